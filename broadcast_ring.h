@@ -0,0 +1,370 @@
+
+#ifndef BROADCAST_RING_H
+#define BROADCAST_RING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+//! Кольцевой буфер с одним писателем и несколькими независимыми читателями.
+//! Каждый подписчик имеет собственную позицию чтения и получает данные
+//! без копирования в виде участков кольца. Отставшие подписчики либо
+//! задерживают писателя (LAG_BLOCK), либо пропускают данные с учетом потерь (LAG_SKIP).
+//! При LAG_SKIP писатель может перезаписывать участок, пока подписчик его
+//! читает, поэтому такие подписчики забирают данные копией через read().
+//-----------------------------------------------------------------------------
+
+class broadcast_ring
+{
+public:
+    enum lag_policy
+    {
+        LAG_BLOCK,  //!< писатель ждет самого медленного подписчика
+        LAG_SKIP,   //!< отставший подписчик перескакивает вперед, потери учитываются
+    };
+
+    //! Непрерывный участок данных кольца
+    struct span
+    {
+        const uint8_t *data{nullptr};
+        size_t size{0};
+    };
+
+    class subscriber
+    {
+    public:
+        explicit subscriber(broadcast_ring &ring) : owner(ring), cursor(ring.published()) {}
+
+        //! Непрерывный участок непрочитанных данных (до конца буфера кольца)
+        span view()
+        {
+            uint64_t pos = cursor.load(std::memory_order_acquire);
+            const uint64_t head = owner.published();
+            const size_t offset = pos & owner.mask;
+            span s;
+            s.data = owner.buffer.data() + offset;
+            s.size = std::min<uint64_t>(head - pos, owner.capacity() - offset);
+            return s;
+        }
+
+        //! Отмечает n байт прочитанными. false - участок был перезаписан писателем (LAG_SKIP)
+        bool consume(size_t n)
+        {
+            uint64_t pos = cursor.load(std::memory_order_relaxed);
+            if (!cursor.compare_exchange_strong(pos, pos + n))
+                return false;
+            owner.notify_space();
+            return true;
+        }
+
+        //! Копирует до max непрочитанных байт в out и отмечает их прочитанными.
+        //! Копия проверяется после чтения: если писатель за это время сдвинул
+        //! позицию подписчика (LAG_SKIP), копия отбрасывается и возвращается 0
+        size_t read(uint8_t *out, size_t max)
+        {
+            uint64_t pos = cursor.load(std::memory_order_acquire);
+            const uint64_t head = owner.published();
+            const size_t offset = pos & owner.mask;
+            const size_t n = std::min<uint64_t>(head - pos, max);
+            const size_t first = std::min(n, owner.capacity() - offset);
+            if (!n)
+                return 0;
+            memcpy(out, owner.buffer.data() + offset, first);
+            memcpy(out + first, owner.buffer.data(), n - first);
+            if (!intact(pos) || !cursor.compare_exchange_strong(pos, pos + n))
+                return 0;
+            owner.notify_space();
+            return n;
+        }
+
+        //! Позиция чтения подписчика
+        uint64_t position() const
+        {
+            return cursor.load(std::memory_order_acquire);
+        }
+
+        //! true - прочитанные с позиции pos данные не были перезаписаны писателем
+        bool intact(uint64_t pos) const
+        {
+            // писатель сдвигает отставших до того, как пишет в кольцо: чтения
+            // данных должны завершиться до проверки позиции
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return cursor.load(std::memory_order_relaxed) == pos;
+        }
+
+        lag_policy policy() const { return owner.policy; }
+
+        //! Ждет, пока непрочитанных данных станет больше have байт;
+        //! false - истек таймаут или кольцо закрыто
+        template <typename rep, typename period>
+        bool wait(const std::chrono::duration<rep, period> &timeout, size_t have = 0)
+        {
+            return owner.wait_data(cursor, have, timeout);
+        }
+
+        size_t available() const
+        {
+            return owner.published() - cursor.load(std::memory_order_acquire);
+        }
+
+        uint64_t lost() const
+        {
+            return lost_bytes.load(std::memory_order_relaxed);
+        }
+
+    private:
+        friend class broadcast_ring;
+
+        broadcast_ring &owner;
+        std::atomic<uint64_t> cursor;
+        std::atomic<uint64_t> lost_bytes{0};
+    };
+
+    using subscriber_t = std::shared_ptr<subscriber>;
+
+    //! Размер кольца округляется вверх до степени двойки. block_timeout - наибольшее
+    //! ожидание писателя при LAG_BLOCK; по его истечении данные отбрасываются с учетом
+    explicit broadcast_ring(size_t size, lag_policy policy = LAG_BLOCK,
+                            std::chrono::milliseconds block_timeout = std::chrono::seconds(1))
+        : policy(policy), block_timeout(block_timeout)
+    {
+        size_t capacity = 1;
+        while (capacity < size)
+            capacity <<= 1;
+        buffer.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    size_t capacity() const { return buffer.size(); }
+
+    //! Подписка начинается с текущей позиции записи
+    subscriber_t subscribe()
+    {
+        auto sub = std::make_shared<subscriber>(*this);
+        std::lock_guard<std::mutex> lock(subs_lock);
+        auto next = std::make_shared<std::vector<subscriber_t>>(*subs);
+        next->push_back(sub);
+        std::atomic_store(&subs, std::shared_ptr<const std::vector<subscriber_t>>(next));
+        return sub;
+    }
+
+    void unsubscribe(const subscriber_t &sub)
+    {
+        {
+            std::lock_guard<std::mutex> lock(subs_lock);
+            auto next = std::make_shared<std::vector<subscriber_t>>(*subs);
+            next->erase(std::remove(next->begin(), next->end(), sub), next->end());
+            std::atomic_store(&subs, std::shared_ptr<const std::vector<subscriber_t>>(next));
+        }
+        notify_space();
+    }
+
+    //! Записывает данные для всех подписчиков; возвращает число записанных байт
+    //! (меньше size, если кольцо закрыто или истекло ожидание подписчиков)
+    size_t write(const uint8_t *data, size_t size)
+    {
+        // публикуется каждый кусок: запись длиннее кольца не упирается в неопубликованное
+        size_t done = 0;
+        while (done < size)
+        {
+            const size_t piece = std::min(size - done, capacity());
+            const size_t n = store_some(data + done, piece);
+            publish(written());
+            done += n;
+            if (n < piece)
+                break;
+        }
+        count_dropped(size - done);
+        return done;
+    }
+
+    //! Записывает данные в кольцо, не делая их доступными подписчикам.
+    //! Позволяет писателю публиковать данные целыми сообщениями через publish().
+    //! Неопубликованные данные занимают не больше емкости кольца: остаток сверх
+    //! нее не записывается и учитывается в dropped().
+    size_t append(const uint8_t *data, size_t size)
+    {
+        const size_t done = store_some(data, size);
+        count_dropped(size - done);
+        return done;
+    }
+
+    //! Делает доступными подписчикам данные до позиции pos (не дальше written())
+    void publish(uint64_t pos)
+    {
+        // запись позиции и проверка ожидающих не должны переставляться;
+        // парный забор - в wait_data()
+        head.store(std::min(pos, tail));
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumers_waiting.load(std::memory_order_relaxed))
+        {
+            {
+                std::lock_guard<std::mutex> lock(wait_lock);
+            }
+            data_cv.notify_all();
+        }
+    }
+
+    //! Позиция записи (включая неопубликованные данные)
+    uint64_t written() const { return tail; }
+
+    //! Закрывает кольцо: пробуждает всех ожидающих
+    void close()
+    {
+        closed = true;
+        {
+            std::lock_guard<std::mutex> lock(wait_lock);
+        }
+        data_cv.notify_all();
+        space_cv.notify_all();
+    }
+
+    bool is_closed() const { return closed.load(); }
+
+    uint64_t published() const { return head.load(std::memory_order_acquire); }
+
+    //! Байты, отброшенные писателем по истечении block_timeout
+    uint64_t dropped() const { return dropped_bytes.load(std::memory_order_relaxed); }
+
+private:
+    //! Записывает сколько возможно из size байт, не публикуя их
+    size_t store_some(const uint8_t *data, size_t size)
+    {
+        size_t done = 0;
+        while (done < size)
+        {
+            size_t n = reserve(std::min(size - done, capacity()));
+            if (!n)
+                break;
+            store(data + done, n);
+            tail += n;
+            done += n;
+        }
+        return done;
+    }
+
+    void count_dropped(size_t n)
+    {
+        if (n && !closed)
+            dropped_bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    //! Освобождает место под n байт; возвращает доступное число байт (0 - кольцо закрыто)
+    size_t reserve(size_t n)
+    {
+        const uint64_t pos = tail;
+        auto active = std::atomic_load(&subs);
+
+        if (policy == LAG_SKIP)
+        {
+            // неопубликованное не должно перезаписывать само себя: тогда граница
+            // сдвига подписчиков не уходит дальше опубликованной позиции
+            n = std::min(n, capacity() - size_t(pos - head.load(std::memory_order_relaxed)));
+            if (!n)
+                return 0;
+
+            // отставшие подписчики сдвигаются вперед, чтобы не читать перезаписанное
+            const uint64_t limit = pos + n - capacity();
+            if (pos + n > capacity())
+            {
+                for (const auto &sub : *active)
+                {
+                    uint64_t cur = sub->cursor.load(std::memory_order_acquire);
+                    while (cur < limit && !sub->cursor.compare_exchange_weak(cur, limit, std::memory_order_acq_rel))
+                    {
+                    }
+                    if (cur < limit)
+                        sub->lost_bytes.fetch_add(limit - cur, std::memory_order_relaxed);
+                }
+            }
+            return n;
+        }
+
+        auto free_space = [&] {
+            uint64_t slowest = pos;
+            for (const auto &sub : *std::atomic_load(&subs))
+                slowest = std::min(slowest, sub->cursor.load(std::memory_order_acquire));
+            return capacity() - size_t(pos - slowest);
+        };
+
+        size_t room = free_space();
+        if (room)
+            return std::min(room, n);
+
+        std::unique_lock<std::mutex> lock(wait_lock);
+        producer_waiting.store(true, std::memory_order_relaxed);
+        // пара с забором в notify_space(): либо подписчик увидит флаг, либо
+        // писатель - сдвинутую подписчиком позицию
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const bool ready = space_cv.wait_for(lock, block_timeout, [&] { return closed || (room = free_space()) != 0; });
+        producer_waiting.store(false, std::memory_order_relaxed);
+        return closed || !ready ? 0 : std::min(room, n);
+    }
+
+    void store(const uint8_t *data, size_t n)
+    {
+        const size_t offset = tail & mask;
+        const size_t first = std::min(n, capacity() - offset);
+        memcpy(buffer.data() + offset, data, first);
+        memcpy(buffer.data(), data + first, n - first);
+    }
+
+    void notify_space()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (producer_waiting.load(std::memory_order_relaxed))
+        {
+            {
+                std::lock_guard<std::mutex> lock(wait_lock);
+            }
+            space_cv.notify_one();
+        }
+    }
+
+    template <typename rep, typename period>
+    bool wait_data(const std::atomic<uint64_t> &cursor, size_t have, const std::chrono::duration<rep, period> &timeout)
+    {
+        auto ready = [&] { return published() - cursor.load(std::memory_order_acquire) > have; };
+        if (ready())
+            return true;
+
+        std::unique_lock<std::mutex> lock(wait_lock);
+        consumers_waiting.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool res = data_cv.wait_for(lock, timeout, [&] { return closed || ready(); });
+        consumers_waiting.fetch_sub(1);
+        return res && ready();
+    }
+
+    lag_policy policy;
+    std::chrono::milliseconds block_timeout;
+    std::vector<uint8_t> buffer;
+    size_t mask{0};
+    std::atomic<uint64_t> head{0};     //!< опубликованная позиция
+    uint64_t tail{0};                  //!< позиция записи, используется только писателем
+    std::atomic<bool> closed{false};
+
+    std::mutex subs_lock;
+    std::shared_ptr<const std::vector<subscriber_t>> subs{std::make_shared<std::vector<subscriber_t>>()};
+
+    std::mutex wait_lock;
+    std::condition_variable data_cv;
+    std::condition_variable space_cv;
+    std::atomic<int> consumers_waiting{0};
+    std::atomic<bool> producer_waiting{false};
+    std::atomic<uint64_t> dropped_bytes{0};
+};
+
+using broadcast_ring_t = std::shared_ptr<broadcast_ring>;
+
+//-----------------------------------------------------------------------------
+
+#endif // BROADCAST_RING_H
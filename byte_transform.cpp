@@ -0,0 +1,554 @@
+
+#include "byte_transform.h"
+#include "exceptinfo.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRANSFORM_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TRANSFORM_NEON 1
+#include <arm_neon.h>
+#endif
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+//! Запас ключа за его концом: вектор ключа читается с любой позиции без переноса.
+//! Короткий ключ повторяется до периода не меньше запаса, чтобы позиция после
+//! вектора переносилась одним вычитанием.
+static constexpr size_t KEY_SLACK = 64;
+
+//! Наименьшая пачка, на которой векторная таблица замен быстрее побайтной
+static constexpr size_t MAP_VECTOR_MIN = 256;
+
+//! Биты тетрады в обратном порядке, в старшей и младшей половине байта
+alignas(16) static const uint8_t reverse_lo[16] = { 0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0 };
+alignas(16) static const uint8_t reverse_hi[16] = { 0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF };
+
+//-----------------------------------------------------------------------------
+// Переносимые ядра
+//-----------------------------------------------------------------------------
+
+static void xor_scalar(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* keystream, size_t key_size, size_t& position)
+{
+    while (size) {
+        const size_t n = std::min(size, key_size - position);
+        const uint8_t* key = keystream + position;
+        for (size_t i = 0; i < n; i++)
+            dst[i] = src[i] ^ key[i];
+        position += n;
+        if (position == key_size)
+            position = 0;
+        src += n;
+        dst += n;
+        size -= n;
+    }
+}
+
+static void map_scalar(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    for (size_t i = 0; i < size; i++)
+        dst[i] = table[src[i]];
+}
+
+//-----------------------------------------------------------------------------
+// SSSE3 и AVX2
+//-----------------------------------------------------------------------------
+
+#if TRANSFORM_X86
+
+__attribute__((target("ssse3")))
+static void xor_ssse3(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* keystream, size_t key_size, size_t& position)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keystream + position));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, k));
+        position += 16;
+        if (position >= key_size)
+            position -= key_size;
+    }
+    xor_scalar(src + i, dst + i, size - i, keystream, key_size, position);
+}
+
+__attribute__((target("ssse3")))
+static void reverse_ssse3(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    const __m128i lo_table = _mm_load_si128(reinterpret_cast<const __m128i*>(reverse_lo));
+    const __m128i hi_table = _mm_load_si128(reinterpret_cast<const __m128i*>(reverse_hi));
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(d, nibble));
+        const __m128i hi = _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(d, 4), nibble));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(lo, hi));
+    }
+    map_scalar(src + i, dst + i, size - i, table);
+}
+
+__attribute__((target("ssse3")))
+static void strip7_ssse3(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    const __m128i mask = _mm_set1_epi8(0x7F);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_and_si128(d, mask));
+    }
+    map_scalar(src + i, dst + i, size - i, table);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* keystream, size_t key_size, size_t& position)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keystream + position));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d, k));
+        position += 32;
+        if (position >= key_size)
+            position -= key_size;
+    }
+    if (i + 16 <= size) {
+        const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keystream + position));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, k));
+        position += 16;
+        if (position >= key_size)
+            position -= key_size;
+        i += 16;
+    }
+    xor_scalar(src + i, dst + i, size - i, keystream, key_size, position);
+}
+
+__attribute__((target("avx2")))
+static void reverse_avx2(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    const __m256i lo_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(reverse_lo)));
+    const __m256i hi_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(reverse_hi)));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(d, nibble));
+        const __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(d, 4), nibble));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(lo, hi));
+    }
+    if (i + 16 <= size) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i lo = _mm_shuffle_epi8(_mm256_castsi256_si128(lo_table), _mm_and_si128(d, _mm256_castsi256_si128(nibble)));
+        const __m128i hi = _mm_shuffle_epi8(_mm256_castsi256_si128(hi_table), _mm_and_si128(_mm_srli_epi16(d, 4), _mm256_castsi256_si128(nibble)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(lo, hi));
+        i += 16;
+    }
+    map_scalar(src + i, dst + i, size - i, table);
+}
+
+__attribute__((target("avx2")))
+static void strip7_avx2(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    const __m256i mask = _mm256_set1_epi8(0x7F);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_and_si256(d, mask));
+    }
+    if (i + 16 <= size) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_and_si128(d, _mm256_castsi256_si128(mask)));
+        i += 16;
+    }
+    map_scalar(src + i, dst + i, size - i, table);
+}
+
+//! Таблица из 256 байт - 16 выборок по младшей тетраде. Для строки h байт с
+//! xor (h << 4) и прибавлением 0x70 с насыщением дает индекс без старшего бита
+//! только при старшей тетраде, равной h; для остальных pshufb возвращает 0.
+//! 16 выборок на вектор окупаются только на длинных пачках и только в AVX2:
+//! с SSSE3 и на пачках FIFO выборка из таблицы по байту быстрее.
+__attribute__((target("avx2")))
+static void map_avx2(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    if (size < MAP_VECTOR_MIN) {
+        map_scalar(src, dst, size, table);
+        return;
+    }
+    __m256i rows[16];
+    for (int h = 0; h < 16; h++)
+        rows[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * h)));
+    const __m256i bias = _mm256_set1_epi8(0x70);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i r = _mm256_setzero_si256();
+        for (int h = 0; h < 16; h++) {
+            const __m256i index = _mm256_adds_epu8(_mm256_xor_si256(d, _mm256_set1_epi8(char(h << 4))), bias);
+            r = _mm256_or_si256(r, _mm256_shuffle_epi8(rows[h], index));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), r);
+    }
+    map_scalar(src + i, dst + i, size - i, table);
+}
+
+#endif // TRANSFORM_X86
+
+//-----------------------------------------------------------------------------
+// NEON
+//-----------------------------------------------------------------------------
+
+#if TRANSFORM_NEON
+
+static void xor_neon(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* keystream, size_t key_size, size_t& position)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), vld1q_u8(keystream + position)));
+        position += 16;
+        if (position >= key_size)
+            position -= key_size;
+    }
+    xor_scalar(src + i, dst + i, size - i, keystream, key_size, position);
+}
+
+static void reverse_neon(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    size_t i = 0;
+#if defined(__aarch64__)
+    for (; i + 16 <= size; i += 16)
+        vst1q_u8(dst + i, vrbitq_u8(vld1q_u8(src + i)));
+#else
+    // в ARMv7 нет rbit для байтов: выборка по тетрадам из таблиц в 16 байт
+    const uint8x8x2_t lo_table = { { vld1_u8(reverse_lo), vld1_u8(reverse_lo + 8) } };
+    const uint8x8x2_t hi_table = { { vld1_u8(reverse_hi), vld1_u8(reverse_hi + 8) } };
+    const uint8x8_t nibble = vdup_n_u8(0x0F);
+    for (; i + 8 <= size; i += 8) {
+        const uint8x8_t d = vld1_u8(src + i);
+        const uint8x8_t lo = vtbl2_u8(lo_table, vand_u8(d, nibble));
+        const uint8x8_t hi = vtbl2_u8(hi_table, vshr_n_u8(d, 4));
+        vst1_u8(dst + i, vorr_u8(lo, hi));
+    }
+#endif
+    map_scalar(src + i, dst + i, size - i, table);
+}
+
+static void strip7_neon(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    const uint8x16_t mask = vdupq_n_u8(0x7F);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+        vst1q_u8(dst + i, vandq_u8(vld1q_u8(src + i), mask));
+    map_scalar(src + i, dst + i, size - i, table);
+}
+
+static void map_neon(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table)
+{
+    size_t i = 0;
+#if defined(__aarch64__)
+    // четыре выборки по 64 байта таблицы; индекс вне выборки оставляет прежний результат
+    uint8x16x4_t quarters[4];
+    for (int q = 0; q < 4; q++) {
+        for (int j = 0; j < 4; j++)
+            quarters[q].val[j] = vld1q_u8(table + 64 * q + 16 * j);
+    }
+    const uint8x16_t step = vdupq_n_u8(64);
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t index = vld1q_u8(src + i);
+        uint8x16_t r = vqtbl4q_u8(quarters[0], index);
+        for (int q = 1; q < 4; q++) {
+            index = vsubq_u8(index, step);
+            r = vqtbx4q_u8(r, quarters[q], index);
+        }
+        vst1q_u8(dst + i, r);
+    }
+#endif
+    map_scalar(src + i, dst + i, size - i, table);
+}
+
+#endif // TRANSFORM_NEON
+
+//-----------------------------------------------------------------------------
+
+using xor_kernel_t = void (*)(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* keystream, size_t key_size, size_t& position);
+using map_kernel_t = void (*)(const uint8_t* src, uint8_t* dst, size_t size, const uint8_t* table);
+
+//! Ядра одного набора команд
+struct transform_kernels
+{
+    xor_kernel_t xor_key;
+    map_kernel_t reverse;
+    map_kernel_t strip7;
+    map_kernel_t map;
+};
+
+static const transform_kernels& get_kernels(transform_isa isa)
+{
+    static const transform_kernels scalar = { xor_scalar, map_scalar, map_scalar, map_scalar };
+#if TRANSFORM_X86
+    static const transform_kernels ssse3 = { xor_ssse3, reverse_ssse3, strip7_ssse3, map_scalar };
+    static const transform_kernels avx2 = { xor_avx2, reverse_avx2, strip7_avx2, map_avx2 };
+    if (isa == TRANSFORM_ISA_SSSE3)
+        return ssse3;
+    if (isa == TRANSFORM_ISA_AVX2)
+        return avx2;
+#elif TRANSFORM_NEON
+    static const transform_kernels neon = { xor_neon, reverse_neon, strip7_neon, map_neon };
+    if (isa == TRANSFORM_ISA_NEON)
+        return neon;
+#endif
+    return scalar;
+}
+
+//-----------------------------------------------------------------------------
+
+const char* transform_isa_name(transform_isa isa)
+{
+    switch (isa) {
+    case TRANSFORM_ISA_SCALAR: return "scalar";
+    case TRANSFORM_ISA_SSSE3: return "ssse3";
+    case TRANSFORM_ISA_AVX2: return "avx2";
+    case TRANSFORM_ISA_NEON: return "neon";
+    }
+    return "unknown";
+}
+
+//-----------------------------------------------------------------------------
+
+std::vector<transform_isa> transform_supported_isa()
+{
+    std::vector<transform_isa> isa{ TRANSFORM_ISA_SCALAR };
+#if TRANSFORM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        isa.push_back(TRANSFORM_ISA_SSSE3);
+    if (__builtin_cpu_supports("avx2"))
+        isa.push_back(TRANSFORM_ISA_AVX2);
+#elif TRANSFORM_NEON
+    isa.push_back(TRANSFORM_ISA_NEON);
+#endif
+    return isa;
+}
+
+//-----------------------------------------------------------------------------
+
+std::vector<uint8_t> make_pn9_key()
+{
+    std::vector<uint8_t> key(511);
+    uint16_t state = 0x1FF;
+    for (auto& byte : key) {
+        byte = uint8_t(state);
+        for (int bit = 0; bit < 8; bit++)
+            state = uint16_t((state >> 1) | (((state ^ (state >> 5)) & 1) << 8));
+    }
+    return key;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Шестнадцатеричные байты с необязательным префиксом 0x
+static bool parse_hex(std::string text, std::vector<uint8_t>& bytes)
+{
+    if (text.compare(0, 2, "0x") == 0 || text.compare(0, 2, "0X") == 0)
+        text.erase(0, 2);
+    if (text.empty() || text.size() % 2)
+        return false;
+    bytes.clear();
+    for (size_t i = 0; i < text.size(); i += 2) {
+        char* end = nullptr;
+        const std::string digits = text.substr(i, 2);
+        const unsigned long value = strtoul(digits.c_str(), &end, 16);
+        if (*end)
+            return false;
+        bytes.push_back(uint8_t(value));
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool transform_keyed(const std::vector<transform_spec>& chain)
+{
+    return std::any_of(chain.begin(), chain.end(), [](const transform_spec& s) { return s.type == TRANSFORM_XOR; });
+}
+
+//-----------------------------------------------------------------------------
+
+bool parse_transforms(const std::string& text, std::vector<transform_spec>& chain)
+{
+    chain.clear();
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        const size_t colon = item.find(':');
+        const std::string name = item.substr(0, colon);
+        const std::string arg = (colon == std::string::npos) ? std::string() : item.substr(colon + 1);
+
+        transform_spec spec;
+        if (name == "xor") {
+            spec.type = TRANSFORM_XOR;
+            if (arg == "pn9")
+                spec.key = make_pn9_key();
+            else if (!parse_hex(arg, spec.key))
+                return false;
+        } else if (name == "reverse" && arg.empty()) {
+            spec.type = TRANSFORM_REVERSE;
+        } else if (name == "strip7" && arg.empty()) {
+            spec.type = TRANSFORM_STRIP7;
+        } else if (name == "map") {
+            spec.type = TRANSFORM_MAP;
+            std::stringstream pairs(arg);
+            std::string pair;
+            while (std::getline(pairs, pair, '/')) {
+                const size_t eq = pair.find('=');
+                std::vector<uint8_t> from, to;
+                if (eq == std::string::npos || !parse_hex(pair.substr(0, eq), from) || !parse_hex(pair.substr(eq + 1), to) ||
+                    from.size() != 1 || to.size() != 1)
+                    return false;
+                spec.replace.emplace_back(from[0], to[0]);
+            }
+            if (spec.replace.empty())
+                return false;
+        } else {
+            return false;
+        }
+        chain.push_back(std::move(spec));
+    }
+    return !chain.empty();
+}
+
+//-----------------------------------------------------------------------------
+
+byte_transform::byte_transform(const std::vector<transform_spec>& chain) :
+    byte_transform(chain, transform_supported_isa().back())
+{
+}
+
+//-----------------------------------------------------------------------------
+
+byte_transform::byte_transform(const std::vector<transform_spec>& chain, transform_isa isa) : _isa(TRANSFORM_ISA_SCALAR)
+{
+    const std::vector<transform_isa> supported = transform_supported_isa();
+    _isa = (std::find(supported.begin(), supported.end(), isa) != supported.end()) ? isa : supported.back();
+
+    for (const auto& spec : chain) {
+        step s;
+        s.type = spec.type;
+        for (unsigned i = 0; i < 256; i++)
+            s.table[i] = uint8_t(i);
+
+        switch (spec.type) {
+        case TRANSFORM_XOR:
+            if (spec.key.empty()) {
+                throw except_info("%s, %d: %s():\n Empty XOR key\n", __FILE__, __LINE__, __FUNCTION__);
+            }
+            s.key_size = spec.key.size() * ((KEY_SLACK + spec.key.size() - 1) / spec.key.size());
+            s.keystream.resize(s.key_size + KEY_SLACK);
+            for (size_t i = 0; i < s.keystream.size(); i++)
+                s.keystream[i] = spec.key[i % spec.key.size()];
+            break;
+        case TRANSFORM_REVERSE:
+            for (unsigned i = 0; i < 256; i++)
+                s.table[i] = uint8_t(reverse_lo[i & 0x0F] | reverse_hi[i >> 4]);
+            break;
+        case TRANSFORM_STRIP7:
+            for (unsigned i = 0; i < 256; i++)
+                s.table[i] = uint8_t(i & 0x7F);
+            break;
+        case TRANSFORM_MAP:
+            for (const auto& r : spec.replace)
+                s.table[r.first] = r.second;
+            break;
+        }
+        steps.push_back(std::move(s));
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void byte_transform::apply(const uint8_t* src, uint8_t* dst, size_t size)
+{
+    if (steps.empty()) {
+        if (src != dst)
+            memmove(dst, src, size);
+        return;
+    }
+
+    // первый шаг читает src, следующие работают на месте в dst
+    const transform_kernels& k = get_kernels(_isa);
+    for (auto& s : steps) {
+        switch (s.type) {
+        case TRANSFORM_XOR:
+            k.xor_key(src, dst, size, s.keystream.data(), s.key_size, s.position);
+            break;
+        case TRANSFORM_REVERSE:
+            k.reverse(src, dst, size, s.table);
+            break;
+        case TRANSFORM_STRIP7:
+            k.strip7(src, dst, size, s.table);
+            break;
+        case TRANSFORM_MAP:
+            k.map(src, dst, size, s.table);
+            break;
+        }
+        src = dst;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void byte_transform::reset()
+{
+    for (auto& s : steps)
+        s.position = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+transform_stage::transform_stage(const std::vector<transform_spec>& rx_chain, const std::vector<transform_spec>& tx_chain) :
+    rx(rx_chain), tx(tx_chain), rx_buf(rx.empty() ? 0 : TRANSFORM_BATCH), tx_buf(tx.empty() ? 0 : TRANSFORM_BATCH)
+{
+}
+
+//-----------------------------------------------------------------------------
+
+size_t transform_stage::read_tx(const uint8_t*& data, size_t max)
+{
+    if (tx.empty())
+        return tx_source(data, max);
+
+    const uint8_t* src = nullptr;
+    const size_t n = tx_source(src, std::min(max, TRANSFORM_BATCH));
+    tx.apply(src, tx_buf.data(), n);
+    data = tx_buf.data();
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+void transform_stage::write_rx(const uint8_t* data, size_t size)
+{
+    if (rx.empty()) {
+        rx_sink(data, size);
+        return;
+    }
+
+    while (size) {
+        const size_t n = std::min(size, TRANSFORM_BATCH);
+        rx.apply(data, rx_buf.data(), n);
+        rx_sink(rx_buf.data(), n);
+        data += n;
+        size -= n;
+    }
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,140 @@
+#ifndef BYTE_TRANSFORM_H
+#define BYTE_TRANSFORM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <functional>
+
+//-----------------------------------------------------------------------------
+//! Побайтные преобразования потока порта: XOR-скремблирование ключом,
+//! перестановка битов байта в обратном порядке, сброс восьмого бита и
+//! таблица замен. Преобразование применяется к пачке целиком; ядра есть в
+//! вариантах SSSE3, AVX2 и NEON с переносимым вариантом на C++, набор команд
+//! выбирается по процессору при создании. Ядра x86 собираются атрибутами
+//! target, поэтому сборка не требует особых ключей компилятора.
+//-----------------------------------------------------------------------------
+
+//! Вид преобразования
+enum transform_type
+{
+    TRANSFORM_XOR,      //!< XOR с повторяющимся ключом; позиция ключа продолжается между пачками,
+                        //!< поэтому поток под ним не должен терять байты (см. transform_stage)
+    TRANSFORM_REVERSE,  //!< биты байта в обратном порядке (устройства с передачей старшим битом вперед)
+    TRANSFORM_STRIP7,   //!< сброс восьмого бита (7-битные символы с битом четности)
+    TRANSFORM_MAP,      //!< замена байтов по таблице
+};
+
+//! Набор команд ядер
+enum transform_isa
+{
+    TRANSFORM_ISA_SCALAR,
+    TRANSFORM_ISA_SSSE3,
+    TRANSFORM_ISA_AVX2,
+    TRANSFORM_ISA_NEON,
+};
+
+const char* transform_isa_name(transform_isa isa);
+
+//! Наборы команд, доступные на этом процессоре (переносимый всегда первый)
+std::vector<transform_isa> transform_supported_isa();
+
+//! Описание шага цепочки преобразований
+struct transform_spec
+{
+    transform_type type{TRANSFORM_XOR};
+    std::vector<uint8_t> key;               //!< ключ TRANSFORM_XOR
+    std::vector<std::pair<uint8_t, uint8_t>> replace;   //!< замены TRANSFORM_MAP, остальные байты не меняются
+};
+
+//! Последовательность PN9 (x^9 + x^5 + 1, начальное состояние 0x1FF) - 511 байт
+//! периода, как при скремблировании в радиотрактах
+std::vector<uint8_t> make_pn9_key();
+
+//! true - в цепочке есть XOR: потеря байта сбивает позицию ключа
+bool transform_keyed(const std::vector<transform_spec>& chain);
+
+//! Разбор цепочки вида "xor:pn9,reverse,strip7,map:e9=65/f1=6e".
+//! Ключ xor - pn9 или шестнадцатеричные байты ("xor:5a", "xor:0x5aa5");
+//! замены map - пары шестнадцатеричных байтов через '/'.
+bool parse_transforms(const std::string& text, std::vector<transform_spec>& chain);
+
+//-----------------------------------------------------------------------------
+
+//! Цепочка преобразований одного направления
+class byte_transform
+{
+public:
+    //! isa - набор команд; недоступный на процессоре заменяется лучшим доступным
+    explicit byte_transform(const std::vector<transform_spec>& chain);
+    byte_transform(const std::vector<transform_spec>& chain, transform_isa isa);
+
+    //! Преобразует size байт из src в dst; dst может совпадать с src
+    void apply(const uint8_t* src, uint8_t* dst, size_t size);
+
+    //! Возвращает ключи XOR к началу
+    void reset();
+
+    bool empty() const { return steps.empty(); }
+    transform_isa isa() const { return _isa; }
+
+private:
+    struct step
+    {
+        transform_type type;
+        std::vector<uint8_t> keystream;     //!< ключ и его повтор на ширину вектора
+        size_t key_size{0};
+        size_t position{0};
+        uint8_t table[256];
+    };
+
+    std::vector<step> steps;
+    transform_isa _isa;
+};
+
+//-----------------------------------------------------------------------------
+
+//! Наибольшая пачка ступени; больший прием преобразуется частями
+constexpr size_t TRANSFORM_BATCH = 4096;
+
+//! Ступень порта: принятые пачки преобразуются перед получателем, а данные
+//! источника - перед передачей ниже. Стоит под сжатием (скремблированные данные
+//! не сжимаются) и над надежной доставкой: ключ XOR идет по потоку без потерь и
+//! повторов, а кадры восстанавливаются после сбоев линии сами. Без надежной
+//! доставки ступень ближе всех к линии, и XOR в ней недопустим. Пустая цепочка
+//! направления пропускает данные без копирования.
+class transform_stage
+{
+public:
+    using source_t = std::function<size_t(const uint8_t*& data, size_t max)>;
+    using sink_t = std::function<void(const uint8_t* data, size_t size)>;
+
+    transform_stage(const std::vector<transform_spec>& rx_chain, const std::vector<transform_spec>& tx_chain);
+
+    //! Источник данных на передачу; задается до запуска порта
+    void set_source(source_t source) { tx_source = std::move(source); }
+
+    //! Получатель преобразованных принятых данных; задается до запуска порта
+    void set_sink(sink_t sink) { rx_sink = std::move(sink); }
+
+    //! Источник для pl_uart::set_tx_source()
+    size_t read_tx(const uint8_t*& data, size_t max);
+
+    //! Получатель для pl_uart::set_rx_sink()
+    void write_rx(const uint8_t* data, size_t size);
+
+    transform_isa isa() const { return rx.empty() ? tx.isa() : rx.isa(); }
+
+private:
+    byte_transform rx;
+    byte_transform tx;
+    std::vector<uint8_t> rx_buf;
+    std::vector<uint8_t> tx_buf;
+    source_t tx_source;
+    sink_t rx_sink;
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // BYTE_TRANSFORM_H
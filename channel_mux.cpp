@@ -0,0 +1,262 @@
+
+#include "channel_mux.h"
+#include "config_parser.h"
+#include "exceptinfo.h"
+#include "crc.h"
+
+#include <string.h>
+#include <algorithm>
+#include <string_view>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+bool parse_mux_channels(const std::string& text, std::vector<mux_channel_params>& channels)
+{
+    std::vector<mux_channel_params> res;
+    std::string_view rest(text);
+
+    while (!rest.empty()) {
+        const size_t comma = rest.find(',');
+        std::string_view item = trim(rest.substr(0, comma));
+        rest = (comma == std::string_view::npos) ? std::string_view() : rest.substr(comma + 1);
+        if (item.empty())
+            continue;
+
+        // id[:priority[:weight]]
+        std::string_view fields[3];
+        unsigned count = 0;
+        while (count < 3) {
+            const size_t colon = item.find(':');
+            fields[count++] = trim(item.substr(0, colon));
+            if (colon == std::string_view::npos)
+                break;
+            item = item.substr(colon + 1);
+            if (count == 3)
+                return false;
+        }
+
+        mux_channel_params ch;
+        if (!parse_value(fields[0], ch.id))
+            return false;
+        if (count > 1 && !parse_value(fields[1], ch.priority))
+            return false;
+        if (count > 2 && (!parse_value(fields[2], ch.weight) || !ch.weight))
+            return false;
+        res.push_back(ch);
+    }
+
+    if (res.empty())
+        return false;
+    channels = res;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+channel_mux::channel_mux(const std::vector<mux_channel_params>& params, unsigned max_payload) :
+    max_payload(std::clamp<unsigned>(max_payload, 1, MUX_MAX_PAYLOAD))
+{
+    std::fill(std::begin(index), std::end(index), -1);
+
+    for (const auto& p : params) {
+        if (index[p.id] >= 0) {
+            throw except_info("%s, %d: %s():\n Duplicate mux channel %u\n", __FILE__, __LINE__, __FUNCTION__, (unsigned)p.id);
+        }
+        index[p.id] = int(channels.size());
+        channels.push_back(channel_state{p, {}, 0, nullptr});
+        channels.back().params.weight = std::max(1u, p.weight);
+    }
+
+    // уровни приоритета по возрастанию номера; внутри уровня - в порядке объявления
+    std::vector<unsigned> priorities;
+    for (const auto& ch : channels)
+        priorities.push_back(ch.params.priority);
+    std::sort(priorities.begin(), priorities.end());
+    priorities.erase(std::unique(priorities.begin(), priorities.end()), priorities.end());
+
+    for (unsigned prio : priorities) {
+        std::vector<unsigned> level;
+        for (unsigned i = 0; i < channels.size(); i++) {
+            if (channels[i].params.priority == prio)
+                level.push_back(i);
+        }
+        levels.push_back(level);
+    }
+    level_pos.assign(levels.size(), 0);
+}
+
+//-----------------------------------------------------------------------------
+
+channel_mux::channel_state* channel_mux::find(uint8_t channel)
+{
+    return index[channel] < 0 ? nullptr : &channels[index[channel]];
+}
+
+//-----------------------------------------------------------------------------
+
+const channel_mux::channel_state* channel_mux::find(uint8_t channel) const
+{
+    return index[channel] < 0 ? nullptr : &channels[index[channel]];
+}
+
+//-----------------------------------------------------------------------------
+
+size_t channel_mux::send(uint8_t channel, const uint8_t* data, size_t size)
+{
+    channel_state* ch = find(channel);
+    if (!ch) {
+        stats.tx_dropped.fetch_add(size, std::memory_order_relaxed);
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> _lock(tx_lock);
+    const size_t n = std::min(size, ch->params.queue_size - std::min(ch->params.queue_size, ch->queue.size()));
+    ch->queue.insert(ch->queue.end(), data, data + n);
+    if (n < size)
+        stats.tx_dropped.fetch_add(size - n, std::memory_order_relaxed);
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t channel_mux::pending(uint8_t channel) const
+{
+    const channel_state* ch = find(channel);
+    if (!ch)
+        return 0;
+    std::lock_guard<std::mutex> _lock(tx_lock);
+    return ch->queue.size();
+}
+
+//-----------------------------------------------------------------------------
+
+void channel_mux::set_handler(uint8_t channel, mux_handler_t handler)
+{
+    channel_state* ch = find(channel);
+    if (!ch) {
+        throw except_info("%s, %d: %s():\n Unknown mux channel %u\n", __FILE__, __LINE__, __FUNCTION__, (unsigned)channel);
+    }
+    ch->handler = std::move(handler);
+}
+
+//-----------------------------------------------------------------------------
+
+bool channel_mux::next_frame()
+{
+    for (size_t l = 0; l < levels.size(); l++) {
+
+        const std::vector<unsigned>& level = levels[l];
+        const bool ready = std::any_of(level.begin(), level.end(), [this](unsigned i) { return !channels[i].queue.empty(); });
+        if (!ready)
+            continue;
+
+        // deficit round robin: при переходе к каналу он получает квант weight * max_payload
+        // и передает кадры, пока их размер покрывается накопленным дефицитом
+        size_t& pos = level_pos[l];
+        while (true) {
+            channel_state& ch = channels[level[pos]];
+            if (!ch.queue.empty()) {
+                const size_t payload = std::min<size_t>(ch.queue.size(), max_payload);
+                if (ch.deficit >= payload) {
+                    ch.deficit -= payload;
+
+                    frame[0] = MUX_SOF;
+                    frame[1] = ch.params.id;
+                    frame[2] = uint8_t(payload);
+                    std::copy_n(ch.queue.begin(), payload, frame + MUX_HEADER_SIZE);
+                    ch.queue.erase(ch.queue.begin(), ch.queue.begin() + payload);
+                    const uint16_t crc = crc::crc16_ccitt(frame + 1, 2 + payload);
+                    frame[MUX_HEADER_SIZE + payload] = uint8_t(crc >> 8);
+                    frame[MUX_HEADER_SIZE + payload + 1] = uint8_t(crc);
+
+                    // опустевший канал не копит дефицит
+                    if (ch.queue.empty())
+                        ch.deficit = 0;
+
+                    frame_size = MUX_HEADER_SIZE + payload + MUX_CRC_SIZE;
+                    frame_offset = 0;
+                    stats.tx_frames.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            } else {
+                ch.deficit = 0;
+            }
+
+            pos = (pos + 1) % level.size();
+            channel_state& next = channels[level[pos]];
+            if (!next.queue.empty())
+                next.deficit += size_t(next.params.weight) * max_payload;
+        }
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t channel_mux::read_tx(const uint8_t*& data, size_t max)
+{
+    // новый кадр выбирается только после передачи текущего целиком
+    if (frame_offset == frame_size) {
+        std::lock_guard<std::mutex> _lock(tx_lock);
+        if (!next_frame())
+            return 0;
+    }
+
+    const size_t n = std::min(max, frame_size - frame_offset);
+    data = frame + frame_offset;
+    frame_offset += n;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+void channel_mux::write_rx(const uint8_t* data, size_t size)
+{
+    rx_pending.insert(rx_pending.end(), data, data + size);
+
+    size_t pos = 0;
+    while (rx_pending.size() - pos >= MUX_HEADER_SIZE + MUX_CRC_SIZE) {
+
+        const uint8_t* p = rx_pending.data() + pos;
+        if (p[0] != MUX_SOF) {
+            ++pos;
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // ложный SOF отбрасывается по заголовку, не дожидаясь p[2] байт данных
+        const size_t payload = p[2];
+        channel_state* ch = find(p[1]);
+        if (payload > max_payload || !ch) {
+            ++pos;
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (rx_pending.size() - pos < MUX_HEADER_SIZE + payload + MUX_CRC_SIZE)
+            break;
+
+        const uint16_t crc = uint16_t((p[MUX_HEADER_SIZE + payload] << 8) | p[MUX_HEADER_SIZE + payload + 1]);
+        if (crc::crc16_ccitt(p + 1, 2 + payload) != crc) {
+            // ложный SOF или искаженный кадр: ищем следующий SOF
+            ++pos;
+            stats.crc_errors.fetch_add(1, std::memory_order_relaxed);
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        if (ch->handler)
+            ch->handler(p[1], p + MUX_HEADER_SIZE, payload);
+        else
+            stats.unknown_channel.fetch_add(1, std::memory_order_relaxed);
+
+        stats.rx_frames.fetch_add(1, std::memory_order_relaxed);
+        pos += MUX_HEADER_SIZE + payload + MUX_CRC_SIZE;
+    }
+    rx_pending.erase(rx_pending.begin(), rx_pending.begin() + pos);
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,116 @@
+#ifndef CHANNEL_MUX_H
+#define CHANNEL_MUX_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+//-----------------------------------------------------------------------------
+//! Виртуальные каналы поверх одного порта.
+//! Кадр: SOF, номер канала, длина, данные (до 255 байт), CRC-16/CCITT от номера
+//! канала до конца данных, старшим байтом вперед. Передатчик выбирает кадр из
+//! очередей каналов строго по приоритету, а среди каналов одного приоритета -
+//! по весам (deficit round robin). Данные канала режутся на кадры не длиннее
+//! max_payload, поэтому срочный кадр ждет не больше одного кадра и содержимого
+//! FIFO. Приемник ищет SOF и проверяет заголовок (известный канал, длина не
+//! больше max_payload) и CRC; при ошибке сдвигается на байт.
+//-----------------------------------------------------------------------------
+
+constexpr uint8_t MUX_SOF = 0x7E;
+constexpr unsigned MUX_HEADER_SIZE = 3;     //!< SOF, канал, длина
+constexpr unsigned MUX_CRC_SIZE = 2;
+constexpr unsigned MUX_MAX_PAYLOAD = 255;
+
+//-----------------------------------------------------------------------------
+
+//! Параметры канала
+struct mux_channel_params
+{
+    uint8_t id{0};
+    unsigned priority{0};       //!< 0 - высший приоритет
+    unsigned weight{1};         //!< доля полосы среди каналов того же приоритета
+    size_t queue_size{1 << 16}; //!< предел очереди канала на передачу
+};
+
+//! Разбор списка каналов вида "id:priority:weight[,id:priority:weight...]"
+bool parse_mux_channels(const std::string& text, std::vector<mux_channel_params>& channels);
+
+//! Обработчик принятых кадров канала
+using mux_handler_t = std::function<void(uint8_t channel, const uint8_t* data, size_t size)>;
+
+//! Счетчики мультиплексора
+struct mux_stats
+{
+    std::atomic<uint64_t> tx_frames{0};
+    std::atomic<uint64_t> tx_dropped{0};        //!< байты, не поместившиеся в очередь канала
+    std::atomic<uint64_t> rx_frames{0};
+    std::atomic<uint64_t> crc_errors{0};
+    std::atomic<uint64_t> skipped_bytes{0};     //!< байты, пропущенные при поиске начала кадра
+    std::atomic<uint64_t> unknown_channel{0};   //!< кадры каналов без обработчика
+};
+
+//-----------------------------------------------------------------------------
+
+//! Мультиплексор каналов; read_tx() и write_rx() подключаются к pl_uart как
+//! источник передачи и получатель приема
+class channel_mux
+{
+public:
+    channel_mux(const std::vector<mux_channel_params>& channels, unsigned max_payload = 64);
+
+    //! Ставит данные в очередь канала; возвращает число принятых байт
+    size_t send(uint8_t channel, const uint8_t* data, size_t size);
+
+    //! Байты в очереди канала на передачу
+    size_t pending(uint8_t channel) const;
+
+    //! Обработчик кадров канала; вызывается потоком приема, задается до запуска порта
+    void set_handler(uint8_t channel, mux_handler_t handler);
+
+    //! Источник для pl_uart::set_tx_source(): следующий кусок текущего кадра
+    size_t read_tx(const uint8_t*& data, size_t max);
+
+    //! Получатель для pl_uart::set_rx_sink(): разбор кадров и раздача по каналам
+    void write_rx(const uint8_t* data, size_t size);
+
+    const mux_stats& get_stats() const { return stats; }
+
+private:
+    struct channel_state
+    {
+        mux_channel_params params;
+        std::deque<uint8_t> queue;
+        size_t deficit{0};
+        mux_handler_t handler;
+    };
+
+    bool next_frame();
+    channel_state* find(uint8_t channel);
+    const channel_state* find(uint8_t channel) const;
+
+    std::vector<channel_state> channels;
+    std::vector<std::vector<unsigned>> levels;  //!< индексы каналов по уровням приоритета
+    std::vector<size_t> level_pos;              //!< текущий канал кругового обхода уровня
+    int index[256];                             //!< номер канала -> индекс, -1 - нет канала
+    unsigned max_payload;
+    mutable std::mutex tx_lock;
+
+    // текущий кадр передачи; используется только потоком передачи
+    uint8_t frame[MUX_HEADER_SIZE + MUX_MAX_PAYLOAD + MUX_CRC_SIZE];
+    size_t frame_size{0};
+    size_t frame_offset{0};
+
+    // несобранный остаток приема; используется только потоком приема
+    std::vector<uint8_t> rx_pending;
+
+    mux_stats stats;
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // CHANNEL_MUX_H
@@ -0,0 +1,321 @@
+#ifndef CHUNK_POOL_H
+#define CHUNK_POOL_H
+
+#include "exceptinfo.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+//! Пул блоков приема фиксированного размера.
+//! Все блоки выделяются одной областью при создании пула; дальше прием не
+//! обращается к куче. Потребитель получает участок блока как chunk_ref -
+//! ссылку со счетчиком владельцев: ее можно передать дальше (разборщику,
+//! журналу, записи в файл) без копирования данных, а блок возвращается в
+//! пул, когда отпущена последняя ссылка. Пул должен жить дольше всех ссылок.
+//-----------------------------------------------------------------------------
+
+class chunk_pool;
+
+//! Заголовок блока пула
+struct pool_chunk
+{
+    std::atomic<uint32_t> refs{0};
+    uint8_t* data{nullptr};
+    chunk_pool* pool{nullptr};
+};
+
+//-----------------------------------------------------------------------------
+
+//! Владеющая ссылка на участок блока пула
+class chunk_ref
+{
+public:
+    chunk_ref() = default;
+
+    chunk_ref(const chunk_ref& other) : chunk(other.chunk), offset(other.offset), length(other.length)
+    {
+        if (chunk)
+            chunk->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    chunk_ref(chunk_ref&& other) noexcept : chunk(other.chunk), offset(other.offset), length(other.length)
+    {
+        other.chunk = nullptr;
+        other.offset = other.length = 0;
+    }
+
+    chunk_ref& operator=(chunk_ref other) noexcept
+    {
+        std::swap(chunk, other.chunk);
+        std::swap(offset, other.offset);
+        std::swap(length, other.length);
+        return *this;
+    }
+
+    ~chunk_ref() { reset(); }
+
+    //! Отпускает ссылку; последняя ссылка возвращает блок в пул
+    inline void reset();
+
+    const uint8_t* data() const { return chunk->data + offset; }
+    size_t size() const { return length; }
+    bool empty() const { return !length; }
+    explicit operator bool() const { return chunk != nullptr; }
+
+    //! Часть участка без копирования; pos и n ограничиваются участком
+    chunk_ref slice(size_t pos, size_t n) const
+    {
+        chunk_ref part(*this);
+        pos = std::min<size_t>(pos, length);
+        part.offset += uint32_t(pos);
+        part.length = uint32_t(std::min(n, length - pos));
+        return part;
+    }
+
+    //! Присоединяет участок того же блока, начинающийся сразу за этим; false - участки не смежны
+    bool extend(const chunk_ref& next)
+    {
+        if (!chunk || next.chunk != chunk || next.offset != offset + length)
+            return false;
+        length += next.length;
+        return true;
+    }
+
+private:
+    friend class chunk_pool;
+    friend class chunk_writer;
+
+    chunk_ref(pool_chunk* chunk, uint32_t length) : chunk(chunk), length(length) {}
+
+    //! Запись в блок; допустима только для еще не отданной потребителям части
+    uint8_t* writable() const { return chunk->data + offset; }
+
+    pool_chunk* chunk{nullptr};
+    uint32_t offset{0};
+    uint32_t length{0};
+};
+
+//-----------------------------------------------------------------------------
+
+//! Счетчики пула
+struct chunk_pool_stats
+{
+    std::atomic<uint64_t> acquired{0};
+    std::atomic<uint64_t> exhausted{0};     //!< запросы блока при пустом пуле
+    std::atomic<size_t> peak_in_use{0};     //!< наибольшее число занятых блоков
+};
+
+//-----------------------------------------------------------------------------
+
+class chunk_pool
+{
+public:
+    chunk_pool(size_t chunk_size, size_t count) : _chunk_size(chunk_size), _count(count)
+    {
+        if (!chunk_size || !count || chunk_size > UINT32_MAX) {
+            throw except_info("%s, %d: %s():\n Bad chunk pool %lu x %lu\n", __FILE__, __LINE__, __FUNCTION__,
+                              (unsigned long)count, (unsigned long)chunk_size);
+        }
+        arena = std::make_unique<uint8_t[]>(chunk_size * count);
+        chunks = std::make_unique<pool_chunk[]>(count);
+        free_list.reserve(count);
+        for (size_t i = count; i > 0; i--) {
+            chunks[i - 1].data = arena.get() + (i - 1) * chunk_size;
+            chunks[i - 1].pool = this;
+            free_list.push_back(&chunks[i - 1]);
+        }
+    }
+
+    chunk_pool(const chunk_pool&) = delete;
+    chunk_pool& operator=(const chunk_pool&) = delete;
+
+    //! Свободный блок целиком; пустая ссылка, если все блоки заняты
+    chunk_ref acquire()
+    {
+        pool_chunk* chunk;
+        size_t in_use;
+        {
+            std::lock_guard<std::mutex> lock(free_lock);
+            if (free_list.empty()) {
+                stats.exhausted.fetch_add(1, std::memory_order_relaxed);
+                return chunk_ref();
+            }
+            chunk = free_list.back();
+            free_list.pop_back();
+            in_use = _count - free_list.size();
+        }
+        chunk->refs.store(1, std::memory_order_relaxed);
+        stats.acquired.fetch_add(1, std::memory_order_relaxed);
+        if (in_use > stats.peak_in_use.load(std::memory_order_relaxed))
+            stats.peak_in_use.store(in_use, std::memory_order_relaxed);
+        return chunk_ref(chunk, uint32_t(_chunk_size));
+    }
+
+    size_t chunk_size() const { return _chunk_size; }
+    size_t count() const { return _count; }
+
+    size_t available() const
+    {
+        std::lock_guard<std::mutex> lock(free_lock);
+        return free_list.size();
+    }
+
+    const chunk_pool_stats& get_stats() const { return stats; }
+
+private:
+    friend class chunk_ref;
+
+    void release(pool_chunk* chunk)
+    {
+        std::lock_guard<std::mutex> lock(free_lock);
+        free_list.push_back(chunk);
+    }
+
+    size_t _chunk_size;
+    size_t _count;
+    std::unique_ptr<uint8_t[]> arena;
+    std::unique_ptr<pool_chunk[]> chunks;
+    mutable std::mutex free_lock;
+    std::vector<pool_chunk*> free_list;     //!< емкость задана заранее, в работе не растет
+    chunk_pool_stats stats;
+};
+
+//-----------------------------------------------------------------------------
+
+inline void chunk_ref::reset()
+{
+    if (chunk && chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        chunk->pool->release(chunk);
+    chunk = nullptr;
+    offset = length = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Очередь участков от потока приема к потребителям.
+//! Участок, продолжающий последний еще не взятый участок того же блока,
+//! дописывается к нему: медленный потребитель получает данные крупнее,
+//! а быстрый - сразу после каждой вычитанной пачки.
+class chunk_queue
+{
+public:
+    //! Емкость кольца; хватает числа блоков пула, так как соседние участки блока сливаются
+    explicit chunk_queue(size_t capacity) : ring(std::max<size_t>(capacity, 1)) {}
+
+    //! false - очередь полна или закрыта, участок отпускается
+    bool push(chunk_ref&& ref)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queue_lock);
+            if (closed)
+                return false;
+            if (!count || !ring[(head + count - 1) % ring.size()].extend(ref)) {
+                if (count == ring.size())
+                    return false;
+                ring[(head + count) % ring.size()] = std::move(ref);
+                count++;
+            }
+        }
+        data_cv.notify_one();
+        ref.reset();
+        return true;
+    }
+
+    //! Забирает участок; false - истек таймаут или очередь закрыта и пуста
+    template <typename rep, typename period>
+    bool pop(chunk_ref& ref, const std::chrono::duration<rep, period>& timeout)
+    {
+        std::unique_lock<std::mutex> lock(queue_lock);
+        if (!data_cv.wait_for(lock, timeout, [this] { return count || closed; }) || !count)
+            return false;
+        ref = std::move(ring[head]);
+        head = (head + 1) % ring.size();
+        count--;
+        return true;
+    }
+
+    //! Пробуждает ожидающих; оставшиеся участки еще можно забрать
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queue_lock);
+            closed = true;
+        }
+        data_cv.notify_all();
+    }
+
+    bool is_closed() const
+    {
+        std::lock_guard<std::mutex> lock(queue_lock);
+        return closed;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(queue_lock);
+        return count;
+    }
+
+private:
+    mutable std::mutex queue_lock;
+    std::condition_variable data_cv;
+    std::vector<chunk_ref> ring;
+    size_t head{0};
+    size_t count{0};
+    bool closed{false};
+};
+
+//-----------------------------------------------------------------------------
+
+//! Получатель приема для uart_device::set_rx_sink(): дописывает пачки в текущий
+//! блок пула и сразу отдает записанный участок в очередь. Блок, заполненный до
+//! конца, заменяется новым; если пул исчерпан, данные отбрасываются с учетом.
+//! Вызывается из одного потока.
+class chunk_writer
+{
+public:
+    chunk_writer(chunk_pool& pool, chunk_queue& queue) : pool(pool), queue(queue) {}
+
+    void write(const uint8_t* data, size_t size)
+    {
+        while (size) {
+            if (!current || used == current.size()) {
+                current = pool.acquire();
+                used = 0;
+                if (!current) {
+                    dropped_bytes.fetch_add(size, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            const size_t n = std::min(size, current.size() - used);
+            memcpy(current.writable() + used, data, n);
+            if (!queue.push(current.slice(used, n)))
+                dropped_bytes.fetch_add(n, std::memory_order_relaxed);
+            used += n;
+            data += n;
+            size -= n;
+        }
+    }
+
+    uint64_t dropped() const { return dropped_bytes.load(std::memory_order_relaxed); }
+
+private:
+    chunk_pool& pool;
+    chunk_queue& queue;
+    chunk_ref current;      //!< блок, в который идет запись
+    size_t used{0};
+    std::atomic<uint64_t> dropped_bytes{0};
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // CHUNK_POOL_H
@@ -2,7 +2,9 @@
 #include <stdio.h>
 #include <signal.h>
 #include <assert.h>
+#include <stdlib.h>
 #include <fstream>
+#include <iterator>
 
 #include "exceptinfo.h"
 #include "config_parser.h"
@@ -240,3 +242,152 @@ bool is_option(int argc, char **argv, const char* name)
 
 //------------------------------------------------------------------------------
 
+std::string_view trim(std::string_view s)
+{
+    const char* ws = " \t\r\n";
+    size_t begin = s.find_first_not_of(ws);
+    if (begin == std::string_view::npos)
+        return std::string_view();
+    size_t end = s.find_last_not_of(ws);
+    return s.substr(begin, end - begin + 1);
+}
+
+//------------------------------------------------------------------------------
+
+config_file::config_file(const std::string& fname)
+{
+    if (!load(fname)) {
+        throw except_info("%s, %d: %s():\n Can't open configuration file: %s\n", __FILE__, __LINE__, __FUNCTION__, fname.c_str());
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool config_file::load(const std::string& fname)
+{
+    std::ifstream ifs(fname.c_str(), std::ios::in | std::ios::binary);
+    if (!ifs.is_open()) {
+        return false;
+    }
+
+    std::string text;
+    ifs.seekg(0, std::ios::end);
+    const std::streamoff size = ifs.tellg();
+    if (size >= 0) {
+        text.resize(size_t(size));
+        ifs.seekg(0, std::ios::beg);
+        ifs.read(&text[0], text.size());
+        text.resize(size_t(ifs.gcount()));
+    } else {
+        // размер неизвестен (канал, устройство) - читаем поток до конца
+        ifs.clear();
+        text.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    if (ifs.bad()) {
+        return false;
+    }
+
+    parse(text);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void config_file::parse(std::string_view text)
+{
+    index.clear();
+    section_names.clear();
+
+    options_t* current = &index[std::string()];
+
+    while (!text.empty()) {
+
+        size_t eol = text.find('\n');
+        std::string_view line = text.substr(0, eol);
+        text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+
+        // отбрасываем комментарии
+        size_t comment = line.find_first_of("#;");
+        if (comment != std::string_view::npos)
+            line = line.substr(0, comment);
+
+        line = trim(line);
+        if (line.empty())
+            continue;
+
+        if (line.front() == '[') {
+            size_t end = line.find(']');
+            std::string name(trim(line.substr(1, end == std::string_view::npos ? std::string_view::npos : end - 1)));
+            auto res = index.try_emplace(name);
+            if (res.second)
+                section_names.push_back(name);
+            current = &res.first->second;
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        if (eq == std::string_view::npos)
+            continue;
+
+        std::string_view key = trim(line.substr(0, eq));
+        std::string_view value = trim(line.substr(eq + 1));
+        if (key.empty() || value.empty())
+            continue;
+
+        (*current)[std::string(key)] = std::string(value);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool config_file::has_section(const std::string& section) const
+{
+    return index.find(section) != index.end();
+}
+
+//------------------------------------------------------------------------------
+
+const std::string* config_file::find(const std::string& section, const std::string& key) const
+{
+    auto sect = index.find(section);
+    if (sect == index.end())
+        return nullptr;
+
+    auto opt = sect->second.find(key);
+    if (opt == sect->second.end())
+        return nullptr;
+
+    return &opt->second;
+}
+
+//------------------------------------------------------------------------------
+
+std::string unescape(const std::string& text)
+{
+    std::string res;
+    for (size_t i = 0; i < text.size(); i++) {
+
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            res += text[i];
+            continue;
+        }
+
+        switch (text[++i]) {
+        case 'n': res += '\n'; break;
+        case 'r': res += '\r'; break;
+        case 't': res += '\t'; break;
+        case '0': res += '\0'; break;
+        case 'x': {
+            std::string hex = text.substr(i + 1, 2);
+            res += char(strtoul(hex.c_str(), nullptr, 16));
+            i += hex.size();
+            break;
+        }
+        default: res += text[i]; break;
+        }
+    }
+    return res;
+}
+
+//-----------------------------------------------------------------------------
@@ -7,6 +7,11 @@
 #include <cstring>
 #include <sstream>
 #include <iomanip>
+#include <charconv>
+#include <string_view>
+#include <unordered_map>
+#include <type_traits>
+#include <limits>
 
 //-----------------------------------------------------------------------------
 
@@ -17,6 +22,10 @@ bool check_string_format(const std::string &s);
 void lowercase(std::string &s);
 unsigned digit_number(unsigned data_size);
 bool is_option(int argc, char **argv, const char* name);
+//! Разбор экранирования \n \r \t \0 \xHH в строковом значении
+std::string unescape(const std::string& text);
+//! Строка без пробелов, табуляций и переводов строки по краям
+std::string_view trim(std::string_view s);
 
 //------------------------------------------------------------------------------
 
@@ -243,4 +252,99 @@ bool get_filter_data(const std::string& fname, std::vector<T>& data)
 
 //-----------------------------------------------------------------------------
 
+//-----------------------------------------------------------------------------
+//! Преобразование строки в значение без потоков ввода-вывода (std::from_chars)
+//! Целые числа с префиксом 0x разбираются как шестнадцатеричные.
+template<typename T>
+bool parse_value(std::string_view s, T& val)
+{
+    if constexpr (std::is_same_v<T, std::string>) {
+        val.assign(s.data(), s.size());
+        return true;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        if (s == "1" || s == "true" || s == "yes" || s == "on") {
+            val = true;
+            return true;
+        }
+        if (s == "0" || s == "false" || s == "no" || s == "off") {
+            val = false;
+            return true;
+        }
+        return false;
+    } else if constexpr (std::is_integral_v<T>) {
+        int base = 10;
+        bool negative = false;
+        if (!s.empty() && (s.front() == '-' || s.front() == '+')) {
+            negative = (s.front() == '-');
+            s.remove_prefix(1);
+        }
+        if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+            s.remove_prefix(2);
+            base = 16;
+        }
+        using unsigned_t = std::make_unsigned_t<T>;
+        unsigned_t res = 0;
+        auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), res, base);
+        if (ec != std::errc() || ptr != s.data() + s.size())
+            return false;
+        // from_chars уже отверг значения шире unsigned_t; остаются знак и половина диапазона
+        const unsigned_t max = unsigned_t(std::numeric_limits<T>::max());
+        if (negative) {
+            if (std::is_unsigned_v<T> ? res != 0 : res > max + 1u)
+                return false;
+            val = T(0 - res);
+        } else {
+            if (res > max)
+                return false;
+            val = T(res);
+        }
+        return true;
+    } else {
+        static_assert(std::is_floating_point_v<T>, "unsupported configuration value type");
+        if (!s.empty() && s.front() == '+')
+            s.remove_prefix(1);
+        auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), val);
+        return (ec == std::errc()) && (ptr == s.data() + s.size());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! Файл конфигурации, разобранный за один проход в индекс секция -> ключ -> значение.
+//! Параметры до первой секции попадают в секцию с пустым именем.
+class config_file {
+
+public:
+    config_file() = default;
+    explicit config_file(const std::string& fname);
+
+    bool load(const std::string& fname);
+    void parse(std::string_view text);
+
+    const std::vector<std::string>& sections() const { return section_names; }
+    bool has_section(const std::string& section) const;
+    const std::string* find(const std::string& section, const std::string& key) const;
+
+    template<typename T> bool get_value(const std::string& section, const std::string& key, T& val) const
+    {
+        const std::string* raw = find(section, key);
+        return raw && parse_value(*raw, val);
+    }
+
+    template<typename T> T get(const std::string& section, const std::string& key, T defValue) const
+    {
+        T res(defValue);
+        if (!get_value(section, key, res))
+            res = defValue;
+        return res;
+    }
+
+private:
+    using options_t = std::unordered_map<std::string, std::string>;
+
+    std::unordered_map<std::string, options_t> index;
+    std::vector<std::string> section_names;
+};
+
+//-----------------------------------------------------------------------------
+
 #endif // CONFIG_PARSER_H
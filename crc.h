@@ -0,0 +1,63 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+//-----------------------------------------------------------------------------
+//! Табличные CRC для кадров, передаваемых через UART
+//-----------------------------------------------------------------------------
+
+namespace crc
+{
+    //! Таблица CRC-16/CCITT (полином 0x1021, старшим битом вперед)
+    constexpr std::array<uint16_t, 256> make_ccitt_table()
+    {
+        std::array<uint16_t, 256> table{};
+        for (unsigned i = 0; i < 256; i++) {
+            uint16_t crc = uint16_t(i << 8);
+            for (int b = 0; b < 8; b++)
+                crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x1021) : uint16_t(crc << 1);
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    inline constexpr std::array<uint16_t, 256> ccitt_table = make_ccitt_table();
+
+    //! CRC-16/CCITT-FALSE; crc - значение для продолжения расчета по частям
+    inline uint16_t crc16_ccitt(const uint8_t* data, size_t size, uint16_t crc = 0xFFFF)
+    {
+        for (size_t i = 0; i < size; i++)
+            crc = uint16_t((crc << 8) ^ ccitt_table[(crc >> 8) ^ data[i]]);
+        return crc;
+    }
+
+    //! Таблица CRC-16/MODBUS (полином 0xA001, младшим битом вперед)
+    constexpr std::array<uint16_t, 256> make_modbus_table()
+    {
+        std::array<uint16_t, 256> table{};
+        for (unsigned i = 0; i < 256; i++) {
+            uint16_t crc = uint16_t(i);
+            for (int b = 0; b < 8; b++)
+                crc = (crc & 1) ? uint16_t((crc >> 1) ^ 0xA001) : uint16_t(crc >> 1);
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    inline constexpr std::array<uint16_t, 256> modbus_table = make_modbus_table();
+
+    //! CRC-16/MODBUS; в кадре передается младшим байтом вперед
+    inline uint16_t crc16_modbus(const uint8_t* data, size_t size, uint16_t crc = 0xFFFF)
+    {
+        for (size_t i = 0; i < size; i++)
+            crc = uint16_t((crc >> 8) ^ modbus_table[(crc ^ data[i]) & 0xFF]);
+        return crc;
+    }
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // CRC_H
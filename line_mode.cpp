@@ -0,0 +1,215 @@
+
+#include "line_mode.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+delim_set::delim_set(const std::string& chars) : delims(chars)
+{
+    if (delims.empty())
+        delims = "\n";
+    memset(table, 0, sizeof(table));
+    for (unsigned char c : delims)
+        table[c] = true;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t delim_set::find(const uint8_t* data, size_t size) const
+{
+    // один разделитель: библиотечный memchr уже векторизован
+    if (delims.size() == 1) {
+        const void* p = memchr(data, (unsigned char)delims[0], size);
+        return p ? size_t(static_cast<const uint8_t*>(p) - data) : size;
+    }
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i hit = _mm_setzero_si128();
+        for (unsigned char c : delims)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)c)));
+        const int mask = _mm_movemask_epi8(hit);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    for (; i + 16 <= size; i += 16) {
+        const uint8x16_t v = vld1q_u8(data + i);
+        uint8x16_t hit = vdupq_n_u8(0);
+        for (unsigned char c : delims)
+            hit = vorrq_u8(hit, vceqq_u8(v, vdupq_n_u8(c)));
+        if (vmaxvq_u8(hit))
+            break;
+    }
+#endif
+
+    for (; i < size; i++) {
+        if (table[data[i]])
+            return i;
+    }
+    return size;
+}
+
+//-----------------------------------------------------------------------------
+
+line_framer::line_framer(broadcast_ring& ring, const delim_set& delims, size_t max_line) :
+    ring(ring), delims(delims), max_line(std::clamp<size_t>(max_line, 1, ring.capacity() / 2))
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void line_framer::write(const uint8_t* data, size_t size)
+{
+    // кусками не длиннее строки: неопубликованный хвост меньше max_line, поэтому
+    // кусок всегда помещается в кольцо (max_line не больше половины емкости)
+    while (size > max_line) {
+        write(data, max_line);
+        data += max_line;
+        size -= max_line;
+    }
+
+    const uint64_t start = ring.written();
+    size = ring.append(data, size);
+
+    // ищем последний разделитель в пачке
+    size_t last = size;
+    for (size_t pos = 0; pos < size; ) {
+        size_t found = pos + delims.find(data + pos, size - pos);
+        if (found == size)
+            break;
+        last = found;
+        pos = found + 1;
+    }
+
+    if (last != size) {
+        ring.publish(start + last + 1);
+        return;
+    }
+
+    // строка без разделителя не должна занимать кольцо бесконечно
+    if (ring.written() - ring.published() >= max_line) {
+        ring.publish(ring.written());
+        ++overlong_count;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+line_reader::line_reader(broadcast_ring::subscriber_t sub, const delim_set& delims, size_t max_line) :
+    sub(sub), delims(delims), max_line(std::max<size_t>(max_line, 1))
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void line_reader::release()
+{
+    if (pending) {
+        sub->consume(pending);
+        pending = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+//! При LAG_SKIP писатель может перезаписать строку, пока она читается прямо из
+//! кольца: строка копируется и отдается, только если позиция подписчика не
+//! сдвинута писателем. torn - строка перезаписана, данные учтены как потерянные
+bool line_reader::settle(std::string_view& line, uint64_t at, bool& torn)
+{
+    if (sub->policy() != broadcast_ring::LAG_SKIP)
+        return true;
+    if (line.data() != reinterpret_cast<const char*>(scratch.data())) {
+        scratch.assign(line.begin(), line.end());
+        line = std::string_view(reinterpret_cast<const char*>(scratch.data()), scratch.size());
+    }
+    if (sub->intact(at))
+        return true;
+    pending = 0;
+    torn = true;
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+bool line_reader::take(std::string_view& line, bool& torn)
+{
+    uint64_t at = sub->position();
+    broadcast_ring::span v = sub->view();
+
+    // пропускаем пустые строки (например, \r\n)
+    size_t skip = 0;
+    while (skip < v.size && delims.contains(v.data[skip]))
+        ++skip;
+    if (skip) {
+        if (!sub->consume(skip)) {
+            torn = true;
+            return false;
+        }
+        at = sub->position();
+        v = sub->view();
+    }
+    if (!v.size)
+        return false;
+
+    const size_t limit = std::min(v.size, max_line);
+    const size_t pos = delims.find(v.data, limit);
+    if (pos < limit) {
+        line = std::string_view(reinterpret_cast<const char*>(v.data), pos);
+        pending = pos + 1;
+        return settle(line, at, torn);
+    }
+
+    if (limit == max_line) {
+        line = std::string_view(reinterpret_cast<const char*>(v.data), max_line);
+        pending = max_line;
+        return settle(line, at, torn);
+    }
+
+    // строка разорвана концом буфера кольца: собираем ее в отдельном буфере
+    const size_t avail = sub->available();
+    if (avail > v.size) {
+        scratch.assign(v.data, v.data + v.size);
+        if (!sub->consume(v.size)) {
+            torn = true;
+            return false;
+        }
+
+        at = sub->position();
+        broadcast_ring::span tail = sub->view();
+        const size_t rest = std::min(tail.size, max_line - scratch.size());
+        const size_t end = delims.find(tail.data, rest);
+        if (end < rest || scratch.size() + rest == max_line) {
+            scratch.insert(scratch.end(), tail.data, tail.data + std::min(end, rest));
+            pending = (end < rest) ? end + 1 : rest;
+            line = std::string_view(reinterpret_cast<const char*>(scratch.data()), scratch.size());
+            return settle(line, at, torn);
+        }
+
+        // продолжение не опубликовано (длинная строка публиковалась частями):
+        // начало уже освобождено в кольце, поэтому отдаем его отдельной строкой
+        line = std::string_view(reinterpret_cast<const char*>(scratch.data()), scratch.size());
+        return true;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,100 @@
+
+#ifndef LINE_MODE_H
+#define LINE_MODE_H
+
+#include "broadcast_ring.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//! Построчный режим приема: данные, вычитанные из FIFO, пишутся в кольцо
+//! рассылки, но публикуются подписчикам только до конца последней полной строки.
+//! Подписчик просыпается один раз на сообщение и получает строки как участки кольца.
+//-----------------------------------------------------------------------------
+
+//! Набор символов-разделителей строк
+class delim_set
+{
+public:
+    explicit delim_set(const std::string& delims = "\r\n");
+
+    //! Позиция первого разделителя в [data, data + size) или size, если его нет
+    size_t find(const uint8_t* data, size_t size) const;
+
+    bool contains(uint8_t c) const { return table[c]; }
+    const std::string& chars() const { return delims; }
+
+private:
+    std::string delims;
+    bool table[256];
+};
+
+//-----------------------------------------------------------------------------
+
+//! Писатель построчного режима; используется как получатель pl_uart::set_rx_sink()
+class line_framer
+{
+public:
+    //! max_line ограничивается половиной кольца
+    line_framer(broadcast_ring& ring, const delim_set& delims, size_t max_line);
+
+    void write(const uint8_t* data, size_t size);
+
+    //! Число строк, опубликованных принудительно из-за превышения max_line
+    uint64_t overlong() const { return overlong_count; }
+
+private:
+    broadcast_ring& ring;
+    const delim_set& delims;
+    size_t max_line;
+    uint64_t overlong_count{0};
+};
+
+//-----------------------------------------------------------------------------
+
+//! Читатель строк одного подписчика кольца
+class line_reader
+{
+public:
+    line_reader(broadcast_ring::subscriber_t sub, const delim_set& delims, size_t max_line);
+
+    //! Следующая непустая строка без разделителя. Строка действительна до
+    //! следующего вызова; false - истек таймаут или кольцо закрыто.
+    template <typename rep, typename period>
+    bool next_line(std::string_view& line, const std::chrono::duration<rep, period>& timeout)
+    {
+        release();
+        while (true) {
+            bool torn = false;
+            if (take(line, torn))
+                return true;
+            if (torn)
+                continue;
+            // ждем новых данных сверх уже просмотренных
+            if (!sub->wait(timeout, sub->available()))
+                return false;
+        }
+    }
+
+    uint64_t lost() const { return sub->lost(); }
+
+private:
+    bool take(std::string_view& line, bool& torn);
+    bool settle(std::string_view& line, uint64_t at, bool& torn);
+    void release();
+
+    broadcast_ring::subscriber_t sub;
+    const delim_set& delims;
+    size_t max_line;
+    size_t pending{0};          //!< сколько байт освободить при следующем вызове
+    std::vector<uint8_t> scratch;  //!< строка, разорванная концом кольца, или копия строки при LAG_SKIP
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // LINE_MODE_H
@@ -0,0 +1,360 @@
+
+#include "lz_stream.h"
+#include "crc.h"
+
+#include <string.h>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+//! Наименьшее совпадение и размер хеш-таблицы поиска совпадений
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr unsigned LZ_HASH_BITS = 12;
+constexpr size_t LZ_MAX_OFFSET = 0xFFFF;
+
+//-----------------------------------------------------------------------------
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned lz_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+//! Длина сверх 15 кодируется байтами 255 и остатком
+static inline bool put_length(uint8_t*& op, const uint8_t* end, size_t len)
+{
+    while (len >= 255) {
+        if (op == end)
+            return false;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op == end)
+        return false;
+    *op++ = uint8_t(len);
+    return true;
+}
+
+static inline bool get_length(const uint8_t*& ip, const uint8_t* end, size_t& len)
+{
+    uint8_t b;
+    do {
+        if (ip == end)
+            return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Последовательность: токен (длина литералов | длина совпадения - 4), литералы,
+//! смещение (16 бит, младшим байтом вперед), продолжение длины совпадения.
+//! Последняя последовательность содержит только литералы.
+static bool put_sequence(uint8_t*& op, const uint8_t* end, const uint8_t* literals, size_t lit_len, size_t offset, size_t match_len)
+{
+    if (op == end)
+        return false;
+    uint8_t* token = op++;
+    *token = uint8_t(std::min<size_t>(lit_len, 15) << 4);
+    if (lit_len >= 15 && !put_length(op, end, lit_len - 15))
+        return false;
+    if (size_t(end - op) < lit_len)
+        return false;
+    if (lit_len)
+        memcpy(op, literals, lit_len);
+    op += lit_len;
+
+    if (!match_len)
+        return true;
+
+    if (end - op < 2)
+        return false;
+    *op++ = uint8_t(offset);
+    *op++ = uint8_t(offset >> 8);
+    const size_t len = match_len - LZ_MIN_MATCH;
+    *token |= uint8_t(std::min<size_t>(len, 15));
+    return len < 15 || put_length(op, end, len - 15);
+}
+
+//-----------------------------------------------------------------------------
+
+size_t lz_compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity)
+{
+    // позиция + 1 последнего вхождения 4-байтовой последовательности, 0 - нет
+    uint32_t table[1 << LZ_HASH_BITS] = {};
+
+    uint8_t* op = dst;
+    const uint8_t* end = dst + capacity;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    while (size >= LZ_MIN_MATCH && i <= size - LZ_MIN_MATCH) {
+
+        const uint32_t seq = read32(src + i);
+        const unsigned h = lz_hash(seq);
+        const size_t cand = table[h];
+        table[h] = uint32_t(i + 1);
+
+        if (!cand || i - (cand - 1) > LZ_MAX_OFFSET || read32(src + cand - 1) != seq) {
+            ++i;
+            continue;
+        }
+
+        const size_t from = cand - 1;
+        size_t len = LZ_MIN_MATCH;
+        while (i + len < size && src[from + len] == src[i + len])
+            ++len;
+
+        if (!put_sequence(op, end, src + anchor, i - anchor, i - from, len))
+            return 0;
+
+        i += len;
+        anchor = i;
+    }
+
+    if (!put_sequence(op, end, src + anchor, size - anchor, 0, 0))
+        return 0;
+
+    return op - dst;
+}
+
+//-----------------------------------------------------------------------------
+
+bool lz_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t size)
+{
+    const uint8_t* ip = src;
+    const uint8_t* ip_end = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* op_end = dst + size;
+
+    while (ip < ip_end) {
+
+        const uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !get_length(ip, ip_end, lit_len))
+            return false;
+        if (size_t(ip_end - ip) < lit_len || size_t(op_end - op) < lit_len)
+            return false;
+        if (lit_len)
+            memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == ip_end)
+            break;
+
+        if (ip_end - ip < 2)
+            return false;
+        const size_t offset = ip[0] | (size_t(ip[1]) << 8);
+        ip += 2;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && !get_length(ip, ip_end, match_len))
+            return false;
+        match_len += LZ_MIN_MATCH;
+
+        if (!offset || size_t(op - dst) < offset || size_t(op_end - op) < match_len)
+            return false;
+
+        // совпадение может перекрывать само себя: копируем побайтно
+        const uint8_t* from = op - offset;
+        for (size_t k = 0; k < match_len; k++)
+            op[k] = from[k];
+        op += match_len;
+    }
+
+    return op == op_end;
+}
+
+//-----------------------------------------------------------------------------
+
+lz_stream::lz_stream(bool compress, size_t block_size) :
+    compress(compress), block_size(std::clamp<size_t>(block_size, 1, LZ_MAX_BLOCK))
+{
+    block.reserve(this->block_size);
+    frame.reserve(LZ_HEADER_SIZE + lz_bound(this->block_size) + LZ_CRC_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+
+bool lz_stream::negotiated() const
+{
+    const int caps = peer_caps.load(std::memory_order_relaxed);
+    return compress && caps >= 0 && (caps & LZ_CAP_LZ);
+}
+
+//-----------------------------------------------------------------------------
+
+void lz_stream::make_frame(uint8_t type, const uint8_t* payload, size_t size, size_t raw_size)
+{
+    frame.resize(LZ_HEADER_SIZE + size + LZ_CRC_SIZE);
+    frame[0] = LZ_SOF0;
+    frame[1] = LZ_SOF1;
+    frame[2] = type;
+    frame[3] = uint8_t(raw_size);
+    frame[4] = uint8_t(raw_size >> 8);
+    frame[5] = uint8_t(size);
+    frame[6] = uint8_t(size >> 8);
+    if (payload != frame.data() + LZ_HEADER_SIZE)
+        memcpy(frame.data() + LZ_HEADER_SIZE, payload, size);
+    const uint16_t crc = crc::crc16_ccitt(frame.data() + 2, LZ_HEADER_SIZE - 2 + size);
+    frame[LZ_HEADER_SIZE + size] = uint8_t(crc >> 8);
+    frame[LZ_HEADER_SIZE + size + 1] = uint8_t(crc);
+    frame_offset = 0;
+    stats.tx_line_bytes.fetch_add(frame.size(), std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+
+bool lz_stream::next_frame()
+{
+    // ответ на HELLO партнера и повтор своего HELLO, пока партнер молчит
+    const bool reply = hello_reply.exchange(false, std::memory_order_relaxed);
+    const ipc_time_t now = ipc_get_time();
+    if (reply || (peer_caps.load(std::memory_order_relaxed) < 0 && now >= next_hello)) {
+        const uint8_t caps = (compress ? LZ_CAP_LZ : 0) | (reply ? LZ_CAP_ACK : 0);
+        make_frame(LZ_FRAME_HELLO, &caps, 1, 0);
+        next_hello = now + LZ_HELLO_PERIOD;
+        return true;
+    }
+
+    // источник отдает данные кусками, собираем из них блок
+    const size_t limit = peer_caps.load(std::memory_order_relaxed) < 0 ? std::min(block_size, LZ_HELLO_BLOCK) : block_size;
+    block.clear();
+    while (block.size() < limit) {
+        const uint8_t* data = nullptr;
+        const size_t n = tx_source ? tx_source(data, limit - block.size()) : 0;
+        if (!n)
+            break;
+        block.insert(block.end(), data, data + n);
+    }
+    if (block.empty())
+        return false;
+
+    stats.tx_raw_bytes.fetch_add(block.size(), std::memory_order_relaxed);
+    stats.tx_blocks.fetch_add(1, std::memory_order_relaxed);
+
+    if (negotiated()) {
+        // сжимаем прямо в кадр; несжимаемый блок уходит как есть
+        frame.resize(LZ_HEADER_SIZE + lz_bound(block.size()) + LZ_CRC_SIZE);
+        const size_t packed = lz_compress(block.data(), block.size(), frame.data() + LZ_HEADER_SIZE, block.size() - 1);
+        if (packed) {
+            make_frame(LZ_FRAME_LZ, frame.data() + LZ_HEADER_SIZE, packed, block.size());
+            stats.tx_compressed.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    make_frame(LZ_FRAME_RAW, block.data(), block.size(), block.size());
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t lz_stream::read_tx(const uint8_t*& data, size_t max)
+{
+    if (frame_offset == frame.size() && !next_frame())
+        return 0;
+
+    const size_t n = std::min(max, frame.size() - frame_offset);
+    data = frame.data() + frame_offset;
+    frame_offset += n;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+void lz_stream::parse_frame(uint8_t type, const uint8_t* payload, size_t size, size_t raw_size)
+{
+    switch (type) {
+    case LZ_FRAME_HELLO:
+        if (size >= 1) {
+            peer_caps.store(payload[0] & ~LZ_CAP_ACK, std::memory_order_relaxed);
+            if (!(payload[0] & LZ_CAP_ACK))
+                hello_reply.store(true, std::memory_order_relaxed);
+        }
+        return;
+
+    case LZ_FRAME_RAW:
+        if (size != raw_size) {
+            stats.decode_errors.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (rx_sink)
+            rx_sink(payload, size);
+        break;
+
+    case LZ_FRAME_LZ:
+        rx_block.resize(raw_size);
+        if (!lz_decompress(payload, size, rx_block.data(), raw_size)) {
+            stats.decode_errors.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (rx_sink)
+            rx_sink(rx_block.data(), raw_size);
+        break;
+
+    default:
+        stats.decode_errors.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    stats.rx_blocks.fetch_add(1, std::memory_order_relaxed);
+    stats.rx_raw_bytes.fetch_add(raw_size, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+
+void lz_stream::write_rx(const uint8_t* data, size_t size)
+{
+    rx_pending.insert(rx_pending.end(), data, data + size);
+
+    size_t pos = 0;
+    while (rx_pending.size() - pos >= LZ_HEADER_SIZE + LZ_CRC_SIZE) {
+
+        const uint8_t* p = rx_pending.data() + pos;
+        if (p[0] != LZ_SOF0 || p[1] != LZ_SOF1) {
+            ++pos;
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        const size_t raw_size = p[3] | (size_t(p[4]) << 8);
+        const size_t payload = p[5] | (size_t(p[6]) << 8);
+        if (raw_size > LZ_MAX_BLOCK || payload > lz_bound(LZ_MAX_BLOCK)) {
+            ++pos;
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (rx_pending.size() - pos < LZ_HEADER_SIZE + payload + LZ_CRC_SIZE)
+            break;
+
+        const uint16_t crc = uint16_t((p[LZ_HEADER_SIZE + payload] << 8) | p[LZ_HEADER_SIZE + payload + 1]);
+        if (crc::crc16_ccitt(p + 2, LZ_HEADER_SIZE - 2 + payload) != crc) {
+            // ложный SOF или искаженный кадр: ищем следующий SOF
+            ++pos;
+            stats.crc_errors.fetch_add(1, std::memory_order_relaxed);
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        parse_frame(p[2], p + LZ_HEADER_SIZE, payload, raw_size);
+        pos += LZ_HEADER_SIZE + payload + LZ_CRC_SIZE;
+    }
+    rx_pending.erase(rx_pending.begin(), rx_pending.begin() + pos);
+}
+
+//-----------------------------------------------------------------------------
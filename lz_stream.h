@@ -0,0 +1,138 @@
+#ifndef LZ_STREAM_H
+#define LZ_STREAM_H
+
+#include "time_ipc.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//! Сжатие потока для медленных линий.
+//! Передаваемые данные собираются в блоки, каждый блок сжимается независимо
+//! кодеком семейства LZ (формат последовательностей как у LZ4) и уходит в кадре:
+//! SOF0, SOF1, тип, исходная длина, длина данных (обе 16 бит, младшим байтом
+//! вперед), данные, CRC-16/CCITT от типа до конца данных. Приемник ищет SOF и
+//! проверяет CRC, поэтому после сбоя теряется только искаженный блок.
+//! Сжатие включается, только если обе стороны объявили его в кадре HELLO;
+//! до этого и для несжимаемых блоков данные идут без сжатия.
+//-----------------------------------------------------------------------------
+
+constexpr uint8_t LZ_SOF0 = 0xC5;
+constexpr uint8_t LZ_SOF1 = 0x5C;
+constexpr unsigned LZ_HEADER_SIZE = 7;      //!< SOF0, SOF1, тип, исходная длина, длина данных
+constexpr unsigned LZ_CRC_SIZE = 2;
+constexpr size_t LZ_BLOCK_SIZE = 1024;      //!< блок по умолчанию
+constexpr size_t LZ_MAX_BLOCK = 4096;
+
+//! Период повтора HELLO, пока партнер не ответил
+constexpr std::chrono::milliseconds LZ_HELLO_PERIOD{200};
+
+//! Блок до ответа партнера: на медленной линии полный блок задержал бы согласование
+constexpr size_t LZ_HELLO_BLOCK = 64;
+
+//! Типы кадров
+enum lz_frame_type
+{
+    LZ_FRAME_RAW = 0,       //!< блок без сжатия
+    LZ_FRAME_LZ = 1,        //!< сжатый блок
+    LZ_FRAME_HELLO = 2,     //!< объявление возможностей: байт флагов LZ_CAP_*
+};
+
+//! Флаги кадра HELLO
+enum lz_caps
+{
+    LZ_CAP_LZ = 0x1,        //!< сторона принимает сжатые блоки и хочет передавать их
+    LZ_CAP_ACK = 0x80,      //!< ответ на HELLO, отвечать на него не нужно
+};
+
+//! Наибольший размер сжатого блока из size байт (несжимаемые данные)
+constexpr size_t lz_bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+//! Сжатие блока; 0 - результат не поместился в capacity
+size_t lz_compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+
+//! Распаковка блока ровно в size байт; false - данные повреждены
+bool lz_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t size);
+
+//-----------------------------------------------------------------------------
+
+//! Счетчики потока сжатия
+struct lz_stats
+{
+    std::atomic<uint64_t> tx_raw_bytes{0};      //!< данные до сжатия
+    std::atomic<uint64_t> tx_line_bytes{0};     //!< байты кадров в линии
+    std::atomic<uint64_t> tx_blocks{0};
+    std::atomic<uint64_t> tx_compressed{0};     //!< блоки, ушедшие сжатыми
+    std::atomic<uint64_t> rx_blocks{0};
+    std::atomic<uint64_t> rx_raw_bytes{0};
+    std::atomic<uint64_t> crc_errors{0};
+    std::atomic<uint64_t> decode_errors{0};
+    std::atomic<uint64_t> skipped_bytes{0};     //!< байты, пропущенные при поиске начала кадра
+};
+
+//! Ступень сжатия между портом и его источником/получателем данных.
+//! read_tx() и write_rx() подключаются к pl_uart как источник передачи и
+//! получатель приема.
+class lz_stream
+{
+public:
+    using source_t = std::function<size_t(const uint8_t*& data, size_t max)>;
+    using sink_t = std::function<void(const uint8_t* data, size_t size)>;
+
+    //! compress - объявлять сжатие партнеру; block_size ограничивается LZ_MAX_BLOCK
+    explicit lz_stream(bool compress, size_t block_size = LZ_BLOCK_SIZE);
+
+    //! Источник несжатых данных на передачу; задается до запуска порта
+    void set_source(source_t source) { tx_source = std::move(source); }
+
+    //! Получатель распакованных данных; задается до запуска порта
+    void set_sink(sink_t sink) { rx_sink = std::move(sink); }
+
+    //! Источник для pl_uart::set_tx_source(): следующий кусок текущего кадра
+    size_t read_tx(const uint8_t*& data, size_t max);
+
+    //! Получатель для pl_uart::set_rx_sink(): разбор кадров и распаковка
+    void write_rx(const uint8_t* data, size_t size);
+
+    //! Обе стороны согласились на сжатие
+    bool negotiated() const;
+
+    const lz_stats& get_stats() const { return stats; }
+
+private:
+    bool next_frame();
+    void make_frame(uint8_t type, const uint8_t* payload, size_t size, size_t raw_size);
+    void parse_frame(uint8_t type, const uint8_t* payload, size_t size, size_t raw_size);
+
+    bool compress;
+    size_t block_size;
+    source_t tx_source;
+    sink_t rx_sink;
+
+    // согласование: прием отмечает HELLO партнера, передача отвечает и повторяет свой
+    std::atomic<int> peer_caps{-1};             //!< -1 - партнер еще не ответил
+    std::atomic<bool> hello_reply{false};
+    ipc_time_t next_hello{};
+
+    // используется только потоком передачи
+    std::vector<uint8_t> block;
+    std::vector<uint8_t> frame;
+    size_t frame_offset{0};
+
+    // используется только потоком приема
+    std::vector<uint8_t> rx_pending;
+    std::vector<uint8_t> rx_block;
+
+    lz_stats stats;
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // LZ_STREAM_H
@@ -1,11 +1,16 @@
 
 #include "config_parser.h"
 #include "pl_uartlite.h"
+#include "uart_port.h"
+#include "uart_discovery.h"
+#include "exceptinfo.h"
 
 //-----------------------------------------------------------------------------
 
 #include <cstdint>
 #include <csignal>
+#include <algorithm>
+#include <sstream>
 
 //-----------------------------------------------------------------------------
 
@@ -22,79 +27,123 @@ void local_signal_handler(int signo)
 
 //-----------------------------------------------------------------------------
 
-void write_job_wrapper(pl_uart& uart)
+int main(int argc, char** argv)
 {
-    uart.write_thread();
-}
+    std::vector<uart_port_params> ports_params;
+
+    // Порты описываются секциями файла конфигурации (-c файл), по одной на порт
+    std::string config_name = get_from_cmdline<std::string>(argc, argv, "-c", "");
+    if (!config_name.empty()) {
+        try {
+            config_file config(config_name);
+            ports_params = get_ports_params(config);
+        } catch (const except_info_t& err) {
+            fprintf(stderr, "%s", err.info.c_str());
+            return -1;
+        }
+    }
 
-//-----------------------------------------------------------------------------
+    // Без файла конфигурации порты можно найти в дереве устройств (-discover корень,
+    // например /proc/device-tree, /sys/bus/platform/devices или каталог-образец)
+    std::string dt_root = get_from_cmdline<std::string>(argc, argv, "-discover", "");
+    if (ports_params.empty() && !dt_root.empty()) {
+        try {
+            ports_params = discover_ports(dt_root);
+        } catch (const except_info_t& err) {
+            fprintf(stderr, "%s", err.info.c_str());
+            return -1;
+        }
+        for (const auto& p : ports_params)
+            fprintf(stderr, "found %s: 0x%x, %u baud\n", p.name.c_str(), p.base_address, p.baud_rate);
+    }
 
-void read_job_wrapper(pl_uart& uart)
-{
-    uart.read_thread();
-}
+    // Иначе работаем с одним PL UART, заданным в командной строке
+    if (ports_params.empty()) {
+        uart_port_params params;
+        params.name = "uart";
+        params.base_address = get_from_cmdline<uint32_t>(argc, argv, "-b", 0x42C00000);
+        ports_params.push_back(params);
+    }
 
-//-----------------------------------------------------------------------------
+    // параметр -baud имеет приоритет над конфигурацией
+    if (is_option(argc, argv, "-baud")) {
+        uint32_t baud_rate = get_from_cmdline<uint32_t>(argc, argv, "-baud", UARTLITE_DEFAULT_BAUD);
+        for (auto& params : ports_params)
+            params.baud_rate = baud_rate;
+    }
 
-int main(int argc, char** argv)
-{
-    // Базовый адрес и размер PL UART на шине AXI
-    uint32_t base_address = get_from_cmdline<uint32_t>(argc, argv, "-b", 0x42C00000);
-    uint32_t aperture_size = 0x10000;
+    // срок ответа транзакции (-t, мс) также имеет приоритет над конфигурацией
+    if (is_option(argc, argv, "-t")) {
+        unsigned timeout_ms = get_from_cmdline<unsigned>(argc, argv, "-t", 10);
+        for (auto& params : ports_params)
+            params.timeout_ms = timeout_ms;
+    }
+
+    // журнал: уровень из командной строки (-log debug|info|warn|error|none)
+    ulog::log_level log_level = ulog::LOG_INFO;
+    std::string log_name = get_from_cmdline<std::string>(argc, argv, "-log", "info");
+    if (!ulog::parse_level(log_name.c_str(), log_level)) {
+        fprintf(stderr, "Unknown log level: %s\n", log_name.c_str());
+        return -1;
+    }
+    ulog::start(log_level);
 
     // выход по Ctrl+C
     signal(SIGINT, local_signal_handler);
 
-    std::deque<uint8_t> rd_queue;
-    std::mutex rd_lock;
-    std::deque<uint8_t> wr_queue;
-    std::mutex wr_lock;
+    // PL UARTLITE UNITS: все порты отображаются через один Mapper. Создаются и открываются
+    // только порты из списка -open (имена или базовые адреса через запятую), по умолчанию все:
+    // конструктор порта уже создает его файлы и сегменты shm, поэтому прочие порты не трогаем
+    std::vector<uart_port_t> ports;
+    try {
+        std::string open_list = get_from_cmdline<std::string>(argc, argv, "-open", "");
+        if (!open_list.empty()) {
+            std::vector<uart_port_params> selected;
+            std::stringstream list(open_list);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                uint32_t address = 0;
+                const bool by_address = parse_value(item, address);
+                auto it = std::find_if(ports_params.begin(), ports_params.end(), [&](const uart_port_params& params) {
+                    return params.name == item || (by_address && params.base_address == address);
+                });
+                if (it == ports_params.end()) {
+                    throw except_info("%s, %d: %s():\n No port '%s' to open\n", __FILE__, __LINE__, __FUNCTION__, item.c_str());
+                }
+                // повтор в списке не создает второй порт на те же файлы
+                if (std::none_of(selected.begin(), selected.end(), [&](const uart_port_params& params) { return params.name == it->name; }))
+                    selected.push_back(*it);
+            }
+            ports_params = selected;
+        }
 
-    // PL UARTLITE UNIT
-    pl_uart uart(base_address, aperture_size, rd_queue, rd_lock, wr_queue, wr_lock);
+        ports = make_ports(get_mapper<Mapper>(), ports_params);
 
-    fprintf(stderr, "Press enter to start UART READ/WRITE THREADS...\n");
-    getchar();
+        open_ports(ports);
+    } catch (const except_info_t& err) {
+        fprintf(stderr, "%s", err.info.c_str());
+        ulog::stop();
+        return -1;
+    }
 
-    auto job_write = make_job<std::thread>(write_job_wrapper, std::ref(uart));
-	auto job_read = make_job<std::thread>(read_job_wrapper, std::ref(uart));
-
-	while (!exit_flag) {
-		if(rd_queue.empty()) {
-			ipc_delay(20);
-		} else {
-    		std::lock_guard<std::mutex> _rlock(rd_lock);
-			std::lock_guard<std::mutex> _wlock(wr_lock);
-    		for (const auto& v : rd_queue) {
-				// поместим символ из приемной очереди в очередь на передачу
-				wr_queue.push_back(v);
-				// удалим символ из приемной очереди
-				rd_queue.pop_front();
-				// напечатем принятый символ из приемной очереди
-				fprintf(stderr, "%c", (int)v);
-			}
-		}
-	}
-/*
-	// Оставил от предыдущей реализации примера. Новый вариант не проверялся.
-	// Число элементов в UART (не используется в текущей реализации)
-    const size_t N = get_from_cmdline<size_t>(argc, argv, "-n", 1);
-	// Таймауцт приема/передачи UART (не используется в текущей реализации)
-    const size_t timeout = get_from_cmdline<size_t>(argc, argv, "-t", 1000);
-    fprintf(stderr, "Press enter to write data into WR_QUEUE... 1\n");
+    fprintf(stderr, "Press enter to start UART READ/WRITE THREADS (%ld ports)...\n", (long)ports.size());
     getchar();
-    {
-        std::lock_guard<std::mutex> _wlock(wr_lock);
-        for (int ii = 0x30; ii < 0x30 + N; ii++) {
-            wr_queue.push_back(ii);
-        }
+
+    for (auto& port : ports)
+        port->start();
+
+    while (!exit_flag) {
+        ipc_delay(20);
     }
-    ipc_delay(3000);
-*/    
-    uart.stop();
 
-	job_write->join();
-    job_read->join();
+    for (auto& port : ports)
+        port->stop();
+
+    for (auto& port : ports)
+        port->join();
+
+    ports.clear();
+    ulog::stop();
 
     return 0;
 }
@@ -0,0 +1,136 @@
+
+#include "mapped_file.h"
+#include "exceptinfo.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+mapped_file_reader::mapped_file_reader(const std::string& fname)
+{
+    fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw except_info("%s, %d: %s() - Can't open file %s: %s\n", __FILE__, __LINE__, __FUNCTION__, fname.c_str(), strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        throw except_info("%s, %d: %s() - Can't stat file %s: %s\n", __FILE__, __LINE__, __FUNCTION__, fname.c_str(), strerror(errno));
+    }
+
+    _size = st.st_size;
+    if (!_size)
+        return;
+
+    void* va = mmap(0, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (va == MAP_FAILED) {
+        ::close(fd);
+        throw except_info("%s, %d: %s() - Can't map file %s: %s\n", __FILE__, __LINE__, __FUNCTION__, fname.c_str(), strerror(errno));
+    }
+
+    // файл читается один раз последовательно
+    madvise(va, _size, MADV_SEQUENTIAL);
+    _data = static_cast<const uint8_t*>(va);
+}
+
+//-----------------------------------------------------------------------------
+
+mapped_file_reader::~mapped_file_reader()
+{
+    if (_data)
+        munmap(const_cast<uint8_t*>(_data), _size);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+//-----------------------------------------------------------------------------
+
+mapped_file_writer::mapped_file_writer(const std::string& fname, size_t prealloc_size)
+{
+    fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw except_info("%s, %d: %s() - Can't create file %s: %s\n", __FILE__, __LINE__, __FUNCTION__, fname.c_str(), strerror(errno));
+    }
+
+    try {
+        reserve(std::max<size_t>(prealloc_size, sysconf(_SC_PAGESIZE)));
+    } catch (...) {
+        ::close(fd);
+        fd = -1;
+        throw;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+mapped_file_writer::~mapped_file_writer()
+{
+    close();
+}
+
+//-----------------------------------------------------------------------------
+
+void mapped_file_writer::reserve(size_t capacity)
+{
+    // место под файл выделяется заранее, чтобы запись в отображение не приводила к SIGBUS
+    int res = posix_fallocate(fd, 0, capacity);
+    if (res == EOPNOTSUPP || res == EINVAL) {
+        res = ftruncate(fd, capacity) ? errno : 0;
+    }
+    if (res) {
+        throw except_info("%s, %d: %s() - Can't allocate %ld bytes: %s\n", __FILE__, __LINE__, __FUNCTION__, (long)capacity, strerror(res));
+    }
+
+    void* va = _data ? mremap(_data, _capacity, capacity, MREMAP_MAYMOVE)
+                     : mmap(0, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (va == MAP_FAILED) {
+        throw except_info("%s, %d: %s() - Can't map %ld bytes: %s\n", __FILE__, __LINE__, __FUNCTION__, (long)capacity, strerror(errno));
+    }
+
+    _data = static_cast<uint8_t*>(va);
+    _capacity = capacity;
+}
+
+//-----------------------------------------------------------------------------
+
+void mapped_file_writer::write(const uint8_t* data, size_t size)
+{
+    if (_size + size > _capacity) {
+        reserve(std::max(_capacity * 2, _size + size));
+    }
+
+    memcpy(_data + _size, data, size);
+    _size += size;
+}
+
+//-----------------------------------------------------------------------------
+
+void mapped_file_writer::close()
+{
+    if (_data) {
+        munmap(_data, _capacity);
+        _data = nullptr;
+    }
+    if (fd >= 0) {
+        if (ftruncate(fd, _size) < 0) {
+            fprintf(stderr, "%s(): can't truncate file to %ld bytes\n", __func__, (long)_size);
+        }
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
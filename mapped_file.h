@@ -0,0 +1,61 @@
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+//-----------------------------------------------------------------------------
+
+//! Файл, отображенный в память только для чтения (источник для передачи)
+class mapped_file_reader
+{
+public:
+    explicit mapped_file_reader(const std::string& fname);
+    virtual ~mapped_file_reader();
+
+    mapped_file_reader(const mapped_file_reader&) = delete;
+    mapped_file_reader& operator=(const mapped_file_reader&) = delete;
+
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    int fd{-1};
+    const uint8_t* _data{nullptr};
+    size_t _size{0};
+};
+
+//-----------------------------------------------------------------------------
+
+//! Файл приема: заранее выделяется и отображается в память, при заполнении
+//! увеличивается вдвое; при закрытии обрезается до фактически записанного размера.
+class mapped_file_writer
+{
+public:
+    mapped_file_writer(const std::string& fname, size_t prealloc_size);
+    virtual ~mapped_file_writer();
+
+    mapped_file_writer(const mapped_file_writer&) = delete;
+    mapped_file_writer& operator=(const mapped_file_writer&) = delete;
+
+    //! Дописывает данные в конец файла
+    void write(const uint8_t* data, size_t size);
+    void close();
+
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+
+private:
+    void reserve(size_t capacity);
+
+    int fd{-1};
+    uint8_t* _data{nullptr};
+    size_t _size{0};
+    size_t _capacity{0};
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // MAPPED_FILE_H
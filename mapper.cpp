@@ -81,8 +81,28 @@ void Mapper::closeDevMem()
 
 //-----------------------------------------------------------------------------
 
+void* Mapper::findMapped(size_t pa, uint32_t size)
+{
+    for(const auto& map : mappedList) {
+        if((pa >= map.physicalAddress) && (pa + size <= map.physicalAddress + map.areaSize)) {
+            return static_cast<uint8_t*>(map.virtualAddress) + (pa - map.physicalAddress);
+        }
+    }
+    return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+
 void* Mapper::map(size_t physicalAddress, uint32_t areaSize)
 {
+    std::lock_guard<std::mutex> lock(mapLock);
+
+    // область уже отображена (например, несколько портов в одной апертуре)
+    void* va = findMapped(physicalAddress, areaSize);
+    if(va) {
+        return va;
+    }
+
     struct map_addr_t map = {0, physicalAddress, areaSize};
 
     map.virtualAddress = mmap(0, map.areaSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, (off_t)map.physicalAddress);
@@ -99,22 +119,14 @@ void* Mapper::map(size_t physicalAddress, uint32_t areaSize)
 
 void* Mapper::map(void* physicalAddress, uint32_t areaSize)
 {
-    struct map_addr_t map = {0, reinterpret_cast<size_t>(physicalAddress), areaSize};
-
-    map.virtualAddress = mmap(0, map.areaSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, (off_t)map.physicalAddress);
-    if(map.virtualAddress == MAP_FAILED) {
-        throw except_info("%s, %d: %s() - Error in IPC_mapPhysAddr().\n", __FILE__, __LINE__, __FUNCTION__);
-    }
-
-    mappedList.push_back(map);
-
-    return map.virtualAddress;
+    return map(reinterpret_cast<size_t>(physicalAddress), areaSize);
 }
 
 //-----------------------------------------------------------------------------
 
 void Mapper::unmap(void* va)
 {
+    std::lock_guard<std::mutex> lock(mapLock);
     for(unsigned i=0; i<mappedList.size(); i++) {
         struct map_addr_t map = mappedList.at(i);
         if(map.virtualAddress == va) {
@@ -131,6 +143,7 @@ void Mapper::unmap(void* va)
 
 void Mapper::unmap()
 {
+    std::lock_guard<std::mutex> lock(mapLock);
     for(unsigned i=0; i<mappedList.size(); i++) {
         struct map_addr_t map = mappedList.at(i);
         if(map.virtualAddress) {
@@ -7,6 +7,7 @@
 #include <string>
 #include <sstream>
 #include <memory>
+#include <mutex>
 
 //-----------------------------------------------------------------------------
 
@@ -34,9 +35,12 @@ public:
 private:
     int fd;
     bool extHandle;
+    std::mutex mapLock;
 
     std::vector<struct map_addr_t> mappedList;
 
+    void* findMapped(size_t pa, uint32_t size);
+
     int openDevMem();
     void closeDevMem();
 };
@@ -0,0 +1,198 @@
+#include "config_parser.h"
+#include "sim_uartlite.h"
+#include "modbus_rtu.h"
+#include "ulog.h"
+
+//-----------------------------------------------------------------------------
+
+#include <cstdint>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Пропускная способность цикла опроса Modbus RTU на модели UART Lite. Каждая
+// линия - две модели, соединенные крест-накрест: на одной работает мастер
+// modbus_poller, на другой - modbus_server с несколькими устройствами. Обе
+// стороны определяют границы кадров по тишине линии через pl_uart::transact().
+//-----------------------------------------------------------------------------
+
+using namespace pl_uartlite;
+
+//-----------------------------------------------------------------------------
+
+static volatile int exit_flag = 0;
+void local_signal_handler(int /*signo*/)
+{
+    exit_flag = 1;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Линия: мастер и сервер на двух моделях, выход каждой модели - вход другой
+struct bench_line
+{
+    bench_line(uint32_t baud_rate, uint64_t seed) :
+        master_model(baud_rate, UARTLITE_CHAR_BITS, UARTLITE_FIFO_DEPTH, seed),
+        slave_model(baud_rate, UARTLITE_CHAR_BITS, UARTLITE_FIFO_DEPTH, seed + 1),
+        master_uart(sim_bus(&master_model), rd_queue[0], rd_lock[0], wr_queue[0], wr_lock[0], baud_rate),
+        slave_uart(sim_bus(&slave_model), rd_queue[1], rd_lock[1], wr_queue[1], wr_lock[1], baud_rate),
+        server(slave_uart)
+    {
+        master_model.connect(slave_model);
+    }
+
+    sim_uartlite master_model;
+    sim_uartlite slave_model;
+    std::deque<uint8_t> rd_queue[2];
+    std::mutex rd_lock[2];
+    std::deque<uint8_t> wr_queue[2];
+    std::mutex wr_lock[2];
+    sim_pl_uart master_uart;
+    sim_pl_uart slave_uart;
+    modbus_server server;
+
+    std::vector<std::chrono::nanoseconds> latency;  //!< время транзакций, пишет только поток линии
+    uint64_t mismatches{0};                         //!< прочитанные значения не совпали с заданными
+};
+
+//-----------------------------------------------------------------------------
+
+//! Значение входного регистра устройства в прогоне
+static uint16_t input_value(unsigned slave, unsigned reg)
+{
+    return uint16_t(slave * 1000 + reg);
+}
+
+//-----------------------------------------------------------------------------
+
+static double percentile_us(std::vector<std::chrono::nanoseconds>& v, double p)
+{
+    if (v.empty())
+        return 0;
+    const size_t i = std::min(v.size() - 1, size_t(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i].count() / 1000.0;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const uint32_t baud_rate = get_from_cmdline<uint32_t>(argc, argv, "-baud", 115200);
+    const unsigned ports = std::max(1u, get_from_cmdline<unsigned>(argc, argv, "-ports", 2));
+    const unsigned slaves = std::clamp(get_from_cmdline<unsigned>(argc, argv, "-slaves", 3), 1u, 247u);
+    const unsigned regs = std::clamp<unsigned>(get_from_cmdline<unsigned>(argc, argv, "-regs", 10), 1, MODBUS_MAX_READ);
+    const unsigned duration_ms = get_from_cmdline<unsigned>(argc, argv, "-d", 2000);
+
+    ulog::start(ulog::LOG_ERROR);
+    signal(SIGINT, local_signal_handler);
+
+    // в цикле каждое устройство линии читается и получает одну запись
+    std::vector<modbus_request> requests;
+    for (unsigned s = 1; s <= slaves; s++) {
+        modbus_request read;
+        read.slave = uint8_t(s);
+        read.function = MODBUS_READ_INPUT;
+        read.count = uint16_t(regs);
+        requests.push_back(read);
+
+        modbus_request write;
+        write.slave = uint8_t(s);
+        write.function = MODBUS_WRITE_SINGLE;
+        write.values = { uint16_t(s) };
+        requests.push_back(write);
+    }
+
+    std::vector<std::unique_ptr<bench_line>> lines;
+    modbus_poller poller;
+    for (unsigned i = 0; i < ports; i++) {
+        lines.push_back(std::make_unique<bench_line>(baud_rate, 100 * (i + 1)));
+        for (unsigned s = 1; s <= slaves; s++) {
+            auto slave = std::make_shared<modbus_slave>(uint8_t(s), 16, uint16_t(regs));
+            for (unsigned r = 0; r < regs; r++)
+                slave->write_input(uint16_t(r), input_value(s, r));
+            lines.back()->server.add_slave(slave);
+        }
+        poller.add_line(lines.back()->master_uart, requests);
+    }
+
+    poller.set_handler([&lines](size_t line, const modbus_request& req, const modbus_reply& reply) {
+        bench_line& l = *lines[line];
+        l.latency.push_back(reply.timing.complete);
+        if (reply.status == MODBUS_OK && req.function == MODBUS_READ_INPUT) {
+            for (unsigned r = 0; r < reply.values.size(); r++) {
+                if (reply.values[r] != input_value(req.slave, req.address + r))
+                    l.mismatches++;
+            }
+        }
+    });
+
+    std::atomic<bool> servers_stop{false};
+    std::vector<job_t> servers;
+    for (auto& l : lines) {
+        bench_line* line = l.get();
+        servers.push_back(make_job<std::thread>([line, &servers_stop] {
+            while (!servers_stop)
+                line->server.serve(std::chrono::milliseconds(20));
+        }));
+    }
+
+    const ipc_time_t start = ipc_get_time();
+    poller.start();
+    const ipc_time_t stop_time = start + std::chrono::milliseconds(duration_ms);
+    while (!exit_flag && ipc_get_time() < stop_time)
+        ipc_delay(10);
+    poller.stop();
+    poller.join();
+    const double elapsed = std::chrono::duration<double>(ipc_get_time() - start).count();
+
+    servers_stop = true;
+    for (auto& job : servers)
+        job->join();
+
+    // идеальная транзакция: запрос, тишина перед ответом, ответ, тишина перед следующим запросом
+    const modbus_timing mt = get_modbus_timing(baud_rate);
+    line_timing lt;
+    lt.baud_rate = baud_rate;
+    const auto read_time = lt.char_time() * (8 + 5 + 2 * regs) + 2 * mt.t3_5;
+    const auto write_time = lt.char_time() * (8 + 8) + 2 * mt.t3_5;
+    const double ideal_cycle = std::chrono::duration<double>((read_time + write_time) * slaves).count();
+
+    fprintf(stderr, "modbus: %u baud, %u ports x %u slaves, read %u registers + write 1 per slave, t3.5 %ld us\n",
+            baud_rate, ports, slaves, regs, (long)(mt.t3_5.count() / 1000));
+    fprintf(stderr, "ideal cycle %.2f ms (%.0f cycles/s per port)\n", ideal_cycle * 1e3, 1.0 / ideal_cycle);
+    fprintf(stderr, "%5s %10s %10s %6s %9s %9s %9s %5s %5s %5s %5s %9s\n",
+            "port", "cycles/s", "trans/s", "eff", "p50 us", "p99 us", "timeouts", "crc", "bad", "gap", "exc", "mismatch");
+
+    double total_cycles = 0;
+    bool failed = false;
+    for (size_t i = 0; i < lines.size(); i++) {
+        bench_line& l = *lines[i];
+        const modbus_stats& st = poller.master(i).get_stats();
+        const double cps = poller.cycles(i) / elapsed;
+        total_cycles += cps;
+        fprintf(stderr, "%5zu %10.1f %10.1f %6.2f %9.0f %9.0f %9lu %5lu %5lu %5lu %5lu %9lu\n", i, cps, st.requests / elapsed,
+                cps * ideal_cycle, percentile_us(l.latency, 0.5), percentile_us(l.latency, 0.99),
+                (unsigned long)st.timeouts, (unsigned long)st.crc_errors, (unsigned long)st.bad_frames,
+                (unsigned long)st.gap_errors, (unsigned long)st.exceptions, (unsigned long)l.mismatches);
+
+        for (unsigned s = 1; s <= slaves; s++)
+            failed |= (l.server.slave(uint8_t(s))->read_holding(0) != s);
+        failed |= (l.mismatches != 0 || st.exceptions != 0);
+    }
+    fprintf(stderr, "total %.1f cycles/s, %.1f transactions/s\n", total_cycles, total_cycles * requests.size());
+    fprintf(stderr, "%s\n", failed ? "FAILED: wrong register values" : "registers OK");
+
+    if (uart_profile::profile_enabled) {
+        for (size_t i = 0; i < lines.size(); i++) {
+            const std::string name = "modbus master " + std::to_string(i);
+            uart_profile::print_profile(stderr, name.c_str(), lines[i]->master_uart.get_profile());
+        }
+    }
+
+    ulog::stop();
+
+    return failed ? 1 : 0;
+}
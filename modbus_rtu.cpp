@@ -0,0 +1,566 @@
+
+#include "modbus_rtu.h"
+#include "config_parser.h"
+#include "exceptinfo.h"
+#include "crc.h"
+
+#include <string.h>
+#include <algorithm>
+#include <string_view>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+using namespace pl_uartlite;
+
+//-----------------------------------------------------------------------------
+
+static inline void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = uint8_t(v >> 8);
+    p[1] = uint8_t(v);
+}
+
+static inline uint16_t get16(const uint8_t* p)
+{
+    return uint16_t((p[0] << 8) | p[1]);
+}
+
+//-----------------------------------------------------------------------------
+
+const char* modbus_status_name(modbus_status status)
+{
+    static const char* names[] = { "ok", "timeout", "crc error", "bad response", "exception", "gap error", "stopped" };
+    return unsigned(status) < sizeof(names) / sizeof(names[0]) ? names[status] : "unknown";
+}
+
+//-----------------------------------------------------------------------------
+
+modbus_timing get_modbus_timing(uint32_t baud_rate)
+{
+    modbus_timing t;
+    if (!baud_rate)
+        return t;
+
+    t.char_time = std::chrono::nanoseconds(1000000000ull * MODBUS_CHAR_BITS / baud_rate);
+    if (baud_rate > 19200) {
+        t.t1_5 = std::chrono::microseconds(750);
+        t.t3_5 = std::chrono::microseconds(1750);
+    } else {
+        t.t1_5 = t.char_time * 3 / 2;
+        t.t3_5 = t.char_time * 7 / 2;
+    }
+    return t;
+}
+
+//-----------------------------------------------------------------------------
+
+bool parse_modbus_requests(const std::string& text, std::vector<modbus_request>& requests)
+{
+    std::vector<modbus_request> res;
+    std::string_view rest(text);
+
+    while (!rest.empty()) {
+        const size_t comma = rest.find(',');
+        std::string_view item = trim(rest.substr(0, comma));
+        rest = (comma == std::string_view::npos) ? std::string_view() : rest.substr(comma + 1);
+        if (item.empty())
+            continue;
+
+        // slave:function:address:count или slave:function:address:value[/value...]
+        std::string_view fields[4];
+        for (unsigned i = 0; i < 4; i++) {
+            const size_t colon = item.find(':');
+            if ((i < 3) == (colon == std::string_view::npos))
+                return false;
+            fields[i] = trim(item.substr(0, colon));
+            item = (i < 3) ? item.substr(colon + 1) : std::string_view();
+        }
+
+        modbus_request req;
+        unsigned function = 0;
+        if (!parse_value(fields[0], req.slave) || !parse_value(fields[1], function) || !parse_value(fields[2], req.address))
+            return false;
+        req.function = uint8_t(function);
+
+        if (req.function == MODBUS_WRITE_SINGLE || req.function == MODBUS_WRITE_MULTIPLE) {
+            std::string_view values = fields[3];
+            while (!values.empty()) {
+                const size_t slash = values.find('/');
+                uint16_t v;
+                if (!parse_value(trim(values.substr(0, slash)), v))
+                    return false;
+                req.values.push_back(v);
+                values = (slash == std::string_view::npos) ? std::string_view() : values.substr(slash + 1);
+            }
+            req.count = uint16_t(req.values.size());
+        } else if (!parse_value(fields[3], req.count)) {
+            return false;
+        }
+
+        modbus_frame frame;
+        if (!modbus_encode(req, frame))
+            return false;
+        res.push_back(req);
+    }
+
+    if (res.empty())
+        return false;
+    requests = res;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool modbus_encode(const modbus_request& request, modbus_frame& frame)
+{
+    const bool broadcast = request.slave == MODBUS_BROADCAST;
+    uint8_t* p = frame.adu;
+    size_t n = 0;
+
+    frame.request = request;
+    p[n++] = request.slave;
+    p[n++] = request.function;
+    put16(p + n, request.address);
+    n += 2;
+
+    switch (request.function) {
+    case MODBUS_READ_HOLDING:
+    case MODBUS_READ_INPUT:
+        // чтение без ответа не имеет смысла
+        if (broadcast || !request.count || request.count > MODBUS_MAX_READ)
+            return false;
+        put16(p + n, request.count);
+        n += 2;
+        frame.reply_size = 5 + 2 * request.count;
+        break;
+
+    case MODBUS_WRITE_SINGLE:
+        if (request.values.size() != 1)
+            return false;
+        put16(p + n, request.values[0]);
+        n += 2;
+        frame.request.count = 1;
+        frame.reply_size = 8;
+        break;
+
+    case MODBUS_WRITE_MULTIPLE:
+        if (request.values.empty() || request.values.size() > MODBUS_MAX_WRITE)
+            return false;
+        frame.request.count = uint16_t(request.values.size());
+        put16(p + n, frame.request.count);
+        n += 2;
+        p[n++] = uint8_t(2 * frame.request.count);
+        for (uint16_t v : request.values) {
+            put16(p + n, v);
+            n += 2;
+        }
+        frame.reply_size = 8;
+        break;
+
+    default:
+        return false;
+    }
+
+    const uint16_t crc = crc::crc16_modbus(p, n);
+    p[n++] = uint8_t(crc);
+    p[n++] = uint8_t(crc >> 8);
+    frame.size = n;
+    if (broadcast)
+        frame.reply_size = 0;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool modbus_crc_ok(const uint8_t* adu, size_t size)
+{
+    if (size < 3)
+        return false;
+    const uint16_t crc = uint16_t(adu[size - 2] | (adu[size - 1] << 8));
+    return crc::crc16_modbus(adu, size - 2) == crc;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Пауза внутри кадра: промежуток между чтениями байтов включает время самого символа
+static bool gap_violated(const transact_timing& t, const modbus_timing& timing)
+{
+    return t.max_gap > timing.char_time + timing.t1_5;
+}
+
+//-----------------------------------------------------------------------------
+
+modbus_master::modbus_master(uart_device& uart, const modbus_params& p) :
+    uart(uart), params(p), timing(get_modbus_timing(uart.get_timing().baud_rate))
+{
+    response.reserve(MODBUS_MAX_ADU);
+}
+
+//-----------------------------------------------------------------------------
+
+modbus_status modbus_master::execute(const modbus_request& request, modbus_reply& reply)
+{
+    modbus_frame frame;
+    if (!modbus_encode(request, frame)) {
+        throw except_info("%s, %d: %s():\n Bad Modbus request: slave %u, function %u, count %u\n", __FILE__, __LINE__, __FUNCTION__,
+                          (unsigned)request.slave, (unsigned)request.function, (unsigned)request.count);
+    }
+    return execute(frame, reply);
+}
+
+//-----------------------------------------------------------------------------
+
+modbus_status modbus_master::execute(const modbus_frame& frame, modbus_reply& reply)
+{
+    reply.status = MODBUS_OK;
+    reply.exception = 0;
+    reply.values.clear();
+    reply.timing = transact_timing();
+    stats.requests.fetch_add(1, std::memory_order_relaxed);
+
+    // тишина 3.5 символа после предыдущего кадра; она короче кванта планировщика, поэтому не спим
+    while (ipc_get_time() < line_idle)
+        std::this_thread::yield();
+
+    // срок отсчитывается от конца передачи запроса до начала ответа: время самих
+    // кадров на линии к нему добавляется, иначе длинный ответ на медленной линии обрезается
+    const ipc_time_t deadline = ipc_get_time() + params.timeout + timing.char_time * (frame.size + frame.reply_size);
+
+    if (!frame.reply_size) {
+        // широковещательный запрос: ответа нет, устройствам дается время на выполнение
+        const transact_result res = uart.send(frame.adu, frame.size, deadline);
+        line_idle = ipc_get_time() + timing.char_time * frame.size + params.turnaround;
+        reply.status = (res == TRANSACT_OK) ? MODBUS_OK : (res == TRANSACT_STOPPED) ? MODBUS_STOPPED : MODBUS_TIMEOUT;
+        return reply.status;
+    }
+
+    // ответ обычно известной длины: не ждем тишины после него, а сразу разбираем
+    const size_t expected = frame.reply_size;
+    const uint8_t exception_function = frame.request.function | 0x80;
+    const response_matcher_t matcher = [expected, exception_function](const uint8_t* data, size_t size) {
+        if (size >= 2 && data[1] == exception_function)
+            return size >= 5;
+        return size >= expected;
+    };
+
+    const transact_result res = uart.transact(frame.adu, frame.size, response, matcher, deadline, &reply.timing, timing.t3_5);
+    line_idle = ipc_get_time() + timing.t3_5;
+
+    if (res == TRANSACT_STOPPED) {
+        reply.status = MODBUS_STOPPED;
+    } else if (response.empty()) {
+        stats.timeouts.fetch_add(1, std::memory_order_relaxed);
+        reply.status = MODBUS_TIMEOUT;
+    } else {
+        reply.status = parse_reply(frame, reply);
+    }
+    return reply.status;
+}
+
+//-----------------------------------------------------------------------------
+
+modbus_status modbus_master::parse_reply(const modbus_frame& frame, modbus_reply& reply)
+{
+    const uint8_t* p = response.data();
+    const size_t n = response.size();
+    const modbus_request& req = frame.request;
+
+    if (n < 5 || !modbus_crc_ok(p, n)) {
+        stats.crc_errors.fetch_add(1, std::memory_order_relaxed);
+        return MODBUS_CRC_ERROR;
+    }
+    if (gap_violated(reply.timing, timing)) {
+        stats.gap_errors.fetch_add(1, std::memory_order_relaxed);
+        if (params.strict_gaps)
+            return MODBUS_GAP_ERROR;
+    }
+
+    bool valid = (p[0] == req.slave);
+    if (valid && p[1] == (req.function | 0x80) && n == 5) {
+        stats.exceptions.fetch_add(1, std::memory_order_relaxed);
+        stats.responses.fetch_add(1, std::memory_order_relaxed);
+        reply.exception = p[2];
+        return MODBUS_EXCEPTION;
+    }
+
+    valid = valid && p[1] == req.function && n == frame.reply_size;
+    if (valid) {
+        if (req.function == MODBUS_READ_HOLDING || req.function == MODBUS_READ_INPUT) {
+            valid = (p[2] == 2 * req.count);
+            for (unsigned i = 0; valid && i < req.count; i++)
+                reply.values.push_back(get16(p + 3 + 2 * i));
+        } else {
+            // запись подтверждается эхом адреса и значения (или числа регистров)
+            valid = !memcmp(p + 2, frame.adu + 2, 4);
+        }
+    }
+
+    if (!valid) {
+        stats.bad_frames.fetch_add(1, std::memory_order_relaxed);
+        reply.values.clear();
+        return MODBUS_BAD_RESPONSE;
+    }
+
+    stats.responses.fetch_add(1, std::memory_order_relaxed);
+    return MODBUS_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+modbus_slave::modbus_slave(uint8_t address, uint16_t holding_count, uint16_t input_count) :
+    unit(address), holding(holding_count), input(input_count)
+{
+}
+
+//-----------------------------------------------------------------------------
+
+uint16_t modbus_slave::read_holding(uint16_t reg) const
+{
+    std::lock_guard<std::mutex> _lock(regs_lock);
+    return reg < holding.size() ? holding[reg] : 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void modbus_slave::write_input(uint16_t reg, uint16_t value)
+{
+    std::lock_guard<std::mutex> _lock(regs_lock);
+    if (reg < input.size())
+        input[reg] = value;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t modbus_slave::process(const uint8_t* adu, size_t size, bool broadcast, uint8_t* reply)
+{
+    if (size < 2)
+        return 0;
+
+    const uint8_t function = adu[1];
+    auto exception = [&](uint8_t code) -> size_t {
+        reply[0] = unit;
+        reply[1] = function | 0x80;
+        reply[2] = code;
+        return broadcast ? 0 : 3;
+    };
+
+    std::lock_guard<std::mutex> _lock(regs_lock);
+
+    switch (function) {
+    case MODBUS_READ_HOLDING:
+    case MODBUS_READ_INPUT: {
+        if (size != 6)
+            return exception(MODBUS_EX_ILLEGAL_VALUE);
+        const uint16_t address = get16(adu + 2);
+        const uint16_t count = get16(adu + 4);
+        const std::vector<uint16_t>& regs = (function == MODBUS_READ_HOLDING) ? holding : input;
+        if (!count || count > MODBUS_MAX_READ)
+            return exception(MODBUS_EX_ILLEGAL_VALUE);
+        if (size_t(address) + count > regs.size())
+            return exception(MODBUS_EX_ILLEGAL_ADDRESS);
+        if (broadcast)
+            return 0;
+        reply[0] = unit;
+        reply[1] = function;
+        reply[2] = uint8_t(2 * count);
+        for (unsigned i = 0; i < count; i++)
+            put16(reply + 3 + 2 * i, regs[address + i]);
+        return 3 + 2 * count;
+    }
+
+    case MODBUS_WRITE_SINGLE: {
+        if (size != 6)
+            return exception(MODBUS_EX_ILLEGAL_VALUE);
+        const uint16_t address = get16(adu + 2);
+        if (address >= holding.size())
+            return exception(MODBUS_EX_ILLEGAL_ADDRESS);
+        holding[address] = get16(adu + 4);
+        break;
+    }
+
+    case MODBUS_WRITE_MULTIPLE: {
+        if (size < 7)
+            return exception(MODBUS_EX_ILLEGAL_VALUE);
+        const uint16_t address = get16(adu + 2);
+        const uint16_t count = get16(adu + 4);
+        if (!count || count > MODBUS_MAX_WRITE || adu[6] != 2 * count || size != 7 + 2u * count)
+            return exception(MODBUS_EX_ILLEGAL_VALUE);
+        if (size_t(address) + count > holding.size())
+            return exception(MODBUS_EX_ILLEGAL_ADDRESS);
+        for (unsigned i = 0; i < count; i++)
+            holding[address + i] = get16(adu + 7 + 2 * i);
+        break;
+    }
+
+    default:
+        return exception(MODBUS_EX_ILLEGAL_FUNCTION);
+    }
+
+    // ответ на запись - эхо адреса и значения (числа регистров)
+    if (broadcast)
+        return 0;
+    reply[0] = unit;
+    memcpy(reply + 1, adu + 1, 5);
+    return 6;
+}
+
+//-----------------------------------------------------------------------------
+
+modbus_server::modbus_server(uart_device& uart, const modbus_params& p) :
+    uart(uart), params(p), timing(get_modbus_timing(uart.get_timing().baud_rate))
+{
+    request.reserve(MODBUS_MAX_ADU);
+}
+
+//-----------------------------------------------------------------------------
+
+void modbus_server::add_slave(modbus_slave_t slave)
+{
+    if (slave->address() == MODBUS_BROADCAST || slaves[slave->address()]) {
+        throw except_info("%s, %d: %s():\n Bad or duplicate Modbus address %u\n", __FILE__, __LINE__, __FUNCTION__, (unsigned)slave->address());
+    }
+    slaves[slave->address()] = std::move(slave);
+}
+
+//-----------------------------------------------------------------------------
+
+modbus_slave_t modbus_server::slave(uint8_t address) const
+{
+    return slaves[address];
+}
+
+//-----------------------------------------------------------------------------
+
+bool modbus_server::serve(std::chrono::milliseconds wait)
+{
+    transact_timing t;
+    transact_result res = uart.transact(nullptr, 0, request, nullptr, ipc_get_time() + wait, &t, timing.t3_5);
+    if (request.empty())
+        return false;
+
+    // срок истек посреди кадра: дослушаем его до тишины
+    std::vector<uint8_t> tail;
+    std::chrono::nanoseconds max_gap = t.max_gap;
+    while (res == TRANSACT_RX_TIMEOUT && request.size() <= MODBUS_MAX_ADU) {
+        res = uart.transact(nullptr, 0, tail, nullptr, ipc_get_time() + timing.t3_5 * 2, &t, timing.t3_5);
+        if (tail.empty())
+            break;
+        request.insert(request.end(), tail.begin(), tail.end());
+        max_gap = std::max(max_gap, t.max_gap);
+    }
+    t.max_gap = max_gap;
+    if (res == TRANSACT_STOPPED)
+        return false;
+
+    stats.requests.fetch_add(1, std::memory_order_relaxed);
+
+    if (request.size() < 4 || request.size() > MODBUS_MAX_ADU || !modbus_crc_ok(request.data(), request.size())) {
+        stats.crc_errors.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if (gap_violated(t, timing)) {
+        stats.gap_errors.fetch_add(1, std::memory_order_relaxed);
+        if (params.strict_gaps)
+            return true;
+    }
+
+    const uint8_t address = request[0];
+    const size_t size = request.size() - 2;
+
+    if (address == MODBUS_BROADCAST) {
+        for (const auto& s : slaves) {
+            if (s)
+                s->process(request.data(), size, true, reply);
+        }
+        return true;
+    }
+
+    // кадры для других устройств линии не касаются сервера
+    const modbus_slave_t& s = slaves[address];
+    if (!s)
+        return true;
+
+    size_t n = s->process(request.data(), size, false, reply);
+    if (!n)
+        return true;
+    if (reply[1] & 0x80)
+        stats.exceptions.fetch_add(1, std::memory_order_relaxed);
+
+    const uint16_t crc = crc::crc16_modbus(reply, n);
+    reply[n++] = uint8_t(crc);
+    reply[n++] = uint8_t(crc >> 8);
+
+    // тишина 3.5 символа после запроса уже выдержана: ответ уходит сразу. Ответ длиннее
+    // FIFO дописывается по мере передачи, поэтому срок включает время самого ответа на линии
+    res = uart.send(reply, n, ipc_get_time() + params.timeout + timing.char_time * n);
+    if (res == TRANSACT_OK)
+        stats.responses.fetch_add(1, std::memory_order_relaxed);
+    return res != TRANSACT_STOPPED;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t modbus_poller::add_line(uart_device& uart, const std::vector<modbus_request>& requests, const modbus_params& params)
+{
+    auto line = std::make_unique<line_state>(uart, params);
+    for (const auto& req : requests) {
+        modbus_frame frame;
+        if (!modbus_encode(req, frame)) {
+            throw except_info("%s, %d: %s():\n Bad Modbus request: slave %u, function %u, count %u\n", __FILE__, __LINE__, __FUNCTION__,
+                              (unsigned)req.slave, (unsigned)req.function, (unsigned)req.count);
+        }
+        line->frames.push_back(frame);
+    }
+    _lines.push_back(std::move(line));
+    return _lines.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+
+void modbus_poller::start(unsigned cycles, std::chrono::milliseconds period)
+{
+    is_exit = false;
+    for (size_t i = 0; i < _lines.size(); i++)
+        jobs.push_back(make_job<std::thread>([this, i, cycles, period] { run(i, cycles, period); }));
+}
+
+//-----------------------------------------------------------------------------
+
+void modbus_poller::join()
+{
+    for (auto& job : jobs) {
+        if (job->joinable())
+            job->join();
+    }
+    jobs.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+void modbus_poller::run(size_t index, unsigned cycles, std::chrono::milliseconds period)
+{
+    line_state& line = *_lines[index];
+    modbus_reply reply;
+    ipc_time_t next = ipc_get_time();
+
+    for (unsigned c = 0; !is_exit && (!cycles || c < cycles); c++) {
+
+        for (const auto& frame : line.frames) {
+            if (is_exit || line.master.execute(frame, reply) == MODBUS_STOPPED)
+                return;
+            if (on_reply)
+                on_reply(index, frame.request, reply);
+        }
+        line.cycles.fetch_add(1, std::memory_order_relaxed);
+
+        // период отсчитывается от начала предыдущего цикла
+        if (period.count()) {
+            next += period;
+            while (!is_exit && ipc_get_time() < next)
+                ipc_delay(1);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,268 @@
+#ifndef MODBUS_RTU_H
+#define MODBUS_RTU_H
+
+#include "pl_uartlite.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+
+//-----------------------------------------------------------------------------
+//! Modbus RTU поверх pl_uart.
+//! Кадр RTU не имеет разделителей: он заканчивается тишиной линии в 3.5 символа,
+//! а пауза больше 1.5 символа внутри кадра делает его недействительным. Потоки
+//! обмена порта опрашивают FIFO с интервалом в несколько символов и таких пауз не
+//! видят, поэтому прием кадра идет через uart_device::transact() с end_gap: FIFO
+//! опрашивается без сна, и тишина отсчитывается от чтения последнего байта.
+//! Измеренная пауза внутри кадра - оценка сверху (поток мог быть вытеснен, пока
+//! байты копились в FIFO), поэтому решающей остается проверка CRC, а нарушение
+//! 1.5 символа по умолчанию только считается.
+//-----------------------------------------------------------------------------
+
+constexpr unsigned MODBUS_CHAR_BITS = 11;   //!< старт, 8 бит данных, четность или второй стоп, стоп
+constexpr size_t MODBUS_MAX_ADU = 256;
+constexpr uint16_t MODBUS_MAX_READ = 125;   //!< регистров в ответе на чтение
+constexpr uint16_t MODBUS_MAX_WRITE = 123;  //!< регистров в запросе записи
+constexpr uint8_t MODBUS_BROADCAST = 0;     //!< широковещательный адрес, ответа нет
+
+//! Поддерживаемые функции
+enum modbus_function
+{
+    MODBUS_READ_HOLDING = 0x03,
+    MODBUS_READ_INPUT = 0x04,
+    MODBUS_WRITE_SINGLE = 0x06,
+    MODBUS_WRITE_MULTIPLE = 0x10,
+};
+
+//! Коды исключений в ответе устройства
+enum modbus_exception
+{
+    MODBUS_EX_ILLEGAL_FUNCTION = 0x01,
+    MODBUS_EX_ILLEGAL_ADDRESS = 0x02,
+    MODBUS_EX_ILLEGAL_VALUE = 0x03,
+};
+
+//! Результат запроса мастера
+enum modbus_status
+{
+    MODBUS_OK = 0,
+    MODBUS_TIMEOUT,         //!< ответ не принят до срока
+    MODBUS_CRC_ERROR,       //!< кадр искажен или обрезан
+    MODBUS_BAD_RESPONSE,    //!< ответ другого устройства, функции или длины
+    MODBUS_EXCEPTION,       //!< устройство ответило исключением
+    MODBUS_GAP_ERROR,       //!< пауза больше 1.5 символа внутри кадра (только при strict_gaps)
+    MODBUS_STOPPED,         //!< порт остановлен
+};
+
+const char* modbus_status_name(modbus_status status);
+
+//! Интервалы RTU; на скоростях выше 19200 стандарт фиксирует их в 750 и 1750 мкс
+struct modbus_timing
+{
+    std::chrono::nanoseconds char_time{0};
+    std::chrono::nanoseconds t1_5{0};       //!< наибольшая пауза между символами кадра
+    std::chrono::nanoseconds t3_5{0};       //!< наименьшая пауза между кадрами
+};
+
+modbus_timing get_modbus_timing(uint32_t baud_rate);
+
+//! Запрос мастера
+struct modbus_request
+{
+    uint8_t slave{1};
+    uint8_t function{MODBUS_READ_HOLDING};
+    uint16_t address{0};
+    uint16_t count{1};              //!< регистров для чтения и записи нескольких
+    std::vector<uint16_t> values;   //!< записываемые значения
+};
+
+//! Разбор списка запросов вида "slave:function:address:count[,...]";
+//! для функций записи вместо count - значения через '/'
+bool parse_modbus_requests(const std::string& text, std::vector<modbus_request>& requests);
+
+//! Ответ на запрос мастера
+struct modbus_reply
+{
+    modbus_status status{MODBUS_OK};
+    uint8_t exception{0};                   //!< код исключения для MODBUS_EXCEPTION
+    std::vector<uint16_t> values;           //!< прочитанные регистры
+    pl_uartlite::transact_timing timing;
+};
+
+//! Закодированный запрос: мастер опроса кодирует список один раз
+struct modbus_frame
+{
+    modbus_request request;
+    uint8_t adu[MODBUS_MAX_ADU];
+    size_t size{0};
+    size_t reply_size{0};   //!< длина нормального ответа, 0 - ответа нет
+};
+
+//! Кодирует запрос с CRC; false - запрос не помещается в кадр или функция не поддерживается
+bool modbus_encode(const modbus_request& request, modbus_frame& frame);
+
+//! Проверка CRC кадра (последние два байта, младшим вперед)
+bool modbus_crc_ok(const uint8_t* adu, size_t size);
+
+//-----------------------------------------------------------------------------
+
+//! Параметры мастера и сервера
+struct modbus_params
+{
+    std::chrono::milliseconds timeout{100};     //!< срок ответа устройства
+    std::chrono::milliseconds turnaround{10};   //!< пауза после широковещательного запроса
+    bool strict_gaps{false};                    //!< отбрасывать кадры с паузой больше 1.5 символа
+};
+
+//! Счетчики мастера или сервера
+struct modbus_stats
+{
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> responses{0};     //!< ответы без ошибок, включая исключения
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> crc_errors{0};
+    std::atomic<uint64_t> bad_frames{0};    //!< чужие, неожиданные и обрезанные кадры
+    std::atomic<uint64_t> exceptions{0};
+    std::atomic<uint64_t> gap_errors{0};    //!< кадры с паузой больше 1.5 символа
+};
+
+//-----------------------------------------------------------------------------
+
+//! Мастер одной линии: запрос и ожидание ответа в обход очередей порта.
+//! Между кадрами выдерживается тишина 3.5 символа; ответ принимается по
+//! ожидаемой длине, а если длина не совпала - по тишине после него.
+class modbus_master
+{
+public:
+    explicit modbus_master(pl_uartlite::uart_device& uart, const modbus_params& params = modbus_params());
+
+    //! Кодирует и выполняет запрос
+    modbus_status execute(const modbus_request& request, modbus_reply& reply);
+
+    //! Выполняет заранее закодированный запрос
+    modbus_status execute(const modbus_frame& frame, modbus_reply& reply);
+
+    const modbus_timing& get_timing() const { return timing; }
+    const modbus_stats& get_stats() const { return stats; }
+
+private:
+    modbus_status parse_reply(const modbus_frame& frame, modbus_reply& reply);
+
+    pl_uartlite::uart_device& uart;
+    modbus_params params;
+    modbus_timing timing;
+    ipc_time_t line_idle{};             //!< с этого момента линия свободна для следующего кадра
+    std::vector<uint8_t> response;
+    modbus_stats stats;
+};
+
+//-----------------------------------------------------------------------------
+
+//! Регистры одного устройства (адреса) и обработка его запросов
+class modbus_slave
+{
+public:
+    modbus_slave(uint8_t address, uint16_t holding_count = 256, uint16_t input_count = 256);
+
+    uint8_t address() const { return unit; }
+
+    uint16_t read_holding(uint16_t reg) const;
+    void write_input(uint16_t reg, uint16_t value);
+
+    //! Обрабатывает кадр без CRC (адрес, функция, данные); возвращает длину ответа
+    //! без CRC в reply, 0 - не отвечать
+    size_t process(const uint8_t* adu, size_t size, bool broadcast, uint8_t* reply);
+
+private:
+    uint8_t unit;
+    mutable std::mutex regs_lock;
+    std::vector<uint16_t> holding;
+    std::vector<uint16_t> input;
+};
+
+using modbus_slave_t = std::shared_ptr<modbus_slave>;
+
+//! Сервер линии: принимает кадры по тишине 3.5 символа и отвечает от имени своих
+//! устройств. Поток приема порта на линии сервера не запускается: кадры читает serve().
+class modbus_server
+{
+public:
+    explicit modbus_server(pl_uartlite::uart_device& uart, const modbus_params& params = modbus_params());
+
+    //! Добавляет устройство; вызывается до запуска
+    void add_slave(modbus_slave_t slave);
+
+    //! Устройство по адресу или nullptr
+    modbus_slave_t slave(uint8_t address) const;
+
+    //! Принимает и обслуживает один кадр; false - за wait кадров не было или порт остановлен
+    bool serve(std::chrono::milliseconds wait);
+
+    const modbus_timing& get_timing() const { return timing; }
+    const modbus_stats& get_stats() const { return stats; }
+
+private:
+    pl_uartlite::uart_device& uart;
+    modbus_params params;
+    modbus_timing timing;
+    modbus_slave_t slaves[256];
+    std::vector<uint8_t> request;
+    uint8_t reply[MODBUS_MAX_ADU];
+    modbus_stats stats;
+};
+
+//-----------------------------------------------------------------------------
+
+//! Циклический опрос устройств на нескольких линиях. Каждая линия обслуживается
+//! своим потоком и мастером, поэтому линии работают параллельно; внутри линии
+//! запросы закодированы заранее и идут подряд: разбор ответа совмещается с
+//! обязательной паузой 3.5 символа перед следующим запросом.
+class modbus_poller
+{
+public:
+    //! Обработчик результата: номер линии, запрос, ответ
+    using handler_t = std::function<void(size_t line, const modbus_request& request, const modbus_reply& reply)>;
+
+    //! Добавляет линию со списком запросов цикла; возвращает номер линии
+    size_t add_line(pl_uartlite::uart_device& uart, const std::vector<modbus_request>& requests,
+                    const modbus_params& params = modbus_params());
+
+    //! Вызывается потоком линии; задается до start()
+    void set_handler(handler_t handler) { on_reply = std::move(handler); }
+
+    //! Запускает опрос: cycles циклов на каждой линии (0 - до stop()), циклы начинаются не чаще period
+    void start(unsigned cycles = 0, std::chrono::milliseconds period = std::chrono::milliseconds(0));
+    void stop() { is_exit = true; }
+    void join();
+
+    //! Опрос одной линии в вызывающем потоке (для владельца, который сам создает потоки)
+    void run(size_t line, unsigned cycles = 0, std::chrono::milliseconds period = std::chrono::milliseconds(0));
+
+    size_t lines() const { return _lines.size(); }
+    uint64_t cycles(size_t line) const { return _lines[line]->cycles; }
+    const modbus_master& master(size_t line) const { return _lines[line]->master; }
+
+private:
+    struct line_state
+    {
+        line_state(pl_uartlite::uart_device& uart, const modbus_params& params) : master(uart, params) {}
+
+        modbus_master master;
+        std::vector<modbus_frame> frames;
+        std::atomic<uint64_t> cycles{0};
+    };
+
+    std::vector<std::unique_ptr<line_state>> _lines;
+    handler_t on_reply;
+    std::vector<job_t> jobs;
+    std::atomic<bool> is_exit{false};
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // MODBUS_RTU_H
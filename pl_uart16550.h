@@ -0,0 +1,162 @@
+
+#ifndef PL_UART_16550_H
+#define PL_UART_16550_H
+
+#include "pl_uartlite.h"
+
+//-----------------------------------------------------------------------------
+
+namespace pl_uartlite
+{
+    //! Регистры AXI UART 16550 (смещение 0x1000 от базового адреса ядра)
+    enum uart16550_registers
+    {
+        UART16550_RBR = 0x1000, ///< прием (DLAB = 0, чтение)
+        UART16550_THR = 0x1000, ///< передача (DLAB = 0, запись)
+        UART16550_DLL = 0x1000, ///< делитель, младший байт (DLAB = 1)
+        UART16550_IER = 0x1004,
+        UART16550_DLM = 0x1004, ///< делитель, старший байт (DLAB = 1)
+        UART16550_FCR = 0x1008,
+        UART16550_LCR = 0x100C,
+        UART16550_MCR = 0x1010,
+        UART16550_LSR = 0x1014,
+        UART16550_MSR = 0x1018,
+    };
+
+    struct uart16550_lsr_bitmask
+    {
+        uint32_t
+            DR : 1,     ///< есть принятые данные
+            OE : 1,     ///< переполнение
+            PE : 1,     ///< ошибка четности
+            FE : 1,     ///< ошибка кадра
+            BI : 1,     ///< обрыв линии
+            THRE : 1,   ///< FIFO передатчика пуст
+            TEMT : 1,   ///< передатчик пуст
+            RXFE : 1,   ///< ошибка в FIFO приемника
+            : 24; ///< Резерв.
+    };
+
+    struct uart16550_fcr_bitmask
+    {
+        uint32_t
+            FIFOEN : 1,
+            RCVR_FIFO_RESET : 1,
+            XMIT_FIFO_RESET : 1,
+            DMA_MODE : 1, : 2,
+            RCVR_TRIGGER : 2,
+            : 24; ///< Резерв.
+    };
+
+    struct uart16550_lcr_bitmask
+    {
+        uint32_t
+            WLS : 2,    ///< длина слова: 3 - 8 бит
+            STB : 1,
+            PEN : 1,
+            EPS : 1,
+            STICK : 1,
+            BREAK : 1,
+            DLAB : 1,
+            : 24; ///< Резерв.
+    };
+
+    using reg_lsr = data_type<uart16550_lsr_bitmask, uint32_t>;
+    using reg_fcr = data_type<uart16550_fcr_bitmask, uint32_t>;
+    using reg_lcr = data_type<uart16550_lcr_bitmask, uint32_t>;
+
+    //! Глубина FIFO AXI UART 16550
+    constexpr unsigned UART16550_FIFO_DEPTH = 64;
+
+    //-----------------------------------------------------------------------------
+
+    //! Описание AXI UART 16550 для basic_pl_uart
+    struct uart16550_traits
+    {
+        static constexpr const char *name = "uart16550";
+        static constexpr unsigned fifo_depth = UART16550_FIFO_DEPTH;
+        static constexpr uint32_t rx_offset = UART16550_RBR;
+        static constexpr uint32_t tx_offset = UART16550_THR;
+        static constexpr uint32_t status_offset = UART16550_LSR;
+
+        //! У 16550 нет флага заполнения FIFO передатчика: пишем только в пустой FIFO
+        static constexpr bool tx_partial_fill = false;
+
+        //! Формат 8N1, FIFO включены; делитель задается, если известна частота ядра
+        template <typename bus_type>
+        static void init(bus_type &io, uint32_t baud_rate, uint32_t clock_hz)
+        {
+            io.write(UART16550_IER, 0);
+
+            reg_lcr lcr{0};
+            lcr.bits.WLS = 3;
+
+            if (clock_hz && baud_rate)
+            {
+                const uint32_t divisor = (clock_hz + 8 * baud_rate) / (16 * baud_rate);
+                lcr.bits.DLAB = 1;
+                io.write(UART16550_LCR, lcr.value);
+                io.write(UART16550_DLL, divisor & 0xFF);
+                io.write(UART16550_DLM, (divisor >> 8) & 0xFF);
+                lcr.bits.DLAB = 0;
+            }
+            io.write(UART16550_LCR, lcr.value);
+
+            reg_fcr fcr{0};
+            fcr.bits.FIFOEN = 1;
+            fcr.bits.RCVR_FIFO_RESET = 1;
+            fcr.bits.XMIT_FIFO_RESET = 1;
+            io.write(UART16550_FCR, fcr.value);
+        }
+
+        template <typename bus_type>
+        static void reset_rx(bus_type &io)
+        {
+            reg_fcr fcr{0};
+            fcr.bits.FIFOEN = 1;
+            fcr.bits.RCVR_FIFO_RESET = 1;
+            io.write(UART16550_FCR, fcr.value);
+        }
+
+        template <typename bus_type>
+        static void reset_tx(bus_type &io)
+        {
+            reg_fcr fcr{0};
+            fcr.bits.FIFOEN = 1;
+            fcr.bits.XMIT_FIFO_RESET = 1;
+            io.write(UART16550_FCR, fcr.value);
+        }
+
+        static bool rx_ready(uint32_t status)
+        {
+            reg_lsr reg{status};
+            return reg.bits.DR;
+        }
+
+        static bool tx_empty(uint32_t status)
+        {
+            reg_lsr reg{status};
+            return reg.bits.THRE;
+        }
+
+        static bool tx_full(uint32_t status)
+        {
+            return !tx_empty(status);
+        }
+
+        static unsigned errors(uint32_t status)
+        {
+            reg_lsr reg{status};
+            return (reg.bits.OE ? UART_ERR_OVERRUN : 0) |
+                   (reg.bits.FE ? UART_ERR_FRAME : 0) |
+                   (reg.bits.PE ? UART_ERR_PARITY : 0);
+        }
+    };
+
+    //! PL UART на базе AXI UART 16550
+    using pl_uart16550 = basic_pl_uart<uart16550_traits>;
+};
+
+//------------------------------------------------------------------------------
+
+#endif // PL_UART_16550_H
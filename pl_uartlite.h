@@ -4,6 +4,8 @@
 
 #include "mapper.h"
 #include "time_ipc.h"
+#include "ulog.h"
+#include "uart_profile.h"
 
 #include <cmath>
 #include <cstdint>
@@ -17,6 +19,10 @@
 #include <mutex>
 #include <thread>
 #include <memory>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
 
 //-----------------------------------------------------------------------------
 
@@ -93,152 +99,833 @@ namespace pl_uartlite
     using reg_ctrl = data_type<uatlite_control_bitmask, uint32_t>;
     using reg_status = data_type<uatlite_status_bitmask, uint32_t>;
 
-    class pl_uart
+    //! Глубина FIFO приемника и передатчика AXI UART Lite
+    constexpr unsigned UARTLITE_FIFO_DEPTH = 16;
+
+    //! Число бит на символ в линии: старт + 8 бит данных + стоп
+    constexpr unsigned UARTLITE_CHAR_BITS = 10;
+
+    //! Запас (в символах) на задержку пробуждения потока
+    constexpr unsigned UARTLITE_GUARD_CHARS = 2;
+
+    //! Скорость по умолчанию, если она не задана в конфигурации
+    constexpr uint32_t UARTLITE_DEFAULT_BAUD = 115200;
+
+    //! Временные параметры линии, используемые для планирования опроса FIFO
+    struct line_timing
+    {
+        uint32_t baud_rate{UARTLITE_DEFAULT_BAUD};
+        unsigned char_bits{UARTLITE_CHAR_BITS};
+        unsigned fifo_depth{UARTLITE_FIFO_DEPTH};
+        unsigned guard_chars{UARTLITE_GUARD_CHARS};
+
+        //! Время передачи одного символа
+        std::chrono::nanoseconds char_time() const
+        {
+            if (!baud_rate)
+                return std::chrono::nanoseconds(0);
+            return std::chrono::nanoseconds((1000000000ull * char_bits) / baud_rate);
+        }
+
+        //! Время, за которое в линии пройдет chars символов, за вычетом запаса
+        std::chrono::nanoseconds service_time(unsigned chars) const
+        {
+            if (chars <= guard_chars)
+                return std::chrono::nanoseconds(0);
+            return char_time() * (chars - guard_chars);
+        }
+
+        //! Интервал опроса приемника: FIFO обслуживается заполненным наполовину, так что
+        //! вторая половина - запас на опоздание пробуждения потока
+        std::chrono::nanoseconds rx_service_time() const
+        {
+            return char_time() * std::max(1u, fifo_depth / 2);
+        }
+
+        //! Время, за которое заполняется пустой FIFO
+        std::chrono::nanoseconds fifo_time() const
+        {
+            return char_time() * fifo_depth;
+        }
+
+        //! Передатчик считается зависшим, если FIFO не опустел за восемь своих времен передачи
+        std::chrono::nanoseconds tx_stall_time() const
+        {
+            return char_time() * fifo_depth * 8 + std::chrono::milliseconds(10);
+        }
+    };
+
+    //! Планирование пробуждений потока обмена с учетом измеренного опоздания пробуждения:
+    //! поток засыпает раньше срока на величину, на которую он опаздывал недавно
+    class service_pacer
     {
     public:
-        pl_uart(uint32_t base_address,
-                uint32_t size,
-                std::deque<uint8_t> &rd_queue,
-                std::mutex &rd_lock,
-                std::deque<uint8_t> &wr_queue,
-                std::mutex &wr_lock) : read_queue(rd_queue), read_lock(rd_lock), write_queue(wr_queue), write_lock(wr_lock)
-        {
-            _base = nullptr;
-            _mapper = get_mapper<Mapper>();
-            if (_mapper.get())
+        void sleep_until(ipc_time_t deadline)
+        {
+            deadline -= slack;
+            ipc_sleep_until(deadline);
+            const std::chrono::nanoseconds late = ipc_get_time() - deadline;
+            // оценка быстро растет и медленно убывает
+            slack = std::max(late, slack - slack / 8);
+        }
+
+        std::chrono::nanoseconds get_slack() const
+        {
+            return slack;
+        }
+
+    private:
+        std::chrono::nanoseconds slack{0};
+    };
+
+    //! Получатель принятых данных: вызывается потоком приема для каждой вычитанной пачки
+    using rx_sink_t = std::function<void(const uint8_t *data, size_t size)>;
+
+    //! Источник данных на передачу: возвращает в data указатель на не более чем max байт
+    //! и их число; возвращенные байты считаются переданными
+    using tx_source_t = std::function<size_t(const uint8_t *&data, size_t max)>;
+
+    //! Проверка накопленного ответа транзакции: true, если ответ принят целиком
+    using response_matcher_t = std::function<bool(const uint8_t *data, size_t size)>;
+
+    //! Результат транзакции запрос/ответ
+    enum transact_result
+    {
+        TRANSACT_OK = 0,
+        TRANSACT_TX_TIMEOUT,    //!< FIFO не освободились потоками обмена или запрос не поместился в FIFO передатчика до срока
+        TRANSACT_RX_TIMEOUT,    //!< ответ не принят до срока
+        TRANSACT_STOPPED,       //!< порт остановлен во время транзакции
+    };
+
+    //! Число опросов в транзакции без продвижения (приемник пуст, передатчик полон),
+    //! после которого поток уступает процессор
+    constexpr unsigned TRANSACT_YIELD_POLLS = 64;
+
+    //! Разбивка времени транзакции; времена отсчитываются от вызова transact()
+    struct transact_timing
+    {
+        std::chrono::nanoseconds lock_wait{0};  //!< ожидание границы пачки потоков обмена
+        std::chrono::nanoseconds tx_done{0};    //!< запрос записан в FIFO передатчика
+        std::chrono::nanoseconds first_byte{0}; //!< принят первый байт ответа
+        std::chrono::nanoseconds complete{0};   //!< ответ принят или истек срок
+        std::chrono::nanoseconds max_gap{0};    //!< наибольший промежуток между чтениями байтов ответа
+        uint32_t stale_bytes{0};                //!< принятые до запроса байты, отданные в rx_sink
+        uint32_t polls{0};                      //!< опросы регистра состояния в ожидании ответа
+    };
+
+    //! Ошибки приема, общие для всех типов устройств
+    enum uart_errors
+    {
+        UART_ERR_OVERRUN = 0x1,
+        UART_ERR_FRAME = 0x2,
+        UART_ERR_PARITY = 0x4,
+    };
+
+    //! Счетчики порта; обновляются потоками обмена, читаются из любого потока
+    struct uart_stats
+    {
+        std::atomic<uint64_t> rx_bytes{0};
+        std::atomic<uint64_t> tx_bytes{0};
+        // ошибки приема - число прочитанных значений регистра состояния с флагом
+        std::atomic<uint64_t> overrun_errors{0};
+        std::atomic<uint64_t> frame_errors{0};
+        std::atomic<uint64_t> parity_errors{0};
+        std::atomic<uint64_t> rx_resets{0};     //!< сбросы FIFO приемника после переполнения
+        std::atomic<uint64_t> rx_late_polls{0};     //!< опросы приемника позже времени заполнения FIFO: поток не получил процессор вовремя
+        std::atomic<uint64_t> rx_late_overruns{0};  //!< сбросы после переполнения, обнаруженного таким опросом
+        std::atomic<uint64_t> tx_resets{0};     //!< сбросы зависшего FIFO передатчика
+        std::atomic<uint64_t> recoveries{0};
+        std::atomic<uint64_t> recovery_total_ns{0};
+        std::atomic<uint64_t> recovery_max_ns{0};
+        std::atomic<uint64_t> transactions{0};
+        std::atomic<uint64_t> transact_timeouts{0};
+
+        //! Время от обнаружения сбоя до возобновления обмена
+        void add_recovery(std::chrono::nanoseconds time)
+        {
+            const uint64_t ns = time.count();
+            recoveries.fetch_add(1, std::memory_order_relaxed);
+            recovery_total_ns.fetch_add(ns, std::memory_order_relaxed);
+            uint64_t max = recovery_max_ns.load(std::memory_order_relaxed);
+            while (ns > max && !recovery_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
             {
-                _base = static_cast<uint32_t *>(_mapper->map(base_address, size));
             }
+        }
+    };
 
-            rx_fifo_reg = (reg_rx_fifo *)&_base[UART_RX_FIFO >> 2];
-            tx_fifo_reg = (reg_tx_fifo *)&_base[UART_TX_FIFO >> 2];
-            ctrl_reg = (reg_ctrl *)&_base[UART_CTRL >> 2];
-            status_reg = (reg_status *)&_base[UART_STATUS >> 2];
+    //-----------------------------------------------------------------------------
 
-            ctrl_reg->value = 0;
+    //! Доступ к регистрам устройства через отображенную апертуру
+    class mmio_bus
+    {
+    public:
+        explicit mmio_bus(volatile uint32_t *base = nullptr) : _base(base) {}
+
+        uint32_t read(uint32_t offset) const
+        {
+            return _base[offset >> 2];
+        }
 
-            fprintf(stderr, "UART_CTRL = 0x%x\n", ctrl_reg->value);
-            fprintf(stderr, "UART_STAT = 0x%x\n", status_reg->value);
+        void write(uint32_t offset, uint32_t value)
+        {
+            _base[offset >> 2] = value;
         }
 
-        virtual ~pl_uart()
+    private:
+        volatile uint32_t *_base;
+    };
+
+    //-----------------------------------------------------------------------------
+
+    //! Описание AXI UART Lite для basic_pl_uart: смещения регистров, глубина FIFO,
+    //! разбор регистра состояния и возможности пакетной записи
+    struct uartlite_traits
+    {
+        static constexpr const char *name = "uartlite";
+        static constexpr unsigned fifo_depth = UARTLITE_FIFO_DEPTH;
+        static constexpr uint32_t rx_offset = UART_RX_FIFO;
+        static constexpr uint32_t tx_offset = UART_TX_FIFO;
+        static constexpr uint32_t status_offset = UART_STATUS;
+
+        //! Флаг TX_FIFO_FULL позволяет дописывать неполный FIFO по одному байту
+        static constexpr bool tx_partial_fill = true;
+
+        //! Скорость UART Lite задается при синтезе, настраиваются только прерывания
+        template <typename bus_type>
+        static void init(bus_type &io, uint32_t, uint32_t)
+        {
+            io.write(UART_CTRL, 0);
+        }
+
+        template <typename bus_type>
+        static void reset_rx(bus_type &io)
+        {
+            reg_ctrl ctrl{0};
+            ctrl.bits.RST_RX_FIFO = 1;
+            io.write(UART_CTRL, ctrl.value);
+        }
+
+        template <typename bus_type>
+        static void reset_tx(bus_type &io)
+        {
+            reg_ctrl ctrl{0};
+            ctrl.bits.RST_TX_FIFO = 1;
+            io.write(UART_CTRL, ctrl.value);
+        }
+
+        static bool rx_ready(uint32_t status)
+        {
+            reg_status reg{status};
+            return reg.bits.RX_FIFO_VALID_DATA;
+        }
+
+        static bool tx_empty(uint32_t status)
+        {
+            reg_status reg{status};
+            return reg.bits.TX_FIFO_EMPTY;
+        }
+
+        static bool tx_full(uint32_t status)
+        {
+            reg_status reg{status};
+            return reg.bits.TX_FIFO_FULL;
+        }
+
+        static unsigned errors(uint32_t status)
+        {
+            reg_status reg{status};
+            return (reg.bits.OVERRUN_ERROR ? UART_ERR_OVERRUN : 0) |
+                   (reg.bits.FRAME_ERROR ? UART_ERR_FRAME : 0) |
+                   (reg.bits.PARITY_ERROR ? UART_ERR_PARITY : 0);
+        }
+    };
+
+    //-----------------------------------------------------------------------------
+
+    //! Интерфейс управления портом, не зависящий от типа устройства.
+    //! Виртуальные вызовы только управляющие, циклы обмена специализируются шаблоном.
+    class uart_device
+    {
+    public:
+        virtual ~uart_device() {}
+
+        virtual ssize_t read_thread() = 0;
+        virtual ssize_t write_thread() = 0;
+        virtual void stop() = 0;
+
+        virtual void set_baud_rate(uint32_t baud_rate) = 0;
+        virtual void set_fifo_depth(unsigned depth) = 0;
+        virtual void set_rx_sink(rx_sink_t sink) = 0;
+        virtual void set_tx_source(tx_source_t source) = 0;
+        virtual const line_timing &get_timing() const = 0;
+        virtual const uart_stats &get_stats() const = 0;
+        virtual uart_profile::port_profile &get_profile() = 0;
+
+        virtual transact_result transact(const uint8_t *request, size_t size, std::vector<uint8_t> &response,
+                                         const response_matcher_t &matcher, ipc_time_t deadline,
+                                         transact_timing *breakdown = nullptr,
+                                         std::chrono::nanoseconds end_gap = std::chrono::nanoseconds(0)) = 0;
+        virtual transact_result send(const uint8_t *data, size_t size, ipc_time_t deadline) = 0;
+    };
+
+    using uart_device_t = std::unique_ptr<uart_device>;
+
+    //-----------------------------------------------------------------------------
+
+    template <typename device_traits, typename bus_type = mmio_bus>
+    class basic_pl_uart : public uart_device
+    {
+    public:
+        using traits = device_traits;
+
+        basic_pl_uart(uint32_t base_address,
+                      uint32_t size,
+                      std::deque<uint8_t> &rd_queue,
+                      std::mutex &rd_lock,
+                      std::deque<uint8_t> &wr_queue,
+                      std::mutex &wr_lock,
+                      uint32_t baud_rate = UARTLITE_DEFAULT_BAUD) : basic_pl_uart(get_mapper<Mapper>(), base_address, size, rd_queue, rd_lock, wr_queue, wr_lock, baud_rate)
+        {
+        }
+
+        //! Конструктор для нескольких портов, отображаемых через общий Mapper
+        basic_pl_uart(mapper_t mapper,
+                      uint32_t base_address,
+                      uint32_t size,
+                      std::deque<uint8_t> &rd_queue,
+                      std::mutex &rd_lock,
+                      std::deque<uint8_t> &wr_queue,
+                      std::mutex &wr_lock,
+                      uint32_t baud_rate = UARTLITE_DEFAULT_BAUD,
+                      uint32_t clock_hz = 0) : basic_pl_uart(map_bus(mapper, base_address, size), rd_queue, rd_lock, wr_queue, wr_lock, baud_rate, clock_hz)
+        {
+            _mapper = mapper;
+            ULOG_INFO("0x%x: %s, UART_STAT = 0x%x\n", base_address, traits::name, io.read(traits::status_offset));
+        }
+
+        //! Конструктор с готовым доступом к регистрам
+        basic_pl_uart(bus_type bus,
+                      std::deque<uint8_t> &rd_queue,
+                      std::mutex &rd_lock,
+                      std::deque<uint8_t> &wr_queue,
+                      std::mutex &wr_lock,
+                      uint32_t baud_rate = UARTLITE_DEFAULT_BAUD,
+                      uint32_t clock_hz = 0) : io(bus), read_queue(rd_queue), write_queue(wr_queue), read_lock(rd_lock), write_lock(wr_lock)
+        {
+            timing.fifo_depth = traits::fifo_depth;
+            set_baud_rate(baud_rate);
+            set_rx_sink(nullptr);
+            set_tx_source(nullptr);
+
+            traits::init(io, timing.baud_rate, clock_hz);
+        }
+
+        virtual ~basic_pl_uart()
         {
             stop();
             ipc_delay(100);
-            _base = nullptr;
         }
 
-        ssize_t read_thread()
+        //! Скорость нужна для расчета интервалов опроса (и делителя, если его задает драйвер)
+        void set_baud_rate(uint32_t baud_rate) override
+        {
+            timing.baud_rate = baud_rate ? baud_rate : UARTLITE_DEFAULT_BAUD;
+        }
+
+        //! Глубина FIFO может быть задана меньше аппаратной для более частого обслуживания
+        void set_fifo_depth(unsigned depth) override
+        {
+            timing.fifo_depth = std::clamp<unsigned>(depth, 1, traits::fifo_depth);
+        }
+
+        const line_timing &get_timing() const override
+        {
+            return timing;
+        }
+
+        const uart_stats &get_stats() const override
+        {
+            return stats;
+        }
+
+        //! Профиль циклов обмена; заполняется только при сборке с PL_UART_PROFILE
+        uart_profile::port_profile &get_profile() override
+        {
+            return profile;
+        }
+
+        //! Заменяет приемную очередь на собственный получатель (nullptr - очередь rd_queue).
+        //! Вызывается до запуска read_thread().
+        void set_rx_sink(rx_sink_t sink) override
+        {
+            if (sink)
+            {
+                rx_sink = std::move(sink);
+                return;
+            }
+            rx_sink = [this](const uint8_t *data, size_t size)
+            {
+                std::lock_guard<std::mutex> _lock(read_lock);
+                read_queue.insert(read_queue.end(), data, data + size);
+            };
+        }
+
+        //! Заменяет очередь на передачу собственным источником (nullptr - очередь wr_queue).
+        //! Вызывается до запуска write_thread().
+        void set_tx_source(tx_source_t source) override
         {
-            ctrl_reg->bits.ENABLE_INTR = 0;
-            ctrl_reg->bits.RST_RX_FIFO = 1;
+            if (source)
+            {
+                tx_source = std::move(source);
+                return;
+            }
+            tx_source = [this](const uint8_t *&data, size_t max)
+            {
+                std::lock_guard<std::mutex> _lock(write_lock);
+                size_t n = std::min(max, write_queue.size());
+                std::copy_n(write_queue.begin(), n, tx_burst);
+                write_queue.erase(write_queue.begin(), write_queue.begin() + n);
+                data = tx_burst;
+                return n;
+            };
+        }
+
+        ssize_t read_thread() override
+        {
+            traits::reset_rx(io);
 
             ssize_t readed = 0;
+            uint8_t burst[traits::fifo_depth];
+
+            ULOG_DEBUG("%s(): %s UART_STAT = 0x%x\n", __func__, traits::name, read_status());
+
+            // FIFO переполнится не раньше, чем через fifo_depth символов после опустошения;
+            // опрашиваем на половине, оставляя вторую половину на задержки планировщика
+            const auto rx_interval = timing.rx_service_time();
 
-            fprintf(stderr, "%s(): UART_CTRL = 0x%x\n", __func__, ctrl_reg->value);
-            fprintf(stderr, "%s(): UART_STAT = 0x%x\n", __func__, status_reg->value);            
+            service_pacer pacer;
+
+            // время сброса FIFO после переполнения, пока прием не возобновился
+            ipc_time_t rx_reset_time;
+            bool rx_recovering = false;
+
+            // опрос позже заполнения FIFO: переполнение тогда вызвано не расписанием
+            // драйвера, а тем, что хост не дал потоку процессор вовремя
+            ipc_time_t last_poll = ipc_get_time();
 
             while (!is_exit)
             {
-                if(status_reg->bits.RX_FIFO_VALID_DATA)
+                // приемник занимается транзакцией целиком, ждем ее окончания
+                std::unique_lock<std::timed_mutex> hw_lock(hw_rx_lock);
+                ipc_time_t polled = ipc_get_time();
+                const bool late = polled - last_poll > timing.fifo_time();
+                last_poll = polled;
+                if (late)
+                    stats.rx_late_polls.fetch_add(1, std::memory_order_relaxed);
+
+                unsigned errors = 0;
+                const unsigned n = drain_rx(burst, timing.fifo_depth, errors);
+
+                if (count_rx_errors(errors))
                 {
-                    if (is_exit)
-                        return readed;
+                    if (late)
+                        stats.rx_late_overruns.fetch_add(1, std::memory_order_relaxed);
+                    if (!rx_recovering)
+                        rx_reset_time = polled;
+                    rx_recovering = true;
+                }
 
-                    std::lock_guard<std::mutex> _lock(write_lock);
-                    uint8_t v = rx_fifo_reg->value;
-                    read_queue.push_back(v);
-                    ++readed;
+                // получатель вызывается без захвата приемника, чтобы транзакция не ждала
+                // обработки пачки; порядок с байтами, отданными транзакцией, держит rx_sink_lock
+                std::unique_lock<std::mutex> sink_lock(rx_sink_lock, std::defer_lock);
+                if (n)
+                {
+                    if (rx_recovering && !(errors & UART_ERR_OVERRUN))
+                    {
+                        stats.add_recovery(ipc_get_time() - rx_reset_time);
+                        rx_recovering = false;
+                    }
+                    readed += n;
+                    stats.rx_bytes.fetch_add(n, std::memory_order_relaxed);
+                    sink_lock.lock();
+                }
+                hw_lock.unlock();
 
-                } else {
-                    ipc_delay(5);
-                    if (is_exit)
-                        return readed;                    
+                if (n)
+                {
+                    rx_sink(burst, n);
+                    sink_lock.unlock();
                 }
+
+                // FIFO был заполнен целиком: данные продолжают поступать, опрашиваем сразу
+                if (n == timing.fifo_depth)
+                    continue;
+
+                pacer.sleep_until(polled + rx_interval);
             }
 
-            fprintf(stderr, "OK: readed %ld bytes\n", readed);
+            ULOG_INFO("OK: readed %ld bytes\n", readed);
 
             return readed;
         };
 
-        ssize_t write_thread()
+        ssize_t write_thread() override
         {
-            ctrl_reg->bits.ENABLE_INTR = 0;
-            ctrl_reg->bits.RST_TX_FIFO = 1;
+            traits::reset_tx(io);
 
             ssize_t written = 0;
 
-            fprintf(stderr, "%s(): UART_CTRL = 0x%x\n", __func__, ctrl_reg->value);
-            fprintf(stderr, "%s(): UART_STAT = 0x%x\n", __func__, status_reg->value);            
+            ULOG_DEBUG("%s(): %s UART_STAT = 0x%x\n", __func__, traits::name, read_status());
+
+            {
+                std::lock_guard<std::timed_mutex> _lock(hw_tx_lock);
+                tx_progress = ipc_get_time();
+            }
+            bool tx_recovering = false;
+            service_pacer pacer;
 
             while (!is_exit)
             {
-                //fprintf(stderr, "%d: %s()\n", __LINE__, __func__);
+                // транзакция пишет запрос между пачками потока передачи
+                std::unique_lock<std::timed_mutex> hw_lock(hw_tx_lock);
+                ipc_time_t polled = ipc_get_time();
+
+                const uint32_t status = read_status();
+                const bool fifo_empty = traits::tx_empty(status);
+                const unsigned room = tx_room(status);
+
+                const unsigned n = room ? fill_tx(room) : 0;
+                written += n;
+
+                if (n)
+                    stats.tx_bytes.fetch_add(n, std::memory_order_relaxed);
 
-                while (status_reg->bits.TX_FIFO_FULL)
+                if (n || fifo_empty)
                 {
-                    ipc_delay(5);
-                    if (is_exit)
-                        return written;
+                    // передатчик снова принимает данные
+                    if (tx_recovering)
+                        stats.add_recovery(polled - tx_progress);
+                    tx_recovering = false;
+                    tx_progress = polled;
                 }
-
+                else if (!tx_recovering && polled - tx_progress > timing.tx_stall_time())
                 {
-                    //fprintf(stderr, "%d: %s()\n", __LINE__, __func__);
+                    // FIFO не опустел за отведенное время: сбрасываем передатчик
+                    stats.tx_resets.fetch_add(1, std::memory_order_relaxed);
+                    traits::reset_tx(io);
+                    tx_recovering = true;
+                    ULOG_WARN("%s(): %s TX FIFO stalled, FIFO reset\n", __func__, traits::name);
+                    continue;
+                }
 
-                    if (write_queue.empty())
-                    {
-                        ipc_delay(5);
-                        continue;
-                    }
+                hw_lock.unlock();
+
+                // в неполностью известном FIFO продолжаем дозаполнение без ожидания
+                if (n && !fifo_empty)
+                    continue;
+
+                // FIFO опустеет через n символов (или fifo_depth, если он был не пуст)
+                const unsigned queued = fifo_empty ? (n ? n : timing.fifo_depth) : timing.fifo_depth;
+                pacer.sleep_until(polled + timing.service_time(queued));
+            }
+
+            ULOG_INFO("OK: written %ld bytes\n", written);
+
+            return written;
+        };
+
+        //! Транзакция запрос/ответ: запрос пишется прямо в FIFO передатчика, затем приемник
+        //! опрашивается без сна, пока matcher не примет накопленный ответ или не наступит deadline.
+        //! Потоки обмена на это время останавливаются на границе своей пачки; если они не
+        //! освободили FIFO до deadline, результат TRANSACT_TX_TIMEOUT. Данные, принятые
+        //! до запроса, отдаются в rx_sink. Если matcher не задан, ответом считается первый байт.
+        //! end_gap > 0 завершает ответ тишиной линии не короче end_gap после принятого байта
+        //! (кадры Modbus RTU); тогда без matcher ответ заканчивается только тишиной. Пустой
+        //! запрос только слушает линию: уже принятые байты считаются началом ответа, а до
+        //! первого байта приемник опрашивается с обычным интервалом потока приема.
+        transact_result transact(const uint8_t *request, size_t size, std::vector<uint8_t> &response,
+                                 const response_matcher_t &matcher, ipc_time_t deadline,
+                                 transact_timing *breakdown = nullptr,
+                                 std::chrono::nanoseconds end_gap = std::chrono::nanoseconds(0)) override
+        {
+            const ipc_time_t started = ipc_get_time();
+            transact_timing t;
+            transact_result result = TRANSACT_OK;
+            response.clear();
+
+            // приемник захватывается до передачи, чтобы ответ не ушел в поток приема
+            std::unique_lock<std::timed_mutex> rx_lock(hw_rx_lock, std::defer_lock);
+            std::unique_lock<std::timed_mutex> tx_lock(hw_tx_lock, std::defer_lock);
+            if (rx_lock.try_lock_until(deadline) && tx_lock.try_lock_until(deadline))
+            {
+                t.lock_wait = ipc_get_time() - started;
 
-                    while (!status_reg->bits.TX_FIFO_FULL)
+                uint8_t burst[traits::fifo_depth];
+                unsigned errors = 0;
+                unsigned n = size ? traits::fifo_depth : 0;
+                while (n == traits::fifo_depth && ipc_get_time() < deadline)
+                {
+                    n = drain_rx(burst, traits::fifo_depth, errors);
+                    if (n)
                     {
-                        //fprintf(stderr, "%d: %s()\n", __LINE__, __func__);
-                        
-                        if (is_exit)
-                            return written;
-
-                        if (!write_queue.empty())
-                        {
-                            std::lock_guard<std::mutex> _lock(write_lock);
-                            uint8_t v = write_queue.front();
-                            tx_fifo_reg->value = v;
-                            ++written;
-                            write_queue.pop_front();
-                        }
-                        else
-                        {
-                            continue;
-                        }
+                        std::lock_guard<std::mutex> sink_lock(rx_sink_lock);
+                        rx_sink(burst, n);
+                        stats.rx_bytes.fetch_add(n, std::memory_order_relaxed);
+                        t.stale_bytes += n;
                     }
                 }
+                count_rx_errors(errors);
+
+                result = push_request(request, size, deadline);
+                t.tx_done = ipc_get_time() - started;
+                tx_lock.unlock();
+            }
+            else
+            {
+                t.lock_wait = ipc_get_time() - started;
+                result = TRANSACT_TX_TIMEOUT;
             }
 
-            fprintf(stderr, "OK: written %ld bytes\n", written);
+            if (result == TRANSACT_OK)
+                result = poll_response(response, matcher, deadline, started, end_gap, size == 0, t);
 
-            return written;
-        };
+            t.complete = ipc_get_time() - started;
+            stats.transactions.fetch_add(1, std::memory_order_relaxed);
+            if (result != TRANSACT_OK)
+                stats.transact_timeouts.fetch_add(1, std::memory_order_relaxed);
+            if (breakdown)
+                *breakdown = t;
+
+            return result;
+        }
+
+        //! Запись прямо в FIFO передатчика в обход источника передачи; возвращается, когда
+        //! последний байт помещен в FIFO. Нужна ответам, которые нельзя задержать на интервал опроса.
+        transact_result send(const uint8_t *data, size_t size, ipc_time_t deadline) override
+        {
+            std::unique_lock<std::timed_mutex> tx_lock(hw_tx_lock, std::defer_lock);
+            if (!tx_lock.try_lock_until(deadline))
+                return TRANSACT_TX_TIMEOUT;
+            return push_request(data, size, deadline);
+        }
 
-        void stop()
+        void stop() override
         {
             is_exit = true;
         }
 
     private:
+        //! Если FIFO пуст, в него гарантированно помещается fifo_depth байт,
+        //! иначе свободное место неизвестно и пишем по одному байту до заполнения
+        unsigned tx_room(uint32_t status) const
+        {
+            if (traits::tx_empty(status))
+                return timing.fifo_depth;
+            return (traits::tx_partial_fill && !traits::tx_full(status)) ? 1 : 0;
+        }
+
+        //! Чтение сбрасывает флаги ошибок регистра, поэтому флаги, прочитанные любым потоком
+        //! (передачей, транзакцией), учитываются сразу и копятся до обработки приемником
+        uint32_t read_status()
+        {
+            uart_profile::mmio_scope _prof(profile.status_reg);
+            const uint32_t status = io.read(traits::status_offset);
+            const unsigned errors = traits::errors(status);
+            if (errors)
+            {
+                if (errors & UART_ERR_OVERRUN)
+                    stats.overrun_errors.fetch_add(1, std::memory_order_relaxed);
+                if (errors & UART_ERR_FRAME)
+                    stats.frame_errors.fetch_add(1, std::memory_order_relaxed);
+                if (errors & UART_ERR_PARITY)
+                    stats.parity_errors.fetch_add(1, std::memory_order_relaxed);
+                pending_errors.fetch_or(errors, std::memory_order_relaxed);
+            }
+            return status;
+        }
+
+        //! Флаги ошибок, прочитанные с прошлого вызова
+        unsigned take_errors()
+        {
+            return pending_errors.load(std::memory_order_relaxed) ? pending_errors.exchange(0, std::memory_order_relaxed) : 0;
+        }
+
+        uint8_t read_rx()
+        {
+            uart_profile::mmio_scope _prof(profile.rx_fifo_reg);
+            return io.read(traits::rx_offset);
+        }
+
+        //! Вычитывает из FIFO приемника не более max байт, накапливая флаги ошибок
+        unsigned drain_rx(uint8_t *burst, unsigned max, unsigned &errors)
+        {
+            uart_profile::section_scope _prof(profile.sections[uart_profile::PROF_RX_DRAIN]);
+            unsigned n = 0;
+            while (n < max)
+            {
+                if (!traits::rx_ready(read_status()))
+                    break;
+                burst[n++] = read_rx();
+            }
+            errors |= take_errors();
+            return n;
+        }
+
+        //! Записывает в FIFO передатчика не более room байт из источника
+        unsigned fill_tx(unsigned room)
+        {
+            uart_profile::section_scope _prof(profile.sections[uart_profile::PROF_TX_FILL]);
+            const uint8_t *data = nullptr;
+            const unsigned n = tx_source(data, room);
+            for (unsigned i = 0; i < n; i++)
+            {
+                io.write(traits::tx_offset, data[i]);
+            }
+            return n;
+        }
+
+        //! Обрабатывает накопленные ошибки приема (учтены в read_status()); при переполнении
+        //! сбрасывает FIFO и возвращает true
+        bool count_rx_errors(unsigned errors)
+        {
+            if (!(errors & UART_ERR_OVERRUN))
+                return false;
+
+            // после переполнения содержимое FIFO не согласовано с потоком: сбрасываем
+            stats.rx_resets.fetch_add(1, std::memory_order_relaxed);
+            traits::reset_rx(io);
+            ULOG_WARN("%s(): %s RX overrun, FIFO reset\n", __func__, traits::name);
+            return true;
+        }
+
+        //! Запись запроса транзакции в FIFO передатчика с ожиданием места до deadline
+        transact_result push_request(const uint8_t *request, size_t size, ipc_time_t deadline)
+        {
+            size_t sent = 0;
+            unsigned idle = 0;
+            while (sent < size)
+            {
+                const unsigned room = tx_room(read_status());
+                if (!room)
+                {
+                    if (is_exit)
+                        return TRANSACT_STOPPED;
+                    if (ipc_get_time() >= deadline)
+                        return TRANSACT_TX_TIMEOUT;
+                    // как в poll_response: символ короче кванта планировщика, поэтому только уступаем
+                    if (++idle % TRANSACT_YIELD_POLLS == 0)
+                        std::this_thread::yield();
+                    continue;
+                }
+
+                const size_t n = std::min<size_t>(room, size - sent);
+                for (size_t i = 0; i < n; i++)
+                {
+                    io.write(traits::tx_offset, request[sent + i]);
+                }
+                sent += n;
+                stats.tx_bytes.fetch_add(n, std::memory_order_relaxed);
+
+                // чтобы поток передачи не принял заполненный запросом FIFO за зависший
+                tx_progress = ipc_get_time();
+            }
+            return TRANSACT_OK;
+        }
+
+        //! Опрос приемника без сна до приема ответа; байты после принятого ответа остаются в FIFO.
+        //! Время берется до чтения состояния: пустой FIFO доказывает тишину с прошлого байта.
+        //! listen - ожидание без запроса: до первого байта опрос идет с интервалом rx_service_time(),
+        //! но не реже двух раз за end_gap - иначе кадр, принятый во время сна, завершится с опозданием
+        transact_result poll_response(std::vector<uint8_t> &response, const response_matcher_t &matcher,
+                                      ipc_time_t deadline, ipc_time_t started, std::chrono::nanoseconds end_gap,
+                                      bool listen, transact_timing &t)
+        {
+            transact_result result = TRANSACT_OK;
+            const bool by_gap = end_gap.count() > 0;
+            unsigned idle = 0;
+            ipc_time_t last_rx{};
+            service_pacer pacer;
+            const std::chrono::nanoseconds listen_interval = by_gap ? std::min<std::chrono::nanoseconds>(timing.rx_service_time(), end_gap / 2)
+                                                                    : timing.rx_service_time();
+
+            while (true)
+            {
+                const ipc_time_t polled = ipc_get_time();
+                const uint32_t status = read_status();
+                t.polls++;
+
+                if (traits::rx_ready(status))
+                {
+                    if (response.empty())
+                        t.first_byte = polled - started;
+                    else
+                        t.max_gap = std::max<std::chrono::nanoseconds>(t.max_gap, polled - last_rx);
+                    last_rx = polled;
+                    response.push_back(read_rx());
+                    stats.rx_bytes.fetch_add(1, std::memory_order_relaxed);
+                    if (matcher ? matcher(response.data(), response.size()) : !by_gap)
+                        break;
+                    idle = 0;
+                    continue;
+                }
+
+                if (by_gap && !response.empty() && polled - last_rx >= end_gap)
+                    break;
+                if (is_exit)
+                {
+                    result = TRANSACT_STOPPED;
+                    break;
+                }
+                if (polled >= deadline)
+                {
+                    result = TRANSACT_RX_TIMEOUT;
+                    break;
+                }
+
+                // линия молчит: FIFO вмещает половину своей глубины до опроса, как в потоке
+                // приема; после первого байта промежутки кадра меряются опросом без сна
+                if (listen && response.empty())
+                {
+                    pacer.sleep_until(std::min(polled + listen_interval, deadline));
+                    continue;
+                }
+
+                // квант планировщика больше времени символа, поэтому не спим, а только уступаем
+                if (++idle % TRANSACT_YIELD_POLLS == 0)
+                    std::this_thread::yield();
+            }
+
+            count_rx_errors(take_errors());
+            return result;
+        }
+
+        static bus_type map_bus(mapper_t mapper, uint32_t base_address, uint32_t size)
+        {
+            return bus_type(static_cast<volatile uint32_t *>(mapper->map(base_address, size)));
+        }
+
         mapper_t _mapper;
-        uint32_t *_base;
-        reg_rx_fifo *rx_fifo_reg = {nullptr};
-        reg_tx_fifo *tx_fifo_reg = {nullptr};
-        reg_ctrl *ctrl_reg = {nullptr};
-        reg_status *status_reg = {nullptr};
+        bus_type io;
         std::deque<uint8_t> &read_queue;
         std::deque<uint8_t> &write_queue;
         std::mutex &read_lock;
         std::mutex &write_lock;
-        std::vector<job_t> jobs;
-        bool is_exit{false};
+        rx_sink_t rx_sink;
+        tx_source_t tx_source;
+        uint8_t tx_burst[traits::fifo_depth];
+        line_timing timing;
+        uart_stats stats;
+        uart_profile::port_profile profile;
+        std::timed_mutex hw_rx_lock;    //!< FIFO приемника: поток приема или транзакция
+        std::timed_mutex hw_tx_lock;    //!< FIFO передатчика: поток передачи или транзакция
+        std::mutex rx_sink_lock;        //!< вызовы rx_sink по порядку приема; берется под hw_rx_lock
+        ipc_time_t tx_progress;     //!< последнее продвижение передатчика (FIFO пуст или принял данные)
+        std::atomic<unsigned> pending_errors{0};    //!< флаги ошибок, еще не обработанные приемником
+        std::atomic<bool> is_exit{false};
     };
+
+    //! PL UART на базе AXI UART Lite
+    using pl_uart = basic_pl_uart<uartlite_traits>;
 };
 
     //------------------------------------------------------------------------------
@@ -0,0 +1,386 @@
+
+#include "reliable_link.h"
+#include "crc.h"
+
+#include <string.h>
+#include <algorithm>
+#include <random>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+//! Разность номеров с учетом переполнения: > 0, если a новее b
+static inline int seq_diff(uint16_t a, uint16_t b)
+{
+    return int16_t(uint16_t(a - b));
+}
+
+//-----------------------------------------------------------------------------
+
+reliable_link::reliable_link(const rl_params& p) : params(p)
+{
+    params.window = std::clamp<unsigned>(params.window, 1, RL_MAX_WINDOW);
+    params.payload = std::clamp<size_t>(params.payload, 1, RL_MAX_PAYLOAD);
+
+    if (params.baud_rate) {
+        // до первого измерения подтверждение может ждать за кадром партнера:
+        // хвост своего кадра в FIFO, кадр партнера, сам ACK и запас на планирование
+        const std::chrono::nanoseconds char_time(10'000'000'000ull / params.baud_rate);
+        const auto frame_time = char_time * (RL_HEADER_SIZE + params.payload + RL_CRC_SIZE);
+        params.rto_initial = std::max(params.rto_initial, std::chrono::ceil<std::chrono::milliseconds>(4 * frame_time));
+    }
+    params.rto_max = std::max(params.rto_max, params.rto_initial);
+
+    // сеанс отличает кадры этого экземпляра от кадров прежнего процесса на той же линии
+    std::random_device rd;
+    while (tx_epoch == 0)
+        tx_epoch = uint16_t(rd());
+
+    // номер кадра отображается на ячейку по модулю RL_MAX_WINDOW, что согласовано с переполнением номера
+    tx_window.resize(RL_MAX_WINDOW);
+    rx_window.resize(RL_MAX_WINDOW);
+    frame.reserve(RL_HEADER_SIZE + params.payload + RL_CRC_SIZE);
+    chunk.reserve(params.payload);
+}
+
+//-----------------------------------------------------------------------------
+
+unsigned reliable_link::in_flight() const
+{
+    std::lock_guard<std::mutex> _lock(state_lock);
+    return uint16_t(tx_next - tx_base);
+}
+
+//-----------------------------------------------------------------------------
+
+std::chrono::nanoseconds reliable_link::rto() const
+{
+    std::chrono::nanoseconds base = params.rto_initial;
+    if (srtt.count() != 0)
+        base = std::max<std::chrono::nanoseconds>(params.rto_min, srtt + 4 * rttvar);
+    // удвоение за каждый повтор по таймауту: молчащий партнер не получает окно каждые несколько мс
+    for (unsigned i = 0; i < rto_backoff && base < params.rto_max; i++)
+        base *= 2;
+    return std::min<std::chrono::nanoseconds>(base, params.rto_max);
+}
+
+//-----------------------------------------------------------------------------
+
+void reliable_link::make_frame(uint8_t type, uint16_t seq, uint16_t base, uint16_t epoch, const uint8_t* payload, size_t size)
+{
+    frame.resize(RL_HEADER_SIZE + size + RL_CRC_SIZE);
+    frame[0] = RL_SOF0;
+    frame[1] = RL_SOF1;
+    frame[2] = type;
+    frame[3] = uint8_t(seq);
+    frame[4] = uint8_t(seq >> 8);
+    frame[5] = uint8_t(base);
+    frame[6] = uint8_t(base >> 8);
+    frame[7] = uint8_t(epoch);
+    frame[8] = uint8_t(epoch >> 8);
+    frame[9] = uint8_t(size);
+    frame[10] = uint8_t(size >> 8);
+    if (size)
+        memcpy(frame.data() + RL_HEADER_SIZE, payload, size);
+    const uint16_t crc = crc::crc16_ccitt(frame.data() + 2, RL_HEADER_SIZE - 2 + size);
+    frame[RL_HEADER_SIZE + size] = uint8_t(crc >> 8);
+    frame[RL_HEADER_SIZE + size + 1] = uint8_t(crc);
+    frame_offset = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void reliable_link::send_slot(tx_slot& slot, ipc_time_t now)
+{
+    make_frame(RL_FRAME_DATA, slot.seq, tx_base, tx_epoch, slot.data.data(), slot.data.size());
+    slot.sent = now;
+    frame_data = true;
+    frame_seq = slot.seq;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Последний байт кадра данных отдан драйверу: отсюда отсчитываются RTT и RTO,
+//! чтобы время передачи самого кадра по медленной линии не считалось ожиданием ответа
+void reliable_link::frame_sent()
+{
+    frame_data = false;
+    std::lock_guard<std::mutex> _lock(state_lock);
+    tx_slot& slot = tx_window[frame_seq % RL_MAX_WINDOW];
+    if (slot.used && slot.seq == frame_seq)
+        slot.sent = ipc_get_time();
+}
+
+//-----------------------------------------------------------------------------
+
+bool reliable_link::next_frame()
+{
+    std::lock_guard<std::mutex> _lock(state_lock);
+    const ipc_time_t now = ipc_get_time();
+
+    // подтверждения идут первыми: от них зависит окно партнера
+    if (ack_pending) {
+        uint64_t sack = 0;
+        for (unsigned i = 0; i + 1 < params.window; i++) {
+            if (rx_window[uint16_t(rx_next + 1 + i) % RL_MAX_WINDOW].present)
+                sack |= 1ull << i;
+        }
+        uint8_t payload[8];
+        for (unsigned i = 0; i < 8; i++)
+            payload[i] = uint8_t(sack >> (8 * i));
+        make_frame(RL_FRAME_ACK, rx_next, 0, rx_epoch, payload, sizeof(payload));
+        frame_data = false;
+        ack_pending = false;
+        stats.acks_sent.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // повтор самого старого потерянного кадра: позже него отправлен и уже
+    // подтвержден другой кадр, или истек таймаут
+    ipc_time_t latest_acked{};
+    tx_slot* lost = nullptr;
+    bool fast = false;
+    const auto timeout = rto();
+    for (uint16_t seq = tx_next; seq != tx_base;) {
+        --seq;
+        tx_slot& slot = tx_window[seq % RL_MAX_WINDOW];
+        if (slot.acked) {
+            latest_acked = std::max(latest_acked, slot.sent);
+            continue;
+        }
+        if (slot.sent < latest_acked) {
+            lost = &slot;
+            fast = true;
+        } else if (now - slot.sent > timeout) {
+            lost = &slot;
+            fast = false;
+        }
+    }
+    if (lost) {
+        lost->retransmitted = true;
+        send_slot(*lost, now);
+        if (fast) {
+            stats.fast_retransmits.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            rto_backoff = std::min(rto_backoff + 1, 16u);
+            stats.retransmits.fetch_add(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // новые данные, пока окно не заполнено
+    if (uint16_t(tx_next - tx_base) >= params.window)
+        return false;
+
+    chunk.clear();
+    while (chunk.size() < params.payload) {
+        const uint8_t* data = nullptr;
+        const size_t n = tx_source ? tx_source(data, params.payload - chunk.size()) : 0;
+        if (!n)
+            break;
+        chunk.insert(chunk.end(), data, data + n);
+    }
+    if (chunk.empty())
+        return false;
+
+    tx_slot& slot = tx_window[tx_next % RL_MAX_WINDOW];
+    slot.seq = tx_next++;
+    slot.used = true;
+    slot.acked = false;
+    slot.retransmitted = false;
+    slot.data.assign(chunk.begin(), chunk.end());
+    send_slot(slot, now);
+    stats.tx_frames.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t reliable_link::read_tx(const uint8_t*& data, size_t max)
+{
+    if (frame_offset == frame.size() && !next_frame())
+        return 0;
+
+    const size_t n = std::min(max, frame.size() - frame_offset);
+    data = frame.data() + frame_offset;
+    frame_offset += n;
+    if (frame_offset == frame.size() && frame_data)
+        frame_sent();
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+void reliable_link::on_ack(uint16_t cum, uint16_t epoch, uint64_t sack, ipc_time_t now)
+{
+    // подтверждение кадров прежнего экземпляра или за пределами отправленного -
+    // искаженный или устаревший кадр
+    if (epoch != tx_epoch || seq_diff(cum, tx_base) < 0 || seq_diff(cum, tx_next) > 0)
+        return;
+
+    // время подтверждения измеряется только по кадрам без повторов (алгоритм Карна)
+    auto sample = [&](const tx_slot& slot) {
+        if (slot.retransmitted)
+            return;
+        const std::chrono::nanoseconds rtt = now - slot.sent;
+        if (srtt.count() == 0) {
+            srtt = rtt;
+            rttvar = rtt / 2;
+        } else {
+            const std::chrono::nanoseconds err = srtt > rtt ? srtt - rtt : rtt - srtt;
+            rttvar = (3 * rttvar + err) / 4;
+            srtt = (7 * srtt + rtt) / 8;
+        }
+        stats.srtt_us.store(srtt.count() / 1000, std::memory_order_relaxed);
+        rto_backoff = 0;
+    };
+
+    if (cum != tx_base) {
+        tx_slot& newest = tx_window[uint16_t(cum - 1) % RL_MAX_WINDOW];
+        if (!newest.acked)
+            sample(newest);
+    }
+    for (; tx_base != cum; ++tx_base) {
+        tx_slot& slot = tx_window[tx_base % RL_MAX_WINDOW];
+        slot.used = false;
+        slot.acked = false;
+    }
+
+    for (unsigned i = 0; i < 64; i++) {
+        if (!(sack & (1ull << i)))
+            continue;
+        const uint16_t seq = uint16_t(cum + 1 + i);
+        if (seq_diff(seq, tx_next) >= 0)
+            break;
+        tx_slot& slot = tx_window[seq % RL_MAX_WINDOW];
+        if (slot.used && !slot.acked) {
+            sample(slot);
+            slot.acked = true;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void reliable_link::on_data(uint16_t seq, uint16_t base, uint16_t epoch, const uint8_t* payload, size_t size)
+{
+    // хвост завершившегося отправителя, дошедший после кадров нового
+    if (epoch == rx_prev_epoch && epoch != rx_epoch) {
+        stats.rx_stale.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // новый сеанс: партнер перезапущен или мы сами приняли первый кадр после
+    // запуска. Все до основания партнер уже считает подтвержденным и повторять
+    // не будет, принятое от прежнего сеанса без пропусков уже отдано получателю
+    if (epoch != rx_epoch) {
+        if (rx_epoch != 0)
+            stats.resyncs.fetch_add(1, std::memory_order_relaxed);
+        rx_prev_epoch = rx_epoch;
+        rx_epoch = epoch;
+        rx_next = base;
+        for (auto& slot : rx_window) {
+            slot.present = false;
+            slot.data.clear();
+        }
+    }
+
+    // ответим в любом случае: повтор означает, что прошлое подтверждение не дошло
+    ack_pending = true;
+
+    const int d = seq_diff(seq, rx_next);
+    if (d < 0) {
+        stats.rx_duplicates.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (d >= int(params.window)) {
+        stats.rx_out_of_window.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    rx_slot& slot = rx_window[seq % RL_MAX_WINDOW];
+    if (slot.present) {
+        stats.rx_duplicates.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    slot.present = true;
+    slot.data.assign(payload, payload + size);
+    stats.rx_frames.fetch_add(1, std::memory_order_relaxed);
+
+    // непрерывную часть окна отдаем получателю по порядку
+    while (rx_window[rx_next % RL_MAX_WINDOW].present) {
+        rx_slot& next = rx_window[rx_next % RL_MAX_WINDOW];
+        deliver.push_back(std::move(next.data));
+        next.data.clear();
+        next.present = false;
+        ++rx_next;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void reliable_link::write_rx(const uint8_t* data, size_t size)
+{
+    rx_pending.insert(rx_pending.end(), data, data + size);
+
+    size_t pos = 0;
+    while (rx_pending.size() - pos >= RL_HEADER_SIZE + RL_CRC_SIZE) {
+
+        const uint8_t* p = rx_pending.data() + pos;
+        if (p[0] != RL_SOF0 || p[1] != RL_SOF1) {
+            ++pos;
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        const uint8_t type = p[2];
+        const uint16_t seq = uint16_t(p[3] | (p[4] << 8));
+        const uint16_t base = uint16_t(p[5] | (p[6] << 8));
+        const uint16_t epoch = uint16_t(p[7] | (p[8] << 8));
+        const size_t payload = p[9] | (size_t(p[10]) << 8);
+        if (payload > RL_MAX_PAYLOAD || (type == RL_FRAME_ACK && payload != 8) || type > RL_FRAME_ACK) {
+            ++pos;
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (rx_pending.size() - pos < RL_HEADER_SIZE + payload + RL_CRC_SIZE)
+            break;
+
+        const uint16_t crc = uint16_t((p[RL_HEADER_SIZE + payload] << 8) | p[RL_HEADER_SIZE + payload + 1]);
+        if (crc::crc16_ccitt(p + 2, RL_HEADER_SIZE - 2 + payload) != crc) {
+            // ложный SOF или искаженный кадр: отправитель повторит его
+            ++pos;
+            stats.crc_errors.fetch_add(1, std::memory_order_relaxed);
+            stats.skipped_bytes.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> _lock(state_lock);
+            if (type == RL_FRAME_ACK) {
+                uint64_t sack = 0;
+                for (unsigned i = 0; i < 8; i++)
+                    sack |= uint64_t(p[RL_HEADER_SIZE + i]) << (8 * i);
+                on_ack(seq, epoch, sack, ipc_get_time());
+            } else {
+                on_data(seq, base, epoch, p + RL_HEADER_SIZE, payload);
+            }
+        }
+
+        // получатель вызывается без блокировки, чтобы не задерживать передачу
+        for (auto& block : deliver) {
+            stats.delivered_bytes.fetch_add(block.size(), std::memory_order_relaxed);
+            if (rx_sink)
+                rx_sink(block.data(), block.size());
+        }
+        deliver.clear();
+
+        pos += RL_HEADER_SIZE + payload + RL_CRC_SIZE;
+    }
+    rx_pending.erase(rx_pending.begin(), rx_pending.begin() + pos);
+}
+
+//-----------------------------------------------------------------------------
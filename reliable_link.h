@@ -0,0 +1,171 @@
+#ifndef RELIABLE_LINK_H
+#define RELIABLE_LINK_H
+
+#include "time_ipc.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//! Надежная доставка поверх потока байт со скользящим окном.
+//! Кадр: SOF0, SOF1, тип, номер (16 бит), основание (16 бит), сеанс (16 бит),
+//! длина (16 бит), данные, CRC-16/CCITT от типа до конца данных; многобайтные
+//! поля младшим байтом вперед.
+//! Получатель подтверждает кадры кадром ACK: в поле номера - следующий
+//! ожидаемый номер (накопительное подтверждение), в данных - 64-битная маска
+//! принятых кадров после него (выборочное подтверждение). Отправитель держит в
+//! полете до window кадров и повторяет только потерянные: кадр, после которого
+//! уже подтвержден отправленный позже, или кадр без подтверждения за время RTO.
+//! Время кадра отсчитывается от передачи драйверу его последнего байта; каждый
+//! повтор по таймауту удваивает RTO, новое измерение RTT возвращает его к расчетному.
+//! Пока идут повторы, окно продолжает заполняться новыми данными.
+//! Каждый экземпляр при создании выбирает случайный ненулевой номер сеанса. Кадр
+//! данных несет сеанс отправителя и основание - его самый старый неподтвержденный
+//! номер; ACK несет сеанс подтверждаемых данных. Получатель, увидев кадр данных
+//! нового сеанса, начинает прием с основания этого кадра, а отправитель отбрасывает
+//! подтверждения чужого сеанса: перезапуск одной стороны не сбивает окна другой,
+//! теряется только то, что было в полете к завершившемуся процессу или от него.
+//-----------------------------------------------------------------------------
+
+constexpr uint8_t RL_SOF0 = 0xD3;
+constexpr uint8_t RL_SOF1 = 0x3D;
+constexpr unsigned RL_HEADER_SIZE = 11;     //!< SOF0, SOF1, тип, номер, основание, сеанс, длина
+constexpr unsigned RL_CRC_SIZE = 2;
+constexpr unsigned RL_MAX_WINDOW = 64;      //!< ограничено маской выборочного подтверждения
+constexpr size_t RL_MAX_PAYLOAD = 1024;
+
+//! Типы кадров
+enum rl_frame_type
+{
+    RL_FRAME_DATA = 0,
+    RL_FRAME_ACK = 1,
+};
+
+//! Параметры канала
+struct rl_params
+{
+    unsigned window{16};                            //!< кадров в полете, не больше RL_MAX_WINDOW
+    size_t payload{128};                            //!< наибольшие данные кадра
+    std::chrono::milliseconds rto_min{10};          //!< нижняя граница таймаута повтора
+    std::chrono::milliseconds rto_initial{200};     //!< таймаут до первого измерения RTT
+    std::chrono::milliseconds rto_max{3000};        //!< верхняя граница таймаута при удвоении
+    uint32_t baud_rate{0};                          //!< скорость линии; если задана, начальный таймаут
+                                                    //!< не меньше времени передачи кадров в обе стороны
+};
+
+//! Счетчики канала
+struct rl_stats
+{
+    std::atomic<uint64_t> tx_frames{0};         //!< новые кадры данных
+    std::atomic<uint64_t> retransmits{0};       //!< повторы по таймауту
+    std::atomic<uint64_t> fast_retransmits{0};  //!< повторы по выборочному подтверждению
+    std::atomic<uint64_t> acks_sent{0};
+    std::atomic<uint64_t> rx_frames{0};         //!< принятые кадры данных без ошибок
+    std::atomic<uint64_t> rx_duplicates{0};
+    std::atomic<uint64_t> rx_out_of_window{0};
+    std::atomic<uint64_t> rx_stale{0};          //!< кадры данных прежнего сеанса партнера
+    std::atomic<uint64_t> resyncs{0};           //!< переходы приема на новый сеанс партнера
+    std::atomic<uint64_t> crc_errors{0};
+    std::atomic<uint64_t> skipped_bytes{0};     //!< байты, пропущенные при поиске начала кадра
+    std::atomic<uint64_t> delivered_bytes{0};
+    std::atomic<uint64_t> srtt_us{0};           //!< сглаженное время подтверждения
+};
+
+//-----------------------------------------------------------------------------
+
+//! Надежный канал между портом и его источником/получателем данных.
+//! read_tx() и write_rx() подключаются к pl_uart как источник передачи и
+//! получатель приема; получатель данных вызывается в порядке отправки без
+//! пропусков и повторов.
+class reliable_link
+{
+public:
+    using source_t = std::function<size_t(const uint8_t*& data, size_t max)>;
+    using sink_t = std::function<void(const uint8_t* data, size_t size)>;
+
+    explicit reliable_link(const rl_params& params = rl_params());
+
+    //! Источник данных на передачу; задается до запуска порта
+    void set_source(source_t source) { tx_source = std::move(source); }
+
+    //! Получатель доставленных данных; задается до запуска порта
+    void set_sink(sink_t sink) { rx_sink = std::move(sink); }
+
+    //! Источник для pl_uart::set_tx_source(): следующий кусок текущего кадра
+    size_t read_tx(const uint8_t*& data, size_t max);
+
+    //! Получатель для pl_uart::set_rx_sink(): разбор кадров, подтверждения, доставка
+    void write_rx(const uint8_t* data, size_t size);
+
+    //! Кадры, отправленные и еще не подтвержденные
+    unsigned in_flight() const;
+
+    const rl_stats& get_stats() const { return stats; }
+
+private:
+    struct tx_slot
+    {
+        uint16_t seq{0};
+        bool used{false};
+        bool acked{false};
+        bool retransmitted{false};
+        ipc_time_t sent;
+        std::vector<uint8_t> data;
+    };
+
+    struct rx_slot
+    {
+        bool present{false};
+        std::vector<uint8_t> data;
+    };
+
+    bool next_frame();
+    void make_frame(uint8_t type, uint16_t seq, uint16_t base, uint16_t epoch, const uint8_t* payload, size_t size);
+    void send_slot(tx_slot& slot, ipc_time_t now);
+    void frame_sent();
+    void on_ack(uint16_t cum, uint16_t epoch, uint64_t sack, ipc_time_t now);
+    void on_data(uint16_t seq, uint16_t base, uint16_t epoch, const uint8_t* payload, size_t size);
+    std::chrono::nanoseconds rto() const;
+
+    rl_params params;
+    source_t tx_source;
+    sink_t rx_sink;
+
+    // состояние отправителя и получателя; кадры ACK формирует поток передачи,
+    // а подтверждения разбирает поток приема
+    mutable std::mutex state_lock;
+    std::vector<tx_slot> tx_window;     //!< по номеру seq % window
+    uint16_t tx_base{0};                //!< самый старый неподтвержденный номер
+    uint16_t tx_next{0};                //!< номер следующего нового кадра
+    uint16_t tx_epoch{0};               //!< свой сеанс, не меняется после создания
+    std::vector<rx_slot> rx_window;
+    uint16_t rx_next{0};                //!< следующий ожидаемый номер
+    uint16_t rx_epoch{0};               //!< сеанс партнера, 0 - еще не принят
+    uint16_t rx_prev_epoch{0};          //!< прежний сеанс партнера: его кадры еще могут быть в линии
+    bool ack_pending{false};
+    std::chrono::nanoseconds srtt{0};
+    std::chrono::nanoseconds rttvar{0};
+    unsigned rto_backoff{0};            //!< повторов по таймауту без нового измерения RTT
+
+    // используется только потоком передачи
+    std::vector<uint8_t> frame;
+    size_t frame_offset{0};
+    bool frame_data{false};             //!< текущий кадр - кадр данных frame_seq
+    uint16_t frame_seq{0};
+    std::vector<uint8_t> chunk;
+
+    // используется только потоком приема
+    std::vector<uint8_t> rx_pending;
+    std::vector<std::vector<uint8_t>> deliver;
+
+    rl_stats stats;
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // RELIABLE_LINK_H
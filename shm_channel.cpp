@@ -0,0 +1,434 @@
+
+#include "shm_channel.h"
+#include "exceptinfo.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+namespace shm_channel
+{
+    //! Порция, которой драйвер пишет в кольцо RX: клиент проверяет, не перезаписаны ли
+    //! скопированные данные, с учетом одной незавершенной записи такого размера
+    static size_t rx_chunk(uint32_t rx_capacity)
+    {
+        return rx_capacity / 4;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    static uint32_t round_pow2(uint32_t size)
+    {
+        uint32_t capacity = 64;
+        while (capacity < size)
+            capacity <<= 1;
+        return capacity;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    // futex в разделяемой памяти: без FUTEX_PRIVATE_FLAG
+    static void futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, int timeout_ms)
+    {
+        struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT, expected, (timeout_ms < 0) ? nullptr : &ts, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<uint32_t> *addr)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    static void copy_from_ring(uint8_t *dst, const uint8_t *ring, size_t capacity, uint64_t pos, size_t n)
+    {
+        const size_t offset = pos & (capacity - 1);
+        const size_t first = std::min(n, capacity - offset);
+        memcpy(dst, ring + offset, first);
+        memcpy(dst + first, ring, n - first);
+    }
+
+    static void copy_to_ring(uint8_t *ring, size_t capacity, uint64_t pos, const uint8_t *src, size_t n)
+    {
+        const size_t offset = pos & (capacity - 1);
+        const size_t first = std::min(n, capacity - offset);
+        memcpy(ring + offset, src, first);
+        memcpy(ring, src + first, n - first);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    size_t segment_size(uint32_t rx_capacity, uint32_t tx_capacity)
+    {
+        return sizeof(shm_header) + rx_capacity + size_t(tx_capacity) * SHM_MAX_CLIENTS;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    static bool process_alive(int32_t pid)
+    {
+        return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+    }
+
+    //! Процесс драйвера, который обслуживает существующий сегмент name; 0 - сегмента
+    //! нет, он чужого формата или его драйвер завершился
+    static int32_t segment_owner(const std::string &name)
+    {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return 0;
+
+        struct stat st;
+        int32_t owner = 0;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(shm_header)) {
+            void *va = mmap(0, sizeof(shm_header), PROT_READ, MAP_SHARED, fd, 0);
+            if (va != MAP_FAILED) {
+                const shm_header *hdr = static_cast<const shm_header *>(va);
+                if (hdr->magic == SHM_MAGIC && hdr->version == SHM_VERSION && hdr->server_alive.load())
+                    owner = hdr->server_pid.load();
+                munmap(va, sizeof(shm_header));
+            }
+        }
+        close(fd);
+
+        return process_alive(owner) ? owner : 0;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    shm_channel_server::shm_channel_server(const std::string &name, uint32_t rx_capacity, uint32_t tx_capacity) : _name(name)
+    {
+        rx_capacity = round_pow2(rx_capacity);
+        tx_capacity = round_pow2(tx_capacity);
+        size = segment_size(rx_capacity, tx_capacity);
+
+        // сегмент, оставшийся от аварийно завершенного драйвера, создается заново;
+        // сегмент работающего драйвера не трогаем
+        const int32_t owner = segment_owner(_name);
+        if (owner) {
+            throw except_info("%s, %d: %s() - Shared memory %s is served by process %d\n", __FILE__, __LINE__, __FUNCTION__, _name.c_str(), owner);
+        }
+        shm_unlink(_name.c_str());
+
+        // данные порта доступны только владельцу и его группе
+        int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+        if (fd < 0) {
+            throw except_info("%s, %d: %s() - Can't create shared memory %s: %s\n", __FILE__, __LINE__, __FUNCTION__, _name.c_str(), strerror(errno));
+        }
+
+        if (ftruncate(fd, size) < 0) {
+            close(fd);
+            shm_unlink(_name.c_str());
+            throw except_info("%s, %d: %s() - Can't resize shared memory %s: %s\n", __FILE__, __LINE__, __FUNCTION__, _name.c_str(), strerror(errno));
+        }
+
+        void *va = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (va == MAP_FAILED) {
+            shm_unlink(_name.c_str());
+            throw except_info("%s, %d: %s() - Can't map shared memory %s: %s\n", __FILE__, __LINE__, __FUNCTION__, _name.c_str(), strerror(errno));
+        }
+
+        // сегмент после ftruncate заполнен нулями, что соответствует начальному состоянию колец
+        hdr = new (va) shm_header;
+        hdr->rx_capacity = rx_capacity;
+        hdr->tx_capacity = tx_capacity;
+        hdr->version = SHM_VERSION;
+        hdr->server_pid.store(getpid());
+        hdr->server_alive.store(1);
+        std::atomic_thread_fence(std::memory_order_release);
+        hdr->magic = SHM_MAGIC;
+
+        rx_buf = reinterpret_cast<uint8_t *>(hdr + 1);
+        tx_buf = rx_buf + rx_capacity;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    shm_channel_server::~shm_channel_server()
+    {
+        if (hdr) {
+            hdr->server_alive.store(0);
+            hdr->rx_seq.fetch_add(1);
+            hdr->tx_seq.fetch_add(1);
+            futex_wake(&hdr->rx_seq);
+            futex_wake(&hdr->tx_seq);
+            munmap(hdr, size);
+        }
+        shm_unlink(_name.c_str());
+    }
+
+    //-----------------------------------------------------------------------------
+
+    void shm_channel_server::write_rx(const uint8_t *data, size_t count)
+    {
+        const uint32_t capacity = hdr->rx_capacity;
+        const size_t chunk = rx_chunk(capacity);
+
+        uint64_t head = hdr->rx_head.load(std::memory_order_relaxed);
+        while (count) {
+            size_t n = std::min(count, chunk);
+            copy_to_ring(rx_buf, capacity, head, data, n);
+            head += n;
+            hdr->rx_head.store(head, std::memory_order_release);
+            data += n;
+            count -= n;
+        }
+
+        // системный вызов только если есть ожидающие клиенты
+        hdr->rx_seq.fetch_add(1);
+        if (hdr->rx_waiters.load())
+            futex_wake(&hdr->rx_seq);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    void shm_channel_server::commit_tx()
+    {
+        if (pending_slot < 0)
+            return;
+
+        client_slot &slot = hdr->slots[pending_slot];
+        slot.tx_tail.store(slot.tx_tail.load(std::memory_order_relaxed) + pending_size, std::memory_order_release);
+        pending_slot = -1;
+        pending_size = 0;
+
+        hdr->tx_seq.fetch_add(1);
+        if (hdr->tx_waiters.load())
+            futex_wake(&hdr->tx_seq);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    size_t shm_channel_server::read_tx(const uint8_t *&data, size_t max)
+    {
+        // участок, выданный в прошлый раз, уже записан в FIFO передатчика
+        commit_tx();
+
+        const uint32_t capacity = hdr->tx_capacity;
+
+        for (unsigned i = 0; i < SHM_MAX_CLIENTS; i++) {
+
+            const unsigned idx = (next_slot + i) % SHM_MAX_CLIENTS;
+            client_slot &slot = hdr->slots[idx];
+            if (slot.in_use.load(std::memory_order_acquire) != SLOT_ACTIVE)
+                continue;
+
+            // base читается после head: новые данные клиента видны вместе с его base
+            uint64_t tail = slot.tx_tail.load(std::memory_order_relaxed);
+            const uint64_t head = slot.tx_head.load(std::memory_order_acquire);
+            const uint64_t base = slot.tx_base.load(std::memory_order_acquire);
+            if (tail < base) {
+                // непереданные данные завершившегося клиента, чей слот занят заново
+                tail = base;
+                slot.tx_tail.store(tail, std::memory_order_release);
+            }
+            if (head <= tail)
+                continue;
+
+            const size_t offset = tail & (capacity - 1);
+            const size_t n = std::min<uint64_t>({max, head - tail, capacity - offset});
+
+            data = tx_buf + size_t(idx) * capacity + offset;
+            pending_slot = idx;
+            pending_size = n;
+            next_slot = idx + 1;
+            return n;
+        }
+
+        return 0;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    shm_channel_client::shm_channel_client(const std::string &name)
+    {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            throw except_info("%s, %d: %s() - Can't open shared memory %s: %s\n", __FILE__, __LINE__, __FUNCTION__, name.c_str(), strerror(errno));
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(shm_header)) {
+            close(fd);
+            throw except_info("%s, %d: %s() - Invalid shared memory %s\n", __FILE__, __LINE__, __FUNCTION__, name.c_str());
+        }
+        size = st.st_size;
+
+        void *va = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (va == MAP_FAILED) {
+            throw except_info("%s, %d: %s() - Can't map shared memory %s: %s\n", __FILE__, __LINE__, __FUNCTION__, name.c_str(), strerror(errno));
+        }
+
+        hdr = static_cast<shm_header *>(va);
+        if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION || size != segment_size(hdr->rx_capacity, hdr->tx_capacity)) {
+            munmap(va, size);
+            throw except_info("%s, %d: %s() - Incompatible shared memory %s\n", __FILE__, __LINE__, __FUNCTION__, name.c_str());
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        rx_buf = reinterpret_cast<uint8_t *>(hdr + 1);
+
+        // занимаем свободный слот или слот завершившегося процесса
+        const int32_t pid = getpid();
+        for (unsigned i = 0; i < SHM_MAX_CLIENTS; i++) {
+
+            client_slot &s = hdr->slots[i];
+            uint32_t free_slot = SLOT_FREE;
+            int32_t owner = s.pid.load();
+            if (s.in_use.compare_exchange_strong(free_slot, SLOT_CLAIMING) ||
+                (owner && !process_alive(owner) && s.pid.compare_exchange_strong(owner, pid))) {
+                slot = &s;
+                tx_buf = rx_buf + hdr->rx_capacity + size_t(i) * hdr->tx_capacity;
+                break;
+            }
+        }
+
+        if (!slot) {
+            munmap(va, size);
+            throw except_info("%s, %d: %s() - No free client slots in %s\n", __FILE__, __LINE__, __FUNCTION__, name.c_str());
+        }
+
+        // пока позиции сбрасываются, драйвер слот не обслуживает; данные прежнего
+        // клиента до tx_base драйвер пропустит
+        slot->in_use.store(SLOT_CLAIMING);
+        slot->pid.store(pid);
+        slot->tx_base.store(slot->tx_head.load(std::memory_order_relaxed), std::memory_order_release);
+        slot->rx_lost.store(0);
+        slot->rx_cursor.store(hdr->rx_head.load(std::memory_order_acquire));
+        slot->in_use.store(SLOT_ACTIVE, std::memory_order_release);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    shm_channel_client::~shm_channel_client()
+    {
+        if (slot) {
+            slot->pid.store(0);
+            slot->in_use.store(SLOT_FREE, std::memory_order_release);
+        }
+        if (hdr)
+            munmap(hdr, size);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    static int remaining_ms(std::chrono::steady_clock::time_point deadline)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        return left > 0 ? int(left) : 0;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    size_t shm_channel_client::recv(uint8_t *data, size_t max, int timeout_ms)
+    {
+        const uint32_t capacity = hdr->rx_capacity;
+        const size_t chunk = rx_chunk(capacity);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+        while (true) {
+
+            uint64_t cur = slot->rx_cursor.load(std::memory_order_relaxed);
+            uint64_t head = hdr->rx_head.load(std::memory_order_acquire);
+
+            // клиент отстал больше чем на кольцо: пропускаем перезаписанные данные
+            if (head - cur > capacity - chunk) {
+                uint64_t next = head - (capacity - chunk);
+                slot->rx_lost.fetch_add(next - cur, std::memory_order_relaxed);
+                cur = next;
+                slot->rx_cursor.store(cur, std::memory_order_relaxed);
+            }
+
+            if (head == cur) {
+                int left = remaining_ms(deadline);
+                if (!left || !hdr->server_alive.load())
+                    return 0;
+
+                uint32_t seq = hdr->rx_seq.load();
+                hdr->rx_waiters.fetch_add(1);
+                if (hdr->rx_head.load() == cur)
+                    futex_wait(&hdr->rx_seq, seq, left);
+                hdr->rx_waiters.fetch_sub(1);
+                continue;
+            }
+
+            const size_t n = std::min<uint64_t>(max, head - cur);
+            copy_from_ring(data, rx_buf, capacity, cur, n);
+
+            // пока копировали, драйвер мог перезаписать начало участка
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t check = hdr->rx_head.load(std::memory_order_relaxed);
+            if (check + chunk - cur > capacity)
+                continue;
+
+            slot->rx_cursor.store(cur + n, std::memory_order_relaxed);
+            return n;
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+
+    size_t shm_channel_client::send(const uint8_t *data, size_t count, int timeout_ms)
+    {
+        const uint32_t capacity = hdr->tx_capacity;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        size_t done = 0;
+
+        while (done < count) {
+
+            const uint64_t head = slot->tx_head.load(std::memory_order_relaxed);
+            const uint64_t tail = slot->tx_tail.load(std::memory_order_acquire);
+            const size_t room = capacity - size_t(head - tail);
+
+            if (!room) {
+                int left = remaining_ms(deadline);
+                if (!left || !hdr->server_alive.load())
+                    break;
+
+                uint32_t seq = hdr->tx_seq.load();
+                hdr->tx_waiters.fetch_add(1);
+                if (slot->tx_tail.load() == tail)
+                    futex_wait(&hdr->tx_seq, seq, left);
+                hdr->tx_waiters.fetch_sub(1);
+                continue;
+            }
+
+            const size_t n = std::min(room, count - done);
+            copy_to_ring(tx_buf, capacity, head, data + done, n);
+            slot->tx_head.store(head + n, std::memory_order_release);
+            done += n;
+        }
+
+        return done;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    uint64_t shm_channel_client::lost() const
+    {
+        return slot->rx_lost.load(std::memory_order_relaxed);
+    }
+};
+
+//-----------------------------------------------------------------------------
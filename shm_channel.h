@@ -0,0 +1,135 @@
+
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <string>
+
+//-----------------------------------------------------------------------------
+//! Каналы приема и передачи порта в именованной разделяемой памяти POSIX.
+//! Процесс драйвера (shm_channel_server) пишет принятые данные в общее кольцо
+//! RX, каждый клиент читает его со своей позиции. На передачу у каждого клиента
+//! свое кольцо TX, которое драйвер выбирает по кругу. Кольца не используют
+//! блокировок; ожидание выполняется на futex только при отсутствии данных/места.
+//-----------------------------------------------------------------------------
+
+namespace shm_channel
+{
+    constexpr uint32_t SHM_MAGIC = 0x554C5348; // "HSLU"
+    constexpr uint32_t SHM_VERSION = 2;
+    constexpr unsigned SHM_MAX_CLIENTS = 8;
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "64-bit atomics must be lock-free in shared memory");
+
+    //! Состояние слота клиента
+    enum slot_state : uint32_t
+    {
+        SLOT_FREE,
+        SLOT_ACTIVE,    //!< драйвер обслуживает кольцо TX слота
+        SLOT_CLAIMING,  //!< клиент занял слот и еще не сбросил его позиции
+    };
+
+    //! Слот клиента: позиция чтения RX и собственное кольцо TX
+    struct alignas(64) client_slot
+    {
+        std::atomic<uint32_t> in_use;
+        std::atomic<int32_t> pid;
+        std::atomic<uint64_t> rx_cursor;
+        std::atomic<uint64_t> rx_lost;
+        alignas(64) std::atomic<uint64_t> tx_head;  //!< пишет клиент
+        std::atomic<uint64_t> tx_base;              //!< начало данных текущего клиента; раньше - данные прежнего
+        alignas(64) std::atomic<uint64_t> tx_tail;  //!< читает драйвер
+    };
+
+    //! Заголовок сегмента; за ним следуют буфер RX и буферы TX клиентов
+    struct alignas(64) shm_header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t rx_capacity;
+        uint32_t tx_capacity;
+        std::atomic<uint32_t> server_alive;
+        std::atomic<int32_t> server_pid;    //!< процесс драйвера, владеющий сегментом
+
+        alignas(64) std::atomic<uint64_t> rx_head;
+        std::atomic<uint32_t> rx_seq;       //!< futex: появились данные RX
+        std::atomic<uint32_t> rx_waiters;
+
+        alignas(64) std::atomic<uint32_t> tx_seq;   //!< futex: освободилось место TX
+        std::atomic<uint32_t> tx_waiters;
+
+        client_slot slots[SHM_MAX_CLIENTS];
+    };
+
+    size_t segment_size(uint32_t rx_capacity, uint32_t tx_capacity);
+
+    //-----------------------------------------------------------------------------
+
+    //! Сторона драйвера: создает сегмент и обслуживает его из потоков pl_uart
+    class shm_channel_server
+    {
+    public:
+        //! Размеры колец округляются вверх до степени двойки. Сегмент с тем же именем
+        //! заменяется, только если его драйвер завершился; иначе - исключение
+        shm_channel_server(const std::string &name, uint32_t rx_capacity, uint32_t tx_capacity);
+        virtual ~shm_channel_server();
+
+        shm_channel_server(const shm_channel_server &) = delete;
+        shm_channel_server &operator=(const shm_channel_server &) = delete;
+
+        //! Публикует принятые данные всем клиентам (вызывается из потока приема)
+        void write_rx(const uint8_t *data, size_t size);
+
+        //! Источник для pl_uart::set_tx_source(): данные клиентов по кругу
+        size_t read_tx(const uint8_t *&data, size_t max);
+
+        const std::string &name() const { return _name; }
+
+    private:
+        void commit_tx();
+
+        std::string _name;
+        shm_header *hdr{nullptr};
+        uint8_t *rx_buf{nullptr};
+        uint8_t *tx_buf{nullptr};
+        size_t size{0};
+        unsigned next_slot{0};
+        int pending_slot{-1};
+        size_t pending_size{0};
+    };
+
+    //-----------------------------------------------------------------------------
+
+    //! Сторона клиента: подключается к сегменту драйвера и занимает свободный слот
+    //! или слот завершившегося клиента (его непереданные данные отбрасываются)
+    class shm_channel_client
+    {
+    public:
+        explicit shm_channel_client(const std::string &name);
+        virtual ~shm_channel_client();
+
+        shm_channel_client(const shm_channel_client &) = delete;
+        shm_channel_client &operator=(const shm_channel_client &) = delete;
+
+        //! Копирует принятые данные; ждет не более timeout_ms (0 - без ожидания)
+        size_t recv(uint8_t *data, size_t max, int timeout_ms);
+
+        //! Помещает данные в кольцо TX; ждет места не более timeout_ms
+        size_t send(const uint8_t *data, size_t size, int timeout_ms);
+
+        uint64_t lost() const;
+
+    private:
+        shm_header *hdr{nullptr};
+        client_slot *slot{nullptr};
+        uint8_t *rx_buf{nullptr};
+        uint8_t *tx_buf{nullptr};
+        size_t size{0};
+    };
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // SHM_CHANNEL_H
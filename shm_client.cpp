@@ -0,0 +1,216 @@
+#include "config_parser.h"
+#include "shm_channel.h"
+#include "exceptinfo.h"
+#include "ulog.h"
+
+//-----------------------------------------------------------------------------
+
+#include <cstdint>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+//-----------------------------------------------------------------------------
+// Клиент порта в режиме shm. По умолчанию подключается к сегменту драйвера
+// (-name, по умолчанию /pl_uart_<-port>): принятое портом печатается в stdout,
+// stdin передается в порт. С -check проверяет shm_channel в одном процессе:
+// раздачу RX, передачу TX, занятие слота завершившегося клиента и защиту
+// сегмента работающего драйвера.
+//-----------------------------------------------------------------------------
+
+using namespace shm_channel;
+
+//-----------------------------------------------------------------------------
+
+static volatile int exit_flag = 0;
+void local_signal_handler(int /*signo*/)
+{
+    exit_flag = 1;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Забирает у драйвера все данные клиентов на передачу
+static std::string drain_tx(shm_channel_server& server)
+{
+    std::string out;
+    const uint8_t* data;
+    size_t n;
+    while ((n = server.read_tx(data, 64)) != 0)
+        out.append(reinterpret_cast<const char*>(data), n);
+    return out;
+}
+
+static std::string recv_text(shm_channel_client& client, size_t max)
+{
+    std::vector<uint8_t> buf(max);
+    const size_t n = client.recv(buf.data(), buf.size(), 100);
+    return std::string(reinterpret_cast<const char*>(buf.data()), n);
+}
+
+static size_t send_text(shm_channel_client& client, const char* text)
+{
+    return client.send(reinterpret_cast<const uint8_t*>(text), strlen(text), 100);
+}
+
+//-----------------------------------------------------------------------------
+
+//! Проверка shm_channel; возвращает число ошибок
+static unsigned self_check()
+{
+    const std::string name = "/pl_uart_check_" + std::to_string(getpid());
+    unsigned errors = 0;
+    auto expect = [&](bool ok, const char* what) {
+        fprintf(stderr, "%-52s %s\n", what, ok ? "ok" : "FAIL");
+        errors += !ok;
+    };
+
+    // сегмент завершившегося драйвера заменяется
+    pid_t child = fork();
+    if (child == 0) {
+        shm_channel_server stale(name, 1024, 64);
+        _exit(0);   // без деструктора: сегмент остается с признаком работы
+    }
+    waitpid(child, nullptr, 0);
+
+    std::unique_ptr<shm_channel_server> server;
+    try {
+        server = std::make_unique<shm_channel_server>(name, 1024, 64);
+    } catch (const except_info_t& err) {
+        fprintf(stderr, "%s", err.info.c_str());
+    }
+    expect(server != nullptr, "stale segment replaced");
+    if (!server)
+        return errors + 1;
+
+    // сегмент работающего драйвера не заменяется
+    bool refused = false;
+    try {
+        shm_channel_server second(name, 1024, 64);
+    } catch (const except_info_t&) {
+        refused = true;
+    }
+    expect(refused, "live segment kept");
+
+    struct stat st;
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    expect(fd >= 0 && fstat(fd, &st) == 0 && !(st.st_mode & S_IRWXO), "segment closed to other users");
+    if (fd >= 0)
+        close(fd);
+
+    // клиент завершается, оставив непереданные данные в своем кольце TX
+    child = fork();
+    if (child == 0) {
+        shm_channel_client dead(name);
+        send_text(dead, "stale");
+        _exit(0);
+    }
+    waitpid(child, nullptr, 0);
+
+    // слот завершившегося клиента занимается заново одним слотом, без его данных
+    std::vector<std::unique_ptr<shm_channel_client>> clients;
+    clients.push_back(std::make_unique<shm_channel_client>(name));
+    send_text(*clients[0], "fresh");
+    expect(drain_tx(*server) == "fresh", "stale TX of dead client discarded");
+
+    try {
+        while (clients.size() < SHM_MAX_CLIENTS)
+            clients.push_back(std::make_unique<shm_channel_client>(name));
+    } catch (const except_info_t& err) {
+        fprintf(stderr, "%s", err.info.c_str());
+    }
+    expect(clients.size() == SHM_MAX_CLIENTS, "reclaim takes exactly one slot");
+
+    // прием раздается всем клиентам
+    server->write_rx(reinterpret_cast<const uint8_t*>("hello"), 5);
+    bool all = true;
+    for (auto& client : clients)
+        all &= recv_text(*client, 64) == "hello";
+    expect(all, "RX delivered to every client");
+
+    // передача клиентов по кругу
+    send_text(*clients[1], "one");
+    send_text(*clients[2], "two");
+    const std::string tx = drain_tx(*server);
+    expect(tx == "onetwo" || tx == "twoone", "TX of several clients");
+
+    // отставший клиент пропускает перезаписанное с учетом потерь
+    std::vector<uint8_t> burst(4096, 'x');
+    server->write_rx(burst.data(), burst.size());
+    const uint64_t lost = clients[0]->lost();
+    recv_text(*clients[0], burst.size());
+    expect(clients[0]->lost() > lost, "overrun counted as lost");
+
+    clients.clear();
+    server.reset();
+
+    return errors;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    ulog::start(ulog::LOG_ERROR);
+    signal(SIGINT, local_signal_handler);
+
+    if (is_option(argc, argv, "-check")) {
+        unsigned errors;
+        try {
+            errors = self_check();
+        } catch (const except_info_t& err) {
+            fprintf(stderr, "%s", err.info.c_str());
+            errors = 1;
+        }
+        fprintf(stderr, "%s\n", errors ? "FAILED: shm channel check" : "check OK");
+        ulog::stop();
+        return errors ? 1 : 0;
+    }
+
+    const std::string port = get_from_cmdline<std::string>(argc, argv, "-port", "uart0");
+    const std::string name = get_from_cmdline<std::string>(argc, argv, "-name", "/pl_uart_" + port);
+
+    std::unique_ptr<shm_channel_client> client;
+    try {
+        client = std::make_unique<shm_channel_client>(name);
+    } catch (const except_info_t& err) {
+        fprintf(stderr, "%s", err.info.c_str());
+        ulog::stop();
+        return -1;
+    }
+
+    // stdin в порт; поток завершается вместе с вводом
+    std::thread input([&] {
+        uint8_t buf[256];
+        ssize_t n;
+        while (!exit_flag && (n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+            if (client->send(buf, size_t(n), 1000) < size_t(n))
+                fprintf(stderr, "TX ring full, data dropped\n");
+        }
+    });
+    input.detach();
+
+    uint8_t buf[4096];
+    while (!exit_flag) {
+        const size_t n = client->recv(buf, sizeof(buf), 100);
+        if (n && fwrite(buf, 1, n, stdout) == n)
+            fflush(stdout);
+    }
+
+    if (client->lost())
+        fprintf(stderr, "lost %lu bytes\n", (unsigned long)client->lost());
+
+    ulog::stop();
+
+    return 0;
+}
@@ -0,0 +1,411 @@
+
+#ifndef SIM_UARTLITE_H
+#define SIM_UARTLITE_H
+
+#include "pl_uartlite.h"
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//! Программная модель AXI UART Lite для проверки pl_uart без аппаратуры.
+//! Линия работает в реальном времени с темпом, заданным скоростью: символы
+//! поступают в FIFO приемника и уходят из FIFO передатчика по одному за время
+//! символа. Модель может вносить ошибки: переполнение, ошибки кадра и четности,
+//! зависание передатчика и искажения регистра состояния. Простои хоста (процесс
+//! снят с процессора целиком) модель может не переносить на линию - см.
+//! set_host_stall_limit().
+//-----------------------------------------------------------------------------
+
+namespace pl_uartlite
+{
+    //! Вероятности сбоев модели
+    struct sim_faults
+    {
+        double overrun{0};      //!< потеря принимаемого символа с флагом OVERRUN_ERROR
+        double frame{0};        //!< искажение принимаемого символа с флагом FRAME_ERROR
+        double parity{0};       //!< искажение принимаемого символа с флагом PARITY_ERROR
+        double tx_stall{0};     //!< зависание передатчика после отправки символа
+        std::chrono::microseconds stall_time{std::chrono::milliseconds(100)};
+        double glitch{0};       //!< инверсия случайного бита при чтении регистра состояния
+    };
+
+    //! Счетчики внесенных моделью событий
+    struct sim_counters
+    {
+        uint64_t rx_line{0};        //!< символов пришло из линии
+        uint64_t rx_dropped{0};     //!< потеряно из-за переполнения FIFO (естественного и внесенного)
+        uint64_t rx_corrupted{0};   //!< искажено ошибками кадра и четности
+        uint64_t rx_reset_lost{0};  //!< потеряно при сбросе FIFO приемника
+        uint64_t rx_empty_reads{0}; //!< чтений пустого FIFO приемника
+        uint64_t tx_line{0};        //!< символов ушло в линию
+        uint64_t tx_dropped{0};     //!< записей в полный FIFO передатчика
+        uint64_t tx_reset_lost{0};  //!< потеряно при сбросе FIFO передатчика
+        uint64_t tx_stalls{0};
+        uint64_t glitches{0};
+        // значения регистра состояния, прочитанные с флагом ошибки (после искажения)
+        uint64_t overrun_flags{0};
+        uint64_t frame_flags{0};
+        uint64_t parity_flags{0};
+        uint64_t host_stalls{0};        //!< простои хоста, на которые линия останавливалась
+        uint64_t host_stall_us{0};      //!< суммарное время остановки линии
+    };
+
+    class sim_uartlite
+    {
+    public:
+        explicit sim_uartlite(uint32_t baud_rate, unsigned char_bits = UARTLITE_CHAR_BITS, unsigned fifo_depth = UARTLITE_FIFO_DEPTH, uint64_t seed = 1) :
+            depth(fifo_depth), rng(seed)
+        {
+            line_timing timing;
+            timing.baud_rate = baud_rate;
+            timing.char_bits = char_bits;
+            char_time = timing.char_time();
+            next_rx = next_tx = std::chrono::steady_clock::now();
+        }
+
+        void set_faults(const sim_faults &f)
+        {
+            std::lock_guard<std::mutex> lock(sim_lock);
+            faults = f;
+        }
+
+        //! Если к модели не обращались дольше max_gap, линия продвигается за этот промежуток
+        //! только на keep: драйвер опрашивает FIFO чаще, поэтому такой промежуток означает,
+        //! что хост не давал процессу работать, а не ошибку драйвера. Опоздание одного потока
+        //! на фоне обращений других не скрывается. max_gap = 0 - линия идет строго по часам.
+        void set_host_stall_limit(std::chrono::nanoseconds max_gap, std::chrono::nanoseconds keep)
+        {
+            std::lock_guard<std::mutex> lock(sim_lock);
+            stall_limit = max_gap;
+            stall_keep = std::min(keep, max_gap);
+        }
+
+        //! Время заполнения FIFO приемника модели
+        std::chrono::nanoseconds fifo_time() const
+        {
+            return char_time * depth;
+        }
+
+        //! Переданные символы возвращаются в приемник этой же модели
+        void set_loopback(bool enable)
+        {
+            std::lock_guard<std::mutex> lock(sim_lock);
+            loopback = enable;
+        }
+
+        //! Получатель переданных в линию символов (если не включена петля)
+        void set_line_out(std::function<void(const uint8_t *data, size_t size)> out)
+        {
+            std::lock_guard<std::mutex> lock(sim_lock);
+            line_out = std::move(out);
+        }
+
+        //! Соединяет линии двух моделей крест-накрест. Обращение к регистрам одной модели
+        //! продвигает и передатчик другой, поэтому вытеснение потока передающей стороны
+        //! не создает в линии пауз, которых не было бы у аппаратного передатчика.
+        //! Вызывается до начала обмена.
+        void connect(sim_uartlite &other)
+        {
+            set_line_out([&other](const uint8_t *data, size_t size) { other.inject(data, size); });
+            other.set_line_out([this](const uint8_t *data, size_t size) { inject(data, size); });
+            peer = &other;
+            other.peer = this;
+        }
+
+        //! Добавляет символы во входную линию; они поступают в FIFO с темпом линии
+        void inject(const uint8_t *data, size_t size)
+        {
+            std::lock_guard<std::mutex> lock(sim_lock);
+            auto now = std::chrono::steady_clock::now();
+            advance(now);
+            if (line_in.empty())
+                next_rx = std::max(next_rx, now + char_time);
+            line_in.insert(line_in.end(), data, data + size);
+        }
+
+        sim_counters counters()
+        {
+            std::lock_guard<std::mutex> lock(sim_lock);
+            return stat;
+        }
+
+        //! Чтение регистра моделью (используется через sim_bus)
+        uint32_t read(uint32_t offset)
+        {
+            if (peer)
+                peer->poll();
+
+            std::lock_guard<std::mutex> emit_guard(emit_lock);
+            std::vector<uint8_t> out;
+            uint32_t value = 0;
+            {
+                std::lock_guard<std::mutex> lock(sim_lock);
+                advance(std::chrono::steady_clock::now(), &out);
+
+                switch (offset)
+                {
+                case UART_RX_FIFO:
+                    if (rx_fifo.empty())
+                    {
+                        ++stat.rx_empty_reads;
+                    }
+                    else
+                    {
+                        value = rx_fifo.front();
+                        rx_fifo.pop_front();
+                    }
+                    break;
+
+                case UART_STATUS:
+                {
+                    reg_status status{0};
+                    status.bits.RX_FIFO_VALID_DATA = !rx_fifo.empty();
+                    status.bits.RX_FIFO_FULL = (rx_fifo.size() == depth);
+                    status.bits.TX_FIFO_EMPTY = tx_fifo.empty();
+                    status.bits.TX_FIFO_FULL = (tx_fifo.size() == depth);
+                    status.bits.OVERRUN_ERROR = overrun_flag;
+                    status.bits.FRAME_ERROR = frame_flag;
+                    status.bits.PARITY_ERROR = parity_flag;
+                    value = status.value;
+
+                    // флаги ошибок сбрасываются чтением регистра состояния
+                    overrun_flag = frame_flag = parity_flag = false;
+
+                    if (chance(faults.glitch))
+                    {
+                        value ^= 1u << (rng() % 8);
+                        ++stat.glitches;
+                    }
+
+                    // драйвер должен учесть каждый флаг, который он прочитал
+                    const reg_status seen{value};
+                    stat.overrun_flags += seen.bits.OVERRUN_ERROR;
+                    stat.frame_flags += seen.bits.FRAME_ERROR;
+                    stat.parity_flags += seen.bits.PARITY_ERROR;
+                    break;
+                }
+
+                default:
+                    break;
+                }
+            }
+            emit(out);
+            return value;
+        }
+
+        //! Запись регистра моделью (используется через sim_bus)
+        void write(uint32_t offset, uint32_t value)
+        {
+            if (peer)
+                peer->poll();
+
+            std::lock_guard<std::mutex> emit_guard(emit_lock);
+            std::vector<uint8_t> out;
+            {
+                std::lock_guard<std::mutex> lock(sim_lock);
+                auto now = std::chrono::steady_clock::now();
+                advance(now, &out);
+
+                switch (offset)
+                {
+                case UART_TX_FIFO:
+                    if (tx_fifo.size() == depth)
+                    {
+                        ++stat.tx_dropped;
+                        break;
+                    }
+                    if (tx_fifo.empty())
+                        next_tx = std::max(next_tx, now + char_time);
+                    tx_fifo.push_back(uint8_t(value));
+                    break;
+
+                case UART_CTRL:
+                {
+                    reg_ctrl ctrl{value};
+                    if (ctrl.bits.RST_RX_FIFO)
+                    {
+                        stat.rx_reset_lost += rx_fifo.size();
+                        rx_fifo.clear();
+                    }
+                    if (ctrl.bits.RST_TX_FIFO)
+                    {
+                        stat.tx_reset_lost += tx_fifo.size();
+                        tx_fifo.clear();
+                        stalled_until = {};
+                    }
+                    break;
+                }
+
+                default:
+                    break;
+                }
+            }
+            emit(out);
+        }
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        bool chance(double p)
+        {
+            return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < p;
+        }
+
+        //! Продвигает линию до момента now
+        void advance(clock::time_point now, std::vector<uint8_t> *out = nullptr)
+        {
+            // простой хоста линия пропускает, кроме stall_keep
+            if (stall_limit.count() > 0 && last_access != clock::time_point{} && now - last_access > stall_limit)
+            {
+                const auto frozen = now - last_access - stall_keep;
+                next_rx += frozen;
+                next_tx += frozen;
+                if (stalled_until > last_access)
+                    stalled_until += frozen;
+                ++stat.host_stalls;
+                stat.host_stall_us += std::chrono::duration_cast<std::chrono::microseconds>(frozen).count();
+            }
+            last_access = std::max(last_access, now);
+
+            // прием
+            while (!line_in.empty() && next_rx <= now)
+            {
+                uint8_t v = line_in.front();
+                line_in.pop_front();
+                next_rx += char_time;
+                ++stat.rx_line;
+
+                if (rx_fifo.size() == depth || chance(faults.overrun))
+                {
+                    overrun_flag = true;
+                    ++stat.rx_dropped;
+                    continue;
+                }
+                if (chance(faults.frame))
+                {
+                    v ^= 1u << (rng() % 8);
+                    frame_flag = true;
+                    ++stat.rx_corrupted;
+                }
+                else if (chance(faults.parity))
+                {
+                    v ^= 1u << (rng() % 8);
+                    parity_flag = true;
+                    ++stat.rx_corrupted;
+                }
+                rx_fifo.push_back(v);
+            }
+            if (line_in.empty())
+                next_rx = std::max(next_rx, now);
+
+            // передача
+            while (!tx_fifo.empty() && next_tx <= now && stalled_until <= now)
+            {
+                uint8_t v = tx_fifo.front();
+                tx_fifo.pop_front();
+                next_tx += char_time;
+                ++stat.tx_line;
+
+                if (loopback)
+                {
+                    if (line_in.empty())
+                        next_rx = std::max(next_rx, now + char_time);
+                    line_in.push_back(v);
+                }
+                else if (out)
+                {
+                    out->push_back(v);
+                }
+
+                if (chance(faults.tx_stall))
+                {
+                    // зависание снимается сбросом FIFO передатчика или по истечении stall_time
+                    stalled_until = now + faults.stall_time;
+                    ++stat.tx_stalls;
+                }
+            }
+            if (tx_fifo.empty() || stalled_until > now)
+                next_tx = std::max(next_tx, now);
+        }
+
+        void emit(const std::vector<uint8_t> &out)
+        {
+            if (!out.empty() && line_out)
+                line_out(out.data(), out.size());
+        }
+
+        //! Продвигает линию до текущего момента без обращения к регистрам
+        void poll()
+        {
+            std::lock_guard<std::mutex> emit_guard(emit_lock);
+            std::vector<uint8_t> out;
+            {
+                std::lock_guard<std::mutex> lock(sim_lock);
+                advance(clock::now(), &out);
+            }
+            emit(out);
+        }
+
+        //! Модель продвигают и свой поток, и поток другого конца линии (poll()); символы
+        //! отдаются в линию вне sim_lock, поэтому продвижение с отдачей идет под emit_lock,
+        //! чтобы пачки разных потоков не поменялись местами. inject() берет только sim_lock.
+        std::mutex emit_lock;
+        std::mutex sim_lock;
+        unsigned depth;
+        std::chrono::nanoseconds char_time;
+        std::mt19937_64 rng;
+        sim_faults faults;
+        sim_counters stat;
+        bool loopback{false};
+        std::function<void(const uint8_t *data, size_t size)> line_out;
+        sim_uartlite *peer{nullptr};  //!< модель на другом конце линии (connect())
+        std::chrono::nanoseconds stall_limit{0};
+        std::chrono::nanoseconds stall_keep{0};
+        clock::time_point last_access{};
+
+        std::deque<uint8_t> line_in;
+        std::deque<uint8_t> rx_fifo;
+        std::deque<uint8_t> tx_fifo;
+        clock::time_point next_rx;
+        clock::time_point next_tx;
+        clock::time_point stalled_until{};
+        bool overrun_flag{false};
+        bool frame_flag{false};
+        bool parity_flag{false};
+    };
+
+    //-----------------------------------------------------------------------------
+
+    //! Доступ к регистрам модели для basic_pl_uart
+    class sim_bus
+    {
+    public:
+        explicit sim_bus(sim_uartlite *model = nullptr) : _model(model) {}
+
+        uint32_t read(uint32_t offset) const
+        {
+            return _model->read(offset);
+        }
+
+        void write(uint32_t offset, uint32_t value)
+        {
+            _model->write(offset, value);
+        }
+
+    private:
+        sim_uartlite *_model;
+    };
+
+    //! pl_uart, работающий с программной моделью UART Lite
+    using sim_pl_uart = basic_pl_uart<uartlite_traits, sim_bus>;
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // SIM_UARTLITE_H
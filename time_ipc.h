@@ -22,4 +22,9 @@ inline void ipc_delay(int ms)
     std::this_thread::sleep_for(std::chrono_literals::operator""ms(ms));
 }
 
+inline void ipc_sleep_until(ipc_time_t deadline)
+{
+    std::this_thread::sleep_until(deadline);
+}
+
 #endif //TIMEIPC_H
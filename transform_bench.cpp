@@ -0,0 +1,126 @@
+#include "config_parser.h"
+#include "byte_transform.h"
+#include "time_ipc.h"
+#include "ulog.h"
+
+//-----------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Стоимость байта преобразований порта для каждого доступного набора команд.
+// Пачки берутся размером с FIFO (так их отдают потоки порта), средние и
+// крупные (прием через пул блоков, файлы). Результат каждого ядра сверяется с
+// переносимым вариантом, в том числе на пачках некратной вектору длины, а
+// стоимость сравнивается со временем символа на линии.
+//-----------------------------------------------------------------------------
+
+//! Преобразование прогона
+struct bench_case
+{
+    const char* name;
+    std::vector<transform_spec> chain;
+};
+
+//-----------------------------------------------------------------------------
+
+//! Прогоняет data через цепочку пачками batch; длины пачек чередуются, чтобы задеть хвосты ядер
+static std::vector<uint8_t> run_chain(const std::vector<transform_spec>& chain, transform_isa isa,
+                                      const std::vector<uint8_t>& data, size_t batch, bool uneven)
+{
+    byte_transform t(chain, isa);
+    std::vector<uint8_t> out(data.size());
+    size_t pos = 0;
+    for (unsigned i = 0; pos < data.size(); i++) {
+        const size_t n = std::min(data.size() - pos, uneven ? batch - i % 7 : batch);
+        t.apply(data.data() + pos, out.data() + pos, n);
+        pos += n;
+    }
+    return out;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Время байта в наносекундах при пачках batch
+static double measure_ns(const std::vector<transform_spec>& chain, transform_isa isa, std::vector<uint8_t>& data,
+                         size_t batch, unsigned duration_ms)
+{
+    byte_transform t(chain, isa);
+    const size_t batches = data.size() / batch;
+    uint64_t bytes = 0;
+    const ipc_time_t start = ipc_get_time();
+    const ipc_time_t stop = start + std::chrono::milliseconds(duration_ms);
+    ipc_time_t now = start;
+    while (now < stop) {
+        for (size_t b = 0; b < batches; b++)
+            t.apply(data.data() + b * batch, data.data() + b * batch, batch);
+        bytes += batches * batch;
+        now = ipc_get_time();
+    }
+    return std::chrono::duration<double, std::nano>(now - start).count() / bytes;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const uint32_t baud_rate = get_from_cmdline<uint32_t>(argc, argv, "-baud", 921600);
+    const unsigned duration_ms = get_from_cmdline<unsigned>(argc, argv, "-d", 200);
+
+    ulog::start(ulog::LOG_ERROR);
+
+    std::vector<bench_case> cases(5);
+    parse_transforms("xor:pn9", cases[0].chain);
+    cases[0].name = "xor pn9";
+    parse_transforms("reverse", cases[1].chain);
+    cases[1].name = "reverse";
+    parse_transforms("strip7", cases[2].chain);
+    cases[2].name = "strip7";
+    parse_transforms("map:e9=65/e8=65/e0=61/e7=63/f9=75", cases[3].chain);
+    cases[3].name = "map";
+    parse_transforms("xor:pn9,reverse", cases[4].chain);
+    cases[4].name = "xor+reverse";
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data(1 << 16);
+    for (auto& b : data)
+        b = uint8_t(rng());
+
+    const std::vector<transform_isa> isa = transform_supported_isa();
+    const size_t batches[] = { 16, 64, 4096 };
+    const double char_ns = 10e9 / baud_rate;
+
+    fprintf(stderr, "transforms: %lu byte buffer, line %u baud (%.0f ns per character)\n",
+            (unsigned long)data.size(), baud_rate, char_ns);
+    fprintf(stderr, "%-12s %-7s %11s %11s %11s %10s %6s\n", "transform", "isa", "ns/B @16", "ns/B @64", "ns/B @4096",
+            "line load", "check");
+
+    bool failed = false;
+    for (const auto& c : cases) {
+        const std::vector<uint8_t> reference = run_chain(c.chain, TRANSFORM_ISA_SCALAR, data, 4096, false);
+        for (transform_isa i : isa) {
+            // сверка на пачках 4096 и на неровных пачках около FIFO
+            const bool ok = run_chain(c.chain, i, data, 4096, false) == reference &&
+                            run_chain(c.chain, i, data, 37, true) == reference;
+            failed |= !ok;
+
+            double ns[3];
+            for (unsigned b = 0; b < 3; b++) {
+                std::vector<uint8_t> work(data);
+                ns[b] = measure_ns(c.chain, i, work, batches[b], duration_ms);
+            }
+            // доля времени символа, которую занимает преобразование пачки FIFO
+            fprintf(stderr, "%-12s %-7s %11.3f %11.3f %11.3f %9.4f%% %6s\n", c.name, transform_isa_name(i),
+                    ns[0], ns[1], ns[2], 100.0 * ns[0] / char_ns, ok ? "ok" : "FAIL");
+        }
+    }
+    fprintf(stderr, "%s\n", failed ? "FAILED: kernel output differs from scalar" : "kernels OK");
+
+    ulog::stop();
+
+    return failed ? 1 : 0;
+}
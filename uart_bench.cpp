@@ -0,0 +1,231 @@
+#include "config_parser.h"
+#include "sim_uartlite.h"
+#include "lz_stream.h"
+#include "ulog.h"
+
+//-----------------------------------------------------------------------------
+
+#include <cstdint>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Полезная пропускная способность pl_uart на модели UART Lite без сжатия и со
+// ступенью lz_stream. Передатчик непрерывно отправляет текстовую телеметрию,
+// модель возвращает ее в приемник (петля), считаются доставленные байты.
+// Простои хоста модель на линию не переносит (как в uart_soak), и время простоя
+// не входит в пропускную способность. Прогон неуспешен (код 1), если кодек не
+// восстановил блок, приемник отбросил кадры сжатия или FIFO переполнился при
+// своевременном опросе. Если кадры испорчены переполнением после опроса,
+// опоздавшего по вине хоста, код 2: нужен выделенный процессор или меньшая -baud.
+//-----------------------------------------------------------------------------
+
+using namespace pl_uartlite;
+
+//-----------------------------------------------------------------------------
+
+static volatile int exit_flag = 0;
+void local_signal_handler(int /*signo*/)
+{
+    exit_flag = 1;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Генератор строк телеметрии с медленно меняющимися значениями
+struct telemetry_source
+{
+    uint32_t tick{0};
+    std::string line;
+    size_t offset{0};
+
+    size_t read(const uint8_t*& data, size_t max)
+    {
+        if (offset == line.size()) {
+            char buf[160];
+            const unsigned t = tick++;
+            snprintf(buf, sizeof(buf), "t=%u.%03u temp=%.2f volt=%.3f cur=%.3f rpm=%u state=RUN\n",
+                     t / 1000, t % 1000, 36.6 + (t % 50) * 0.01, 12.0 + (t % 7) * 0.001, 1.5 + (t % 13) * 0.002, 3000 + t % 20);
+            line = buf;
+            offset = 0;
+        }
+        const size_t n = std::min(max, line.size() - offset);
+        data = reinterpret_cast<const uint8_t*>(line.data()) + offset;
+        offset += n;
+        return n;
+    }
+};
+
+//-----------------------------------------------------------------------------
+
+static double seconds(ipc_time_t start, ipc_time_t end)
+{
+    return std::chrono::duration<double>(end - start).count();
+}
+
+//-----------------------------------------------------------------------------
+
+struct bench_result
+{
+    double goodput{0};          //!< доставленные байты в секунду
+    double ratio{1};            //!< исходные байты к байтам в линии
+    uint64_t overruns{0};       //!< сбросы FIFO приемника после переполнения
+    uint64_t late_overruns{0};  //!< из них после опроса, опоздавшего по вине хоста
+    uint64_t bad_frames{0};     //!< отброшенные кадры сжатия
+};
+
+//-----------------------------------------------------------------------------
+
+static bench_result run(uint32_t baud_rate, bool compress, unsigned duration_ms, size_t block)
+{
+    sim_uartlite model(baud_rate);
+    model.set_loopback(true);
+    model.set_host_stall_limit(model.fifo_time() * 5 / 8, model.fifo_time() / 4);
+
+    std::deque<uint8_t> rd_queue;
+    std::mutex rd_lock;
+    std::deque<uint8_t> wr_queue;
+    std::mutex wr_lock;
+    sim_pl_uart uart(sim_bus(&model), rd_queue, rd_lock, wr_queue, wr_lock, baud_rate);
+
+    telemetry_source source;
+    std::atomic<uint64_t> delivered{0};
+    auto sink = [&](const uint8_t*, size_t size) { delivered.fetch_add(size, std::memory_order_relaxed); };
+
+    lz_stream lz(true, block);
+    if (compress) {
+        lz.set_source([&](const uint8_t*& data, size_t max) { return source.read(data, max); });
+        lz.set_sink(sink);
+        uart.set_tx_source([&](const uint8_t*& data, size_t max) { return lz.read_tx(data, max); });
+        uart.set_rx_sink([&](const uint8_t* data, size_t size) { lz.write_rx(data, size); });
+    } else {
+        uart.set_tx_source([&](const uint8_t*& data, size_t max) { return source.read(data, max); });
+        uart.set_rx_sink(sink);
+    }
+
+    const ipc_time_t start = ipc_get_time();
+    auto job_write = make_job<std::thread>([&] { uart.write_thread(); });
+    auto job_read = make_job<std::thread>([&] { uart.read_thread(); });
+
+    const ipc_time_t stop_time = start + std::chrono::milliseconds(duration_ms);
+    while (!exit_flag && ipc_get_time() < stop_time)
+        ipc_delay(10);
+
+    const uint64_t bytes = delivered.load();
+    const double elapsed = seconds(start, ipc_get_time());
+    const double paused = model.counters().host_stall_us / 1e6;
+    uart.stop();
+    job_write->join();
+    job_read->join();
+
+    bench_result res;
+    res.goodput = bytes / std::max(elapsed - paused, 1e-3);
+    res.overruns = uart.get_stats().rx_resets;
+    res.late_overruns = uart.get_stats().rx_late_overruns;
+    if (compress) {
+        const lz_stats& st = lz.get_stats();
+        res.ratio = st.tx_line_bytes ? double(st.tx_raw_bytes) / st.tx_line_bytes : 1.0;
+        res.bad_frames = st.crc_errors + st.decode_errors;
+    }
+
+    if (uart_profile::profile_enabled) {
+        const std::string name = std::to_string(baud_rate) + (compress ? " lz" : " off");
+        uart_profile::print_profile(stderr, name.c_str(), uart.get_profile());
+    }
+
+    return res;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Скорость кодека на той же телеметрии, МБ/с; false - блок не восстановлен после сжатия
+static bool codec_speed(size_t block)
+{
+    telemetry_source source;
+    std::vector<uint8_t> input;
+    while (input.size() < (8 << 20)) {
+        const uint8_t* data;
+        const size_t n = source.read(data, 256);
+        input.insert(input.end(), data, data + n);
+    }
+
+    std::vector<uint8_t> packed(lz_bound(block));
+    std::vector<uint8_t> unpacked(block);
+    size_t packed_total = 0;
+    double t_pack = 0;
+    double t_unpack = 0;
+    size_t mismatches = 0;
+
+    for (size_t off = 0; off + block <= input.size(); off += block) {
+        ipc_time_t t0 = ipc_get_time();
+        const size_t n = lz_compress(input.data() + off, block, packed.data(), packed.size());
+        ipc_time_t t1 = ipc_get_time();
+        const bool ok = n && lz_decompress(packed.data(), n, unpacked.data(), block);
+        ipc_time_t t2 = ipc_get_time();
+        t_pack += seconds(t0, t1);
+        t_unpack += seconds(t1, t2);
+        packed_total += n;
+        if (!ok || memcmp(unpacked.data(), input.data() + off, block) != 0)
+            ++mismatches;
+    }
+
+    fprintf(stderr, "codec: block %zu, ratio %.2f, compress %.1f MB/s, decompress %.1f MB/s\n",
+            block, double(input.size()) / packed_total, input.size() / t_pack / 1e6, input.size() / t_unpack / 1e6);
+    if (mismatches)
+        fprintf(stderr, "FAILED: %zu blocks differ after decompression\n", mismatches);
+    return !mismatches;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const unsigned duration_ms = get_from_cmdline<unsigned>(argc, argv, "-d", 2000);
+    const size_t block = get_from_cmdline<size_t>(argc, argv, "-block", LZ_BLOCK_SIZE);
+
+    // по умолчанию - ряд типовых скоростей, -baud задает одну
+    std::vector<uint32_t> rates = { 9600, 19200, 57600, 115200, 230400, 460800, 921600 };
+    if (is_option(argc, argv, "-baud"))
+        rates = { get_from_cmdline<uint32_t>(argc, argv, "-baud", 115200) };
+
+    ulog::start(ulog::LOG_ERROR);
+    signal(SIGINT, local_signal_handler);
+
+    bool failed = !codec_speed(block);
+    bool host_late = false;
+
+    fprintf(stderr, "%8s %10s %12s %12s %6s %6s %9s %9s %10s\n", "baud", "line B/s", "off B/s", "lz B/s", "gain", "ratio",
+            "off ovr", "lz ovr", "bad frames");
+    for (uint32_t baud : rates) {
+        if (exit_flag)
+            break;
+        // на медленной линии прогон должен вместить несколько блоков
+        const unsigned run_ms = std::max<unsigned>(duration_ms, 8 * block * UARTLITE_CHAR_BITS * 1000ull / baud);
+        const bench_result off = run(baud, false, run_ms, block);
+        const bench_result lz = run(baud, true, run_ms, block);
+        fprintf(stderr, "%8u %10u %12.0f %12.0f %6.2f %6.2f %9lu %9lu %10lu\n", baud, baud / UARTLITE_CHAR_BITS,
+                off.goodput, lz.goodput, off.goodput ? lz.goodput / off.goodput : 0.0, lz.ratio,
+                (unsigned long)off.overruns, (unsigned long)lz.overruns, (unsigned long)lz.bad_frames);
+
+        // переполнение при своевременном опросе - ошибка драйвера; после опоздавшего опроса
+        // кадры портит хост, и прогон не доказывает ничего о кодеке
+        failed |= off.overruns > off.late_overruns || lz.overruns > lz.late_overruns;
+        if (lz.late_overruns)
+            host_late = true;
+        else
+            failed |= lz.bad_frames != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "FAILED: codec mismatch, bad compressed frames or overruns of a timely polled FIFO\n");
+    } else if (host_late) {
+        fprintf(stderr, "HOST TOO SLOW: RX polls delayed past the FIFO fill time overran the FIFO; "
+                "run on a dedicated CPU or lower -baud\n");
+    }
+
+    ulog::stop();
+
+    return failed ? 1 : host_late ? 2 : 0;
+}
@@ -0,0 +1,186 @@
+
+#include "uart_discovery.h"
+#include "exceptinfo.h"
+#include "ulog.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <set>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+namespace fs = std::filesystem;
+
+//-----------------------------------------------------------------------------
+
+//! Глубина обхода: в дереве Zynq узлы UART лежат на втором-третьем уровне
+static constexpr unsigned DT_MAX_DEPTH = 16;
+
+//-----------------------------------------------------------------------------
+
+//! Свойство узла целиком; пустое, если свойства нет
+static std::vector<uint8_t> read_property(const fs::path& node, const char* name)
+{
+    std::ifstream f(node / name, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+//-----------------------------------------------------------------------------
+
+//! Ячейки свойств дерева - 32 бита старшим байтом вперед
+static bool read_cells(const std::vector<uint8_t>& prop, size_t index, unsigned cells, uint64_t& value)
+{
+    if ((index + cells) * 4 > prop.size())
+        return false;
+    value = 0;
+    for (unsigned i = 0; i < cells; i++) {
+        const uint8_t* p = prop.data() + (index + i) * 4;
+        value = (value << 32) | (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+static unsigned read_u32(const fs::path& node, const char* name, unsigned def)
+{
+    uint64_t value;
+    return read_cells(read_property(node, name), 0, 1, value) ? unsigned(value) : def;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Тип ядра по списку compatible (строки через '\0'); false - узел не PL UART
+static bool match_compatible(const std::vector<uint8_t>& prop, uart_device_type& device)
+{
+    static const struct {
+        const char* prefix;
+        uart_device_type device;
+    } known[] = {
+        { "xlnx,xps-uartlite", DEVICE_UARTLITE },
+        { "xlnx,axi-uartlite", DEVICE_UARTLITE },
+        { "xlnx,xps-uart16550", DEVICE_UART16550 },
+        { "xlnx,axi-uart16550", DEVICE_UART16550 },
+    };
+
+    const char* p = reinterpret_cast<const char*>(prop.data());
+    const char* end = p + prop.size();
+    while (p < end) {
+        const std::string name(p, strnlen(p, end - p));
+        for (const auto& k : known) {
+            if (name.compare(0, strlen(k.prefix), k.prefix) == 0) {
+                device = k.device;
+                return true;
+            }
+        }
+        p += name.size() + 1;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+static bool node_enabled(const fs::path& node)
+{
+    const std::vector<uint8_t> status = read_property(node, "status");
+    if (status.empty())
+        return true;
+    const std::string s(reinterpret_cast<const char*>(status.data()), strnlen(reinterpret_cast<const char*>(status.data()), status.size()));
+    return s == "okay" || s == "ok";
+}
+
+//-----------------------------------------------------------------------------
+
+//! Разбор узла PL UART; false - узел отключен или его reg не описывает 32-битное окно
+static bool parse_node(const fs::path& node, uart_device_type device, uart_port_params& params)
+{
+    if (!node_enabled(node))
+        return false;
+
+    // размерность reg задает родитель; по умолчанию 2 и 1 ячейки
+    const fs::path parent = node.parent_path();
+    const unsigned address_cells = read_u32(parent, "#address-cells", 2);
+    const unsigned size_cells = read_u32(parent, "#size-cells", 1);
+
+    const std::vector<uint8_t> reg = read_property(node, "reg");
+    uint64_t base = 0;
+    uint64_t size = 0;
+    if (!read_cells(reg, 0, address_cells, base) || !read_cells(reg, address_cells, size_cells, size)) {
+        // путь узла не живет до записи журнала, поэтому сообщения обхода печатаются сразу
+        if (ulog::LOG_WARN >= ulog::get_level())
+            fprintf(stderr, "%s(): %s has no valid reg\n", __func__, node.c_str());
+        return false;
+    }
+    if (base > UINT32_MAX || !size || size > UINT32_MAX) {
+        if (ulog::LOG_WARN >= ulog::get_level())
+            fprintf(stderr, "%s(): %s reg 0x%llx/0x%llx is out of 32-bit range\n", __func__, node.c_str(), (unsigned long long)base, (unsigned long long)size);
+        return false;
+    }
+
+    params.name = node.filename().string();
+    params.device = device;
+    params.base_address = uint32_t(base);
+    params.aperture = uint32_t(size);
+    params.baud_rate = read_u32(node, "current-speed", params.baud_rate);
+    if (device == DEVICE_UART16550)
+        params.clock_hz = read_u32(node, "clock-frequency", 0);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Обход каталогов: ссылки в /sys в основном ведут назад по дереву, поэтому
+//! идем только по ссылкам of_node и по ссылкам устройств прямо в корне
+static void scan(const fs::path& dir, unsigned depth, std::set<fs::path>& visited, std::vector<uart_port_params>& ports)
+{
+    std::error_code ec;
+    const fs::path real = fs::canonical(dir, ec);
+    if (ec || depth > DT_MAX_DEPTH || !visited.insert(real).second)
+        return;
+
+    uart_device_type device = DEVICE_UARTLITE;
+    if (fs::exists(real / "compatible", ec) && match_compatible(read_property(real, "compatible"), device)) {
+        uart_port_params params;
+        if (parse_node(real, device, params))
+            ports.push_back(params);
+        return;
+    }
+
+    for (const auto& entry : fs::directory_iterator(real, ec)) {
+        if (!entry.is_directory(ec))
+            continue;
+        if (entry.is_symlink(ec) && depth > 0 && entry.path().filename() != "of_node")
+            continue;
+        scan(entry.path(), depth + 1, visited, ports);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+std::vector<uart_port_params> discover_ports(const std::string& root)
+{
+    std::error_code ec;
+    if (!fs::is_directory(root, ec)) {
+        throw except_info("%s, %d: %s():\n Device tree root '%s' is not a directory\n", __FILE__, __LINE__, __FUNCTION__, root.c_str());
+    }
+
+    std::vector<uart_port_params> ports;
+    std::set<fs::path> visited;
+    scan(root, 0, visited, ports);
+
+    // узел может быть найден и в дереве, и через of_node устройства
+    std::sort(ports.begin(), ports.end(), [](const uart_port_params& a, const uart_port_params& b) { return a.base_address < b.base_address; });
+    ports.erase(std::unique(ports.begin(), ports.end(), [](const uart_port_params& a, const uart_port_params& b) { return a.base_address == b.base_address; }),
+                ports.end());
+
+    if (ulog::LOG_INFO >= ulog::get_level())
+        fprintf(stderr, "%s(): %lu PL UART nodes under %s\n", __func__, (unsigned long)ports.size(), root.c_str());
+    return ports;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,30 @@
+#ifndef UART_DISCOVERY_H
+#define UART_DISCOVERY_H
+
+#include "uart_port.h"
+
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//! Поиск PL UART в дереве устройств.
+//! Узлом считается каталог со свойством compatible; подходят xlnx,xps-uartlite,
+//! xlnx,axi-uartlite (UART Lite) и xlnx,xps-uart16550, xlnx,axi-uart16550.
+//! Базовый адрес и размер окна берутся из reg с учетом #address-cells и
+//! #size-cells родителя, скорость - из current-speed, частота ядра 16550 - из
+//! clock-frequency. Отключенные узлы (status не "okay") пропускаются.
+//! Корнем может быть /proc/device-tree, /sys/firmware/devicetree/base или
+//! /sys/bus/platform/devices (по ссылкам of_node), а также каталог-образец
+//! с той же структурой для проверки без устройства.
+//-----------------------------------------------------------------------------
+
+constexpr const char* DT_DEFAULT_ROOT = "/proc/device-tree";
+
+//! Параметры портов для найденных узлов, упорядоченные по базовому адресу.
+//! Имя порта - имя узла (например serial@42c00000). Порты без отображения
+//! создаются дешево: устройство открывается при uart_port::open().
+std::vector<uart_port_params> discover_ports(const std::string& root = DT_DEFAULT_ROOT);
+
+//-----------------------------------------------------------------------------
+
+#endif // UART_DISCOVERY_H
@@ -0,0 +1,841 @@
+
+#include "uart_port.h"
+#include "exceptinfo.h"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <future>
+#include <sstream>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+using namespace pl_uartlite;
+
+//-----------------------------------------------------------------------------
+
+bool parse_port_mode(const std::string& name, uart_port_mode& mode)
+{
+    if (name == "echo") {
+        mode = PORT_MODE_ECHO;
+        return true;
+    }
+    if (name == "monitor") {
+        mode = PORT_MODE_MONITOR;
+        return true;
+    }
+    if (name == "tx_file") {
+        mode = PORT_MODE_TX_FILE;
+        return true;
+    }
+    if (name == "rx_file") {
+        mode = PORT_MODE_RX_FILE;
+        return true;
+    }
+    if (name == "shm") {
+        mode = PORT_MODE_SHM;
+        return true;
+    }
+    if (name == "line") {
+        mode = PORT_MODE_LINE;
+        return true;
+    }
+    if (name == "transact") {
+        mode = PORT_MODE_TRANSACT;
+        return true;
+    }
+    if (name == "mux") {
+        mode = PORT_MODE_MUX;
+        return true;
+    }
+    if (name == "modbus_master") {
+        mode = PORT_MODE_MODBUS_MASTER;
+        return true;
+    }
+    if (name == "modbus_slave") {
+        mode = PORT_MODE_MODBUS_SLAVE;
+        return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+bool parse_device_type(const std::string& name, uart_device_type& device)
+{
+    if (name == "uartlite") {
+        device = DEVICE_UARTLITE;
+        return true;
+    }
+    if (name == "uart16550") {
+        device = DEVICE_UART16550;
+        return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+bool parse_compression(const std::string& name, uart_compression& compression)
+{
+    if (name == "off") {
+        compression = COMPRESSION_OFF;
+        return true;
+    }
+    if (name == "raw") {
+        compression = COMPRESSION_RAW;
+        return true;
+    }
+    if (name == "lz") {
+        compression = COMPRESSION_LZ;
+        return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+bool get_port_params(const config_file& config, const std::string& section, uart_port_params& params)
+{
+    // секцией порта считается секция с базовым адресом
+    if (!config.get_value(section, "base_address", params.base_address))
+        return false;
+
+    params.name = section;
+
+    std::string device;
+    if (config.get_value(section, "device", device) && !parse_device_type(device, params.device)) {
+        throw except_info("%s, %d: %s():\n Unknown device '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, device.c_str(), section.c_str());
+    }
+
+    config.get_value(section, "clock_hz", params.clock_hz);
+    config.get_value(section, "aperture", params.aperture);
+    config.get_value(section, "fifo_depth", params.fifo_depth);
+    config.get_value(section, "baud_rate", params.baud_rate);
+    config.get_value(section, "cpu_affinity", params.cpu_affinity);
+    config.get_value(section, "file", params.file);
+    config.get_value(section, "file_size", params.file_size);
+    config.get_value(section, "rx_ring", params.rx_ring);
+    config.get_value(section, "rx_chunks", params.rx_chunks);
+    config.get_value(section, "rx_chunk_size", params.rx_chunk_size);
+    config.get_value(section, "shm_rx", params.shm_rx);
+    config.get_value(section, "shm_tx", params.shm_tx);
+    if (!config.get_value(section, "shm_name", params.shm_name))
+        params.shm_name = "/pl_uart_" + section;
+    config.get_value(section, "line_max", params.line_max);
+    if (config.get_value(section, "line_delims", params.line_delims))
+        params.line_delims = unescape(params.line_delims);
+    if (config.get_value(section, "request", params.request))
+        params.request = unescape(params.request);
+    if (config.get_value(section, "response_end", params.response_end))
+        params.response_end = unescape(params.response_end);
+    config.get_value(section, "period_ms", params.period_ms);
+    config.get_value(section, "timeout_ms", params.timeout_ms);
+    config.get_value(section, "mux_payload", params.mux_payload);
+    config.get_value(section, "lz_block", params.lz_block);
+    config.get_value(section, "reliable", params.reliable);
+    config.get_value(section, "window", params.reliable_params.window);
+    config.get_value(section, "reliable_payload", params.reliable_params.payload);
+
+    unsigned rto_min_ms;
+    if (config.get_value(section, "rto_min_ms", rto_min_ms))
+        params.reliable_params.rto_min = std::chrono::milliseconds(rto_min_ms);
+
+    std::string compression;
+    if (config.get_value(section, "compression", compression) && !parse_compression(compression, params.compression)) {
+        throw except_info("%s, %d: %s():\n Unknown compression '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, compression.c_str(), section.c_str());
+    }
+
+    std::string transforms;
+    if (config.get_value(section, "rx_transform", transforms) && !parse_transforms(transforms, params.rx_transform)) {
+        throw except_info("%s, %d: %s():\n Bad rx_transform '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, transforms.c_str(), section.c_str());
+    }
+    if (config.get_value(section, "tx_transform", transforms) && !parse_transforms(transforms, params.tx_transform)) {
+        throw except_info("%s, %d: %s():\n Bad tx_transform '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, transforms.c_str(), section.c_str());
+    }
+
+    std::string channels;
+    if (config.get_value(section, "mux_channels", channels) && !parse_mux_channels(channels, params.mux_channels)) {
+        throw except_info("%s, %d: %s():\n Bad mux_channels '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, channels.c_str(), section.c_str());
+    }
+
+    std::string poll;
+    if (config.get_value(section, "modbus_poll", poll) && !parse_modbus_requests(poll, params.modbus_poll)) {
+        throw except_info("%s, %d: %s():\n Bad modbus_poll '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, poll.c_str(), section.c_str());
+    }
+
+    std::string units;
+    if (config.get_value(section, "modbus_units", units)) {
+        params.modbus_units.clear();
+        std::stringstream list(units);
+        std::string unit;
+        while (std::getline(list, unit, ',')) {
+            unsigned address = 0;
+            if (!parse_value(unit, address) || address == MODBUS_BROADCAST || address > 247) {
+                throw except_info("%s, %d: %s():\n Bad modbus_units '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, units.c_str(), section.c_str());
+            }
+            params.modbus_units.push_back(uint8_t(address));
+        }
+    }
+    config.get_value(section, "modbus_registers", params.modbus_registers);
+    config.get_value(section, "modbus_strict_gaps", params.modbus_strict_gaps);
+
+    std::string policy;
+    if (config.get_value(section, "lag_policy", policy)) {
+        if (policy == "block") {
+            params.lag_policy = broadcast_ring::LAG_BLOCK;
+        } else if (policy == "skip") {
+            params.lag_policy = broadcast_ring::LAG_SKIP;
+        } else {
+            throw except_info("%s, %d: %s():\n Unknown lag_policy '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, policy.c_str(), section.c_str());
+        }
+    }
+
+    std::string mode;
+    if (config.get_value(section, "mode", mode) && !parse_port_mode(mode, params.mode)) {
+        throw except_info("%s, %d: %s():\n Unknown mode '%s' of port [%s]\n", __FILE__, __LINE__, __FUNCTION__, mode.c_str(), section.c_str());
+    }
+
+    if ((params.mode == PORT_MODE_TX_FILE || params.mode == PORT_MODE_RX_FILE) && params.file.empty()) {
+        throw except_info("%s, %d: %s():\n Port [%s] needs 'file' for mode '%s'\n", __FILE__, __LINE__, __FUNCTION__, section.c_str(), mode.c_str());
+    }
+
+    if (params.mode == PORT_MODE_TRANSACT && params.request.empty()) {
+        throw except_info("%s, %d: %s():\n Port [%s] needs 'request' for mode '%s'\n", __FILE__, __LINE__, __FUNCTION__, section.c_str(), mode.c_str());
+    }
+
+    if (params.mode == PORT_MODE_MODBUS_MASTER && params.modbus_poll.empty()) {
+        throw except_info("%s, %d: %s():\n Port [%s] needs 'modbus_poll' for mode '%s'\n", __FILE__, __LINE__, __FUNCTION__, section.c_str(), mode.c_str());
+    }
+
+    // транзакции обращаются к FIFO напрямую, мимо ступеней сжатия, надежной доставки и преобразований
+    const bool direct = (params.mode == PORT_MODE_TRANSACT || params.mode == PORT_MODE_MODBUS_MASTER || params.mode == PORT_MODE_MODBUS_SLAVE);
+    const bool staged = (params.compression != COMPRESSION_OFF || params.reliable || !params.rx_transform.empty() || !params.tx_transform.empty());
+    if (direct && staged) {
+        throw except_info("%s, %d: %s():\n Port [%s] can't use compression, reliable link or transforms in mode '%s'\n", __FILE__, __LINE__, __FUNCTION__, section.c_str(), mode.c_str());
+    }
+
+    // байт, потерянный на линии, сдвинул бы позицию ключа до конца работы
+    if ((transform_keyed(params.rx_transform) || transform_keyed(params.tx_transform)) && !params.reliable) {
+        throw except_info("%s, %d: %s():\n Port [%s] needs 'reliable' for xor transform\n", __FILE__, __LINE__, __FUNCTION__, section.c_str());
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+std::vector<uart_port_params> get_ports_params(const config_file& config)
+{
+    std::vector<uart_port_params> ports;
+    for (const auto& section : config.sections()) {
+        uart_port_params params;
+        if (get_port_params(config, section, params))
+            ports.push_back(params);
+    }
+    return ports;
+}
+
+//-----------------------------------------------------------------------------
+
+static void set_job_affinity(job_t& job, int cpu)
+{
+    if (cpu < 0)
+        return;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    int res = pthread_setaffinity_np(job->native_handle(), sizeof(cpuset), &cpuset);
+    if (res) {
+        ULOG_WARN("%s(): can't bind thread to CPU %d: error %d\n", __func__, cpu, res);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+uart_port::uart_port(mapper_t mapper, const uart_port_params& params) : _params(params), _mapper(mapper)
+{
+    // режим задает получателя и источник данных; без них работают очереди порта.
+    // Устройство здесь не создается: окно отображается и регистры трогаются в open()
+    rx_sink_t& rx_sink = port_rx_sink;
+    tx_source_t& tx_source = port_tx_source;
+
+    if (_params.mode == PORT_MODE_TX_FILE) {
+        // передатчик берет данные пачками прямо из отображения файла
+        tx_file = std::make_unique<mapped_file_reader>(_params.file);
+        tx_source = [this](const uint8_t*& data, size_t max) {
+            size_t offset = tx_offset.load(std::memory_order_relaxed);
+            size_t n = std::min(max, tx_file->size() - offset);
+            data = tx_file->data() + offset;
+            tx_offset.store(offset + n, std::memory_order_relaxed);
+            return n;
+        };
+
+        if (!_params.rx_chunks) {
+            // прием во время передачи файла никто не читает: считаем и отбрасываем
+            rx_sink = [this](const uint8_t*, size_t size) {
+                rx_discarded.fetch_add(size, std::memory_order_relaxed);
+            };
+        }
+    }
+
+    // пул приема: поток приема только заполняет блоки, потребители забирают их без копирования
+    auto chunk_sink = [this]() -> rx_sink_t {
+        rx_pool = std::make_unique<chunk_pool>(_params.rx_chunk_size, _params.rx_chunks);
+        rx_queue = std::make_unique<chunk_queue>(_params.rx_chunks);
+        rx_chunker = std::make_unique<chunk_writer>(*rx_pool, *rx_queue);
+        return [this](const uint8_t* data, size_t size) {
+            rx_chunker->write(data, size);
+        };
+    };
+
+    if (_params.mode == PORT_MODE_RX_FILE && _params.rx_chunks) {
+        // блоки пишет в файл file_thread: рост файла не задерживает поток приема
+        rx_file = std::make_unique<mapped_file_writer>(_params.file, _params.file_size);
+        rx_sink = chunk_sink();
+    } else if (_params.mode == PORT_MODE_RX_FILE) {
+        // приемник дописывает вычитанные пачки прямо в отображение файла
+        rx_file = std::make_unique<mapped_file_writer>(_params.file, _params.file_size);
+        rx_sink = [this](const uint8_t* data, size_t size) {
+            try {
+                rx_file->write(data, size);
+            } catch (const except_info_t& err) {
+                fprintf(stderr, "%s", err.info.c_str());
+                stop();
+            }
+        };
+    }
+
+    if (_params.mode == PORT_MODE_SHM) {
+        // клиенты других процессов подключаются к сегменту через shm_channel_client
+        shm = std::make_unique<shm_channel::shm_channel_server>(_params.shm_name, _params.shm_rx, _params.shm_tx);
+        rx_sink = [this](const uint8_t* data, size_t size) {
+            shm->write_rx(data, size);
+        };
+        tx_source = [this](const uint8_t*& data, size_t max) {
+            return shm->read_tx(data, max);
+        };
+    }
+
+    if (_params.mode == PORT_MODE_LINE) {
+        // подписчики получают только полные строки
+        rx_ring = std::make_shared<broadcast_ring>(_params.rx_ring, _params.lag_policy);
+        delims = std::make_unique<delim_set>(_params.line_delims);
+        framer = std::make_unique<line_framer>(*rx_ring, *delims, _params.line_max);
+        rx_sink = [this](const uint8_t* data, size_t size) {
+            framer->write(data, size);
+        };
+
+        // напечатаем принятые строки
+        subscribe_lines([](std::string_view line) {
+            static const uint8_t eol = '\n';
+            ULOG_DATA(ulog::LOG_INFO, reinterpret_cast<const uint8_t*>(line.data()), line.size());
+            ULOG_DATA(ulog::LOG_INFO, &eol, 1);
+        });
+    }
+
+    if (_params.mode == PORT_MODE_TRANSACT) {
+        // данные вне транзакций только печатаются
+        rx_sink = [](const uint8_t* data, size_t size) {
+            ULOG_DATA(ulog::LOG_INFO, data, size);
+        };
+    }
+
+    if (_params.mode == PORT_MODE_MUX) {
+        // каналы делят порт кадрами; срочные каналы обгоняют объемные на границе кадра
+        _mux = std::make_unique<channel_mux>(_params.mux_channels, _params.mux_payload);
+        rx_sink = [this](const uint8_t* data, size_t size) {
+            _mux->write_rx(data, size);
+        };
+        tx_source = [this](const uint8_t*& data, size_t max) {
+            return _mux->read_tx(data, max);
+        };
+
+        // напечатаем принятые кадры
+        for (const auto& ch : _params.mux_channels) {
+            _mux->set_handler(ch.id, [this](uint8_t channel, const uint8_t* data, size_t size) {
+                ULOG_INFO("0x%x: channel %u, %lu bytes\n", _params.base_address, (unsigned)channel, (unsigned long)size);
+                ULOG_DATA(ulog::LOG_INFO, data, size);
+            });
+        }
+    }
+
+    if (_params.mode == PORT_MODE_MODBUS_MASTER) {
+        // байты вне ответов (опоздавшие ответы, помехи) только печатаются
+        rx_sink = [](const uint8_t* data, size_t size) {
+            ULOG_DATA(ulog::LOG_DEBUG, data, size);
+        };
+    }
+
+    if (_params.mode == PORT_MODE_ECHO || _params.mode == PORT_MODE_MONITOR) {
+        // принятые данные рассылаются всем подписчикам через общее кольцо без копирования
+        rx_ring = std::make_shared<broadcast_ring>(_params.rx_ring, _params.lag_policy);
+        rx_sink = [this](const uint8_t* data, size_t size) {
+            rx_ring->write(data, size);
+        };
+
+        // напечатаем принятые символы
+        subscribe([](const uint8_t* data, size_t size) {
+            ULOG_DATA(ulog::LOG_INFO, data, size);
+        });
+
+        if (_params.mode == PORT_MODE_ECHO) {
+            // поместим принятые символы в очередь на передачу
+            subscribe([this](const uint8_t* data, size_t size) {
+                std::lock_guard<std::mutex> _wlock(wr_lock);
+                wr_queue.insert(wr_queue.end(), data, data + size);
+            });
+        }
+    }
+
+    if (!rx_sink && _params.rx_chunks) {
+        // без собственного получателя режима прием идет в пул вместо rd_queue, см. read_chunk()
+        rx_sink = chunk_sink();
+    }
+
+    const bool transforms = !_params.rx_transform.empty() || !_params.tx_transform.empty();
+    if (_params.compression != COMPRESSION_OFF || _params.reliable || transforms) {
+        // ступеням нужны явные получатель и источник; без режима это очереди порта
+        if (!rx_sink) {
+            rx_sink = [this](const uint8_t* data, size_t size) {
+                std::lock_guard<std::mutex> _rlock(rd_lock);
+                rd_queue.insert(rd_queue.end(), data, data + size);
+            };
+        }
+        if (!tx_source) {
+            tx_source = [this](const uint8_t*& data, size_t max) {
+                std::lock_guard<std::mutex> _wlock(wr_lock);
+                wr_chunk.assign(wr_queue.begin(), wr_queue.begin() + std::min(max, wr_queue.size()));
+                wr_queue.erase(wr_queue.begin(), wr_queue.begin() + wr_chunk.size());
+                data = wr_chunk.data();
+                return wr_chunk.size();
+            };
+        }
+    }
+
+    if (_params.compression != COMPRESSION_OFF) {
+        // сжатие встает между устройством и данными режима
+        lz = std::make_unique<lz_stream>(_params.compression == COMPRESSION_LZ, _params.lz_block);
+        lz->set_sink(rx_sink);
+        lz->set_source(tx_source);
+        rx_sink = [this](const uint8_t* data, size_t size) {
+            lz->write_rx(data, size);
+        };
+        tx_source = [this](const uint8_t*& data, size_t max) {
+            return lz->read_tx(data, max);
+        };
+    }
+
+    if (transforms) {
+        // побайтные преобразования: скремблирование, порядок битов, 7-битные символы
+        transform = std::make_unique<transform_stage>(_params.rx_transform, _params.tx_transform);
+        transform->set_sink(rx_sink);
+        transform->set_source(tx_source);
+        rx_sink = [this](const uint8_t* data, size_t size) {
+            transform->write_rx(data, size);
+        };
+        tx_source = [this](const uint8_t*& data, size_t max) {
+            return transform->read_tx(data, max);
+        };
+        ULOG_INFO("0x%x: %lu RX and %lu TX transforms, %s kernels\n", _params.base_address, (unsigned long)_params.rx_transform.size(),
+                  (unsigned long)_params.tx_transform.size(), transform_isa_name(transform->isa()));
+    }
+
+    if (_params.reliable) {
+        // надежная доставка - под сжатием и преобразованиями: повторяет искаженные кадры выше лежащих
+        rl_params rl = _params.reliable_params;
+        rl.baud_rate = _params.baud_rate;
+        link = std::make_unique<reliable_link>(rl);
+        link->set_sink(rx_sink);
+        link->set_source(tx_source);
+        rx_sink = [this](const uint8_t* data, size_t size) {
+            link->write_rx(data, size);
+        };
+        tx_source = [this](const uint8_t*& data, size_t max) {
+            return link->read_tx(data, max);
+        };
+    }
+
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::open()
+{
+    std::lock_guard<std::mutex> _lock(open_lock);
+    if (uart)
+        return;
+
+    // тип устройства выбирается один раз, циклы обмена специализированы шаблоном
+    if (_params.device == DEVICE_UART16550)
+        uart = std::make_unique<pl_uart16550>(_mapper, _params.base_address, _params.aperture, rd_queue, rd_lock, wr_queue, wr_lock, _params.baud_rate, _params.clock_hz);
+    else
+        uart = std::make_unique<pl_uart>(_mapper, _params.base_address, _params.aperture, rd_queue, rd_lock, wr_queue, wr_lock, _params.baud_rate);
+    uart->set_fifo_depth(_params.fifo_depth);
+
+    if (port_rx_sink)
+        uart->set_rx_sink(port_rx_sink);
+    if (port_tx_source)
+        uart->set_tx_source(port_tx_source);
+
+    if (_params.mode == PORT_MODE_MODBUS_MASTER || _params.mode == PORT_MODE_MODBUS_SLAVE) {
+        modbus_params mp;
+        mp.timeout = std::chrono::milliseconds(_params.timeout_ms);
+        mp.strict_gaps = _params.modbus_strict_gaps;
+
+        if (_params.mode == PORT_MODE_MODBUS_MASTER) {
+            poller = std::make_unique<modbus_poller>();
+            poller->add_line(*uart, _params.modbus_poll, mp);
+            poller->set_handler([this](size_t, const modbus_request& req, const modbus_reply& reply) {
+                if (reply.status != MODBUS_OK) {
+                    ULOG_WARN("0x%x: modbus slave %u function %u: %s, exception %u\n", _params.base_address,
+                              (unsigned)req.slave, (unsigned)req.function, modbus_status_name(reply.status), (unsigned)reply.exception);
+                    return;
+                }
+                ULOG_DEBUG("0x%x: modbus slave %u function %u address %u in %ld us\n", _params.base_address,
+                           (unsigned)req.slave, (unsigned)req.function, (unsigned)req.address, (long)(reply.timing.complete.count() / 1000));
+                for (size_t i = 0; i < reply.values.size(); i++)
+                    ULOG_INFO("0x%x: slave %u register %u = %u\n", _params.base_address, (unsigned)req.slave, unsigned(req.address + i), (unsigned)reply.values[i]);
+            });
+        } else {
+            // кадры читает сервер, поток приема порта не запускается
+            _modbus = std::make_unique<modbus_server>(*uart, mp);
+            for (uint8_t unit : _params.modbus_units)
+                _modbus->add_slave(std::make_shared<modbus_slave>(unit, _params.modbus_registers, _params.modbus_registers));
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool uart_port::is_open() const
+{
+    std::lock_guard<std::mutex> _lock(open_lock);
+    return uart != nullptr;
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::subscribe_lines(line_handler_t handler)
+{
+    if (!framer) {
+        throw except_info("%s, %d: %s():\n Port [%s] is not in line mode\n", __FILE__, __LINE__, __FUNCTION__, _params.name.c_str());
+    }
+    auto reader = std::make_shared<line_reader>(rx_ring->subscribe(), *delims, _params.line_max);
+    line_subscribers.emplace_back(reader, std::move(handler));
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::subscribe(rx_handler_t handler)
+{
+    if (!rx_ring || framer) {
+        throw except_info("%s, %d: %s():\n Port [%s] has no RX subscribers in this mode\n", __FILE__, __LINE__, __FUNCTION__, _params.name.c_str());
+    }
+    subscribers.emplace_back(rx_ring->subscribe(), std::move(handler));
+}
+
+//-----------------------------------------------------------------------------
+
+uart_port::~uart_port()
+{
+    stop();
+    join();
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::start()
+{
+    if (started.exchange(true)) {
+        ULOG_WARN("0x%x: port already started\n", _params.base_address);
+        return;
+    }
+
+    try {
+        open();
+    } catch (...) {
+        started = false;
+        throw;
+    }
+
+    jobs.push_back(make_job<std::thread>([this] { uart->write_thread(); }));
+    if (!_modbus)
+        jobs.push_back(make_job<std::thread>([this] { uart->read_thread(); }));
+    if (tx_file || rx_file)
+        jobs.push_back(make_job<std::thread>([this] { file_thread(); }));
+    if (_params.mode == PORT_MODE_TRANSACT)
+        jobs.push_back(make_job<std::thread>([this] { transact_thread(); }));
+    if (poller)
+        jobs.push_back(make_job<std::thread>([this] { poller->run(0, 0, std::chrono::milliseconds(_params.period_ms)); }));
+    if (_modbus)
+        jobs.push_back(make_job<std::thread>([this] { modbus_thread(); }));
+
+    for (auto& sub : subscribers)
+        jobs.push_back(make_job<std::thread>([this, sub] { subscriber_thread(sub.first, sub.second); }));
+
+    for (auto& sub : line_subscribers)
+        jobs.push_back(make_job<std::thread>([this, sub] { line_thread(sub.first, sub.second); }));
+
+    for (auto& job : jobs)
+        set_job_affinity(job, _params.cpu_affinity);
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::stop()
+{
+    is_exit = true;
+    std::lock_guard<std::mutex> _lock(open_lock);
+    if (poller)
+        poller->stop();
+    if (uart)
+        uart->stop();
+    if (rx_ring)
+        rx_ring->close();
+    if (rx_queue)
+        rx_queue->close();
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::join()
+{
+    // итоги печатаются один раз: повторный join() из деструктора ничего не делает
+    if (jobs.empty())
+        return;
+
+    for (auto& job : jobs) {
+        if (job->joinable())
+            job->join();
+    }
+    jobs.clear();
+
+    if (tx_file && !_params.rx_chunks) {
+        ULOG_INFO("0x%x: discarded %lu bytes received during file transfer\n", _params.base_address,
+                  (unsigned long)rx_discarded.load());
+    }
+
+    if (rx_ring && rx_ring->dropped()) {
+        ULOG_WARN("0x%x: RX ring dropped %lu bytes waiting for slow subscribers\n", _params.base_address,
+                  (unsigned long)rx_ring->dropped());
+    }
+
+    if (rx_file) {
+        ULOG_INFO("0x%x: received %ld bytes into file\n", _params.base_address, (long)rx_file->size());
+        rx_file->close();
+    }
+
+    if (rx_pool) {
+        const chunk_pool_stats& st = rx_pool->get_stats();
+        ULOG_INFO("0x%x: rx chunks %lu taken, peak %lu of %lu in use, %lu bytes dropped\n", _params.base_address,
+                  (unsigned long)st.acquired, (unsigned long)st.peak_in_use, (unsigned long)rx_pool->count(),
+                  (unsigned long)rx_chunker->dropped());
+    }
+
+    if (lz) {
+        const lz_stats& st = lz->get_stats();
+        ULOG_INFO("0x%x: lz sent %lu bytes as %lu, received %lu bytes, crc errors %lu\n", _params.base_address,
+                  (unsigned long)st.tx_raw_bytes, (unsigned long)st.tx_line_bytes, (unsigned long)st.rx_raw_bytes,
+                  (unsigned long)st.crc_errors);
+    }
+
+    if (link) {
+        const rl_stats& st = link->get_stats();
+        ULOG_INFO("0x%x: reliable link sent %lu frames, %lu retransmits, delivered %lu bytes, crc errors %lu, peer restarts %lu\n", _params.base_address,
+                  (unsigned long)st.tx_frames, (unsigned long)(st.retransmits + st.fast_retransmits),
+                  (unsigned long)st.delivered_bytes, (unsigned long)st.crc_errors, (unsigned long)st.resyncs);
+    }
+
+    if (poller || _modbus) {
+        const modbus_stats& st = poller ? poller->master(0).get_stats() : _modbus->get_stats();
+        ULOG_INFO("0x%x: modbus %lu requests, %lu responses, %lu timeouts, %lu crc errors, %lu gap errors\n", _params.base_address,
+                  (unsigned long)st.requests, (unsigned long)st.responses, (unsigned long)st.timeouts,
+                  (unsigned long)st.crc_errors, (unsigned long)st.gap_errors);
+    }
+
+    if (uart_profile::profile_enabled && uart)
+        uart_profile::print_profile(stderr, _params.name.c_str(), uart->get_profile());
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::subscriber_thread(broadcast_ring::subscriber_t sub, rx_handler_t handler)
+{
+    uint64_t reported = 0;
+    // при LAG_SKIP писатель может перезаписать участок во время обработки:
+    // обработчик получает проверенную копию
+    std::vector<uint8_t> copy(sub->policy() == broadcast_ring::LAG_SKIP ? std::min<size_t>(_params.rx_ring, 4096) : 0);
+
+    while (!is_exit) {
+
+        if (!sub->wait(std::chrono::milliseconds(20)))
+            continue;
+
+        broadcast_ring::span data = sub->view();
+        if (!copy.empty()) {
+            data.data = copy.data();
+            data.size = sub->read(copy.data(), copy.size());
+        }
+        if (data.size) {
+            uart_profile::section_scope _prof(uart->get_profile().sections[uart_profile::PROF_CONSUMER]);
+            handler(data.data, data.size);
+        }
+        if (copy.empty())
+            sub->consume(data.size);
+
+        if (sub->lost() != reported) {
+            ULOG_WARN("0x%x: RX subscriber lost %lu bytes\n", _params.base_address, (unsigned long)(sub->lost() - reported));
+            reported = sub->lost();
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::line_thread(std::shared_ptr<line_reader> reader, line_handler_t handler)
+{
+    std::string_view line;
+
+    while (!is_exit) {
+        if (reader->next_line(line, std::chrono::milliseconds(20))) {
+            uart_profile::section_scope _prof(uart->get_profile().sections[uart_profile::PROF_CONSUMER]);
+            handler(line);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::file_thread()
+{
+    bool tx_done = false;
+
+    // в режиме rx_file с пулом приема блоки пишутся в файл здесь
+    auto write_chunk = [this](const chunk_ref& chunk) {
+        try {
+            uart_profile::section_scope _prof(uart->get_profile().sections[uart_profile::PROF_CONSUMER]);
+            rx_file->write(chunk.data(), chunk.size());
+        } catch (const except_info_t& err) {
+            fprintf(stderr, "%s", err.info.c_str());
+            stop();
+        }
+    };
+
+    chunk_ref chunk;
+    while (!is_exit) {
+
+        if (rx_file && rx_queue) {
+            if (rx_queue->pop(chunk, std::chrono::milliseconds(100)))
+                write_chunk(chunk);
+            chunk.reset();
+        } else {
+            ipc_delay(100);
+        }
+
+        if (tx_file && !tx_done && tx_offset == tx_file->size()) {
+            ULOG_INFO("0x%x: sent %ld bytes from file\n", _params.base_address, (long)tx_file->size());
+            tx_done = true;
+        }
+    }
+
+    // допишем блоки, принятые до остановки
+    while (rx_file && rx_queue && rx_queue->pop(chunk, std::chrono::milliseconds(0))) {
+        write_chunk(chunk);
+        chunk.reset();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool uart_port::read_chunk(chunk_ref& chunk, std::chrono::milliseconds timeout)
+{
+    if (!rx_queue || rx_file) {
+        throw except_info("%s, %d: %s():\n Port [%s] has no RX chunk pool in this mode\n", __FILE__, __LINE__, __FUNCTION__, _params.name.c_str());
+    }
+    return rx_queue->pop(chunk, timeout);
+}
+
+//-----------------------------------------------------------------------------
+
+transact_result uart_port::transact(const uint8_t* request, size_t size, std::vector<uint8_t>& response,
+                                    const response_matcher_t& matcher, std::chrono::milliseconds timeout,
+                                    transact_timing* breakdown)
+{
+    open();
+    return uart->transact(request, size, response, matcher, ipc_get_time() + timeout, breakdown);
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::transact_thread()
+{
+    static const char* results[] = { "ok", "tx timeout", "rx timeout", "stopped" };
+
+    const std::string& end = _params.response_end;
+    const response_matcher_t matcher = [&end](const uint8_t* data, size_t size) {
+        return size >= end.size() && std::equal(end.begin(), end.end(), data + size - end.size());
+    };
+
+    std::vector<uint8_t> response;
+    ipc_time_t next = ipc_get_time();
+
+    while (!is_exit) {
+
+        transact_timing t;
+        transact_result res = transact(reinterpret_cast<const uint8_t*>(_params.request.data()), _params.request.size(),
+                                       response, matcher, std::chrono::milliseconds(_params.timeout_ms), &t);
+
+        ULOG_INFO("0x%x: transact %s in %ld us: request sent %ld us, first byte %ld us\n",
+                  _params.base_address, results[res], (long)(t.complete.count() / 1000),
+                  (long)(t.tx_done.count() / 1000), (long)(t.first_byte.count() / 1000));
+        ULOG_DEBUG("0x%x: transact lock wait %ld us, %u polls, %u stale bytes\n",
+                   _params.base_address, (long)(t.lock_wait.count() / 1000), t.polls, t.stale_bytes);
+        if (!response.empty())
+            ULOG_DATA(ulog::LOG_INFO, response.data(), response.size());
+
+        // период отсчитывается от начала предыдущего запроса
+        next += std::chrono::milliseconds(_params.period_ms);
+        while (!is_exit && ipc_get_time() < next)
+            ipc_delay(20);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void uart_port::modbus_thread()
+{
+    // короткий срок ожидания кадра, чтобы поток вовремя замечал остановку
+    while (!is_exit)
+        _modbus->serve(std::chrono::milliseconds(20));
+}
+
+//-----------------------------------------------------------------------------
+
+std::vector<uart_port_t> make_ports(mapper_t mapper, const std::vector<uart_port_params>& params)
+{
+    std::vector<uart_port_t> ports;
+    for (const auto& p : params) {
+        ports.push_back(std::make_shared<uart_port>(mapper, p));
+    }
+    return ports;
+}
+
+//-----------------------------------------------------------------------------
+
+void open_ports(const std::vector<uart_port_t>& ports)
+{
+    std::vector<std::future<void>> pending;
+    for (const auto& port : ports) {
+        pending.push_back(std::async(std::launch::async, [port] { port->open(); }));
+    }
+
+    // get() передает исключение открытия вызывающему
+    for (auto& f : pending) {
+        f.get();
+    }
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,221 @@
+
+#ifndef UART_PORT_H
+#define UART_PORT_H
+
+#include "config_parser.h"
+#include "pl_uartlite.h"
+#include "pl_uart16550.h"
+#include "mapped_file.h"
+#include "broadcast_ring.h"
+#include "chunk_pool.h"
+#include "shm_channel.h"
+#include "line_mode.h"
+#include "channel_mux.h"
+#include "lz_stream.h"
+#include "reliable_link.h"
+#include "byte_transform.h"
+#include "modbus_rtu.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <string_view>
+
+//-----------------------------------------------------------------------------
+
+//! Режим работы порта
+enum uart_port_mode
+{
+    PORT_MODE_ECHO,     //!< принятые данные отправляются обратно и печатаются
+    PORT_MODE_MONITOR,  //!< принятые данные только печатаются
+    PORT_MODE_TX_FILE,  //!< передача файла, отображенного в память
+    PORT_MODE_RX_FILE,  //!< запись принятых данных в файл, отображенный в память
+    PORT_MODE_SHM,      //!< прием и передача для других процессов через разделяемую память
+    PORT_MODE_LINE,     //!< прием целыми строками, строки печатаются
+    PORT_MODE_TRANSACT, //!< периодический запрос с ожиданием ответа, печатается время обмена
+    PORT_MODE_MUX,      //!< виртуальные каналы с приоритетной передачей, принятые кадры печатаются
+    PORT_MODE_MODBUS_MASTER,    //!< циклический опрос устройств Modbus RTU, печатаются значения
+    PORT_MODE_MODBUS_SLAVE,     //!< устройства Modbus RTU с регистрами в памяти
+};
+
+//-----------------------------------------------------------------------------
+
+//! Тип IP-ядра порта
+enum uart_device_type
+{
+    DEVICE_UARTLITE,    //!< AXI UART Lite
+    DEVICE_UART16550,   //!< AXI UART 16550
+};
+
+//-----------------------------------------------------------------------------
+
+//! Ступень сжатия порта; обе стороны линии должны использовать кадры (raw или lz)
+enum uart_compression
+{
+    COMPRESSION_OFF,    //!< данные идут в линию как есть
+    COMPRESSION_RAW,    //!< кадры lz_stream без сжатия своих данных
+    COMPRESSION_LZ,     //!< кадры lz_stream, сжатие при согласии партнера
+};
+
+//-----------------------------------------------------------------------------
+
+//! Параметры порта из секции файла конфигурации
+struct uart_port_params
+{
+    std::string name;
+    uart_device_type device{DEVICE_UARTLITE};
+    uint32_t clock_hz{0};   //!< частота ядра 16550 для расчета делителя, 0 - делитель не менять
+    uint32_t base_address{0};
+    uint32_t aperture{0x10000};
+    unsigned fifo_depth{pl_uartlite::UART16550_FIFO_DEPTH};    //!< ограничивается глубиной FIFO устройства
+    uint32_t baud_rate{pl_uartlite::UARTLITE_DEFAULT_BAUD};
+    uart_port_mode mode{PORT_MODE_ECHO};
+    int cpu_affinity{-1};   //!< номер CPU для потоков порта, -1 - без привязки
+    std::string file;       //!< файл для режимов tx_file/rx_file
+    size_t file_size{1 << 20};  //!< начальный размер файла приема
+    size_t rx_ring{1 << 16};    //!< размер кольца рассылки принятых данных
+    unsigned rx_chunks{0};      //!< блоков в пуле приема, 0 - прием в очередь rd_queue
+    size_t rx_chunk_size{4096}; //!< размер блока пула приема
+    broadcast_ring::lag_policy lag_policy{broadcast_ring::LAG_BLOCK};
+    std::string shm_name;       //!< имя сегмента для режима shm (по умолчанию /pl_uart_<секция>)
+    uint32_t shm_rx{1 << 16};   //!< размер общего кольца RX в разделяемой памяти
+    uint32_t shm_tx{1 << 12};   //!< размер кольца TX каждого клиента
+    std::string line_delims{"\r\n"};   //!< разделители строк для режима line
+    size_t line_max{256};       //!< максимальная длина строки
+    std::string request;        //!< запрос режима transact
+    std::string response_end{"\n"};   //!< окончание ответа в режиме transact
+    unsigned period_ms{1000};   //!< период запросов в режиме transact
+    unsigned timeout_ms{10};    //!< срок ответа на запрос
+    std::vector<mux_channel_params> mux_channels{mux_channel_params{}};    //!< каналы режима mux
+    unsigned mux_payload{64};   //!< наибольшие данные кадра канала
+    uart_compression compression{COMPRESSION_OFF};
+    size_t lz_block{LZ_BLOCK_SIZE};     //!< наибольший блок сжатия
+    bool reliable{false};       //!< доставка через reliable_link (ниже ступени сжатия)
+    rl_params reliable_params;  //!< ключи window, reliable_payload, rto_min_ms
+    std::vector<transform_spec> rx_transform;   //!< преобразования принятых данных (над reliable_link; xor - только с ним)
+    std::vector<transform_spec> tx_transform;   //!< преобразования передаваемых данных
+    std::vector<modbus_request> modbus_poll;    //!< запросы цикла режима modbus_master
+    std::vector<uint8_t> modbus_units{1};       //!< адреса устройств режима modbus_slave
+    uint16_t modbus_registers{256};             //!< регистров каждого типа у устройства
+    bool modbus_strict_gaps{false};             //!< отбрасывать кадры с паузой больше 1.5 символа
+};
+
+bool get_port_params(const config_file& config, const std::string& section, uart_port_params& params);
+std::vector<uart_port_params> get_ports_params(const config_file& config);
+bool parse_port_mode(const std::string& name, uart_port_mode& mode);
+bool parse_device_type(const std::string& name, uart_device_type& device);
+bool parse_compression(const std::string& name, uart_compression& compression);
+
+//-----------------------------------------------------------------------------
+
+//! Обработчик принятых данных подписчика порта
+using rx_handler_t = std::function<void(const uint8_t* data, size_t size)>;
+
+//! Обработчик строк подписчика порта в режиме line
+using line_handler_t = std::function<void(std::string_view line)>;
+
+//! Порт PL UART с собственными очередями и потоками приема, передачи и обработки
+class uart_port
+{
+public:
+    uart_port(mapper_t mapper, const uart_port_params& params);
+    virtual ~uart_port();
+
+    //! Отображает окно регистров и инициализирует устройство; повторный вызов ничего
+    //! не делает. Вызывается из start() и transact(), если порт еще не открыт.
+    void open();
+    bool is_open() const;
+
+    //! Запускает потоки порта; повторный вызов ничего не делает
+    void start();
+    void stop();
+    void join();
+
+    const uart_port_params& params() const { return _params; }
+
+    //! Добавляет подписчика на принятые данные (режимы echo и monitor).
+    //! Каждый подписчик обслуживается своим потоком; вызывается до start().
+    void subscribe(rx_handler_t handler);
+
+    //! Добавляет подписчика на принятые строки (режим line); вызывается до start()
+    void subscribe_lines(line_handler_t handler);
+
+    //! Транзакция запрос/ответ в обход очередей порта; ответ принимается, когда его
+    //! одобрит matcher, или истекает timeout (см. pl_uartlite::uart_device::transact())
+    pl_uartlite::transact_result transact(const uint8_t* request, size_t size, std::vector<uint8_t>& response,
+                                          const pl_uartlite::response_matcher_t& matcher,
+                                          std::chrono::milliseconds timeout,
+                                          pl_uartlite::transact_timing* breakdown = nullptr);
+
+    //! Забирает принятый участок из пула приема (rx_chunks в режимах без собственного
+    //! получателя); ссылку можно хранить и передавать, блок вернется в пул при ее отпускании.
+    //! false - за timeout данных не было или порт остановлен.
+    bool read_chunk(chunk_ref& chunk, std::chrono::milliseconds timeout);
+
+    //! Мультиплексор каналов порта в режиме mux, иначе nullptr
+    channel_mux* mux() { return _mux.get(); }
+
+    //! Сервер устройств порта в режиме modbus_slave после open(), иначе nullptr
+    modbus_server* modbus() { return _modbus.get(); }
+
+private:
+    void subscriber_thread(broadcast_ring::subscriber_t sub, rx_handler_t handler);
+    void line_thread(std::shared_ptr<line_reader> reader, line_handler_t handler);
+    void file_thread();
+    void transact_thread();
+    void modbus_thread();
+
+    uart_port_params _params;
+    mapper_t _mapper;
+    pl_uartlite::rx_sink_t port_rx_sink;     //!< получатель приема с учетом режима и ступеней
+    pl_uartlite::tx_source_t port_tx_source; //!< источник передачи с учетом режима и ступеней
+    mutable std::mutex open_lock;
+    std::deque<uint8_t> rd_queue;
+    std::mutex rd_lock;
+    std::deque<uint8_t> wr_queue;
+    std::mutex wr_lock;
+    pl_uartlite::uart_device_t uart;
+    std::unique_ptr<mapped_file_reader> tx_file;
+    std::atomic<size_t> tx_offset{0};
+    std::atomic<uint64_t> rx_discarded{0};  //!< принятые в режиме tx_file байты
+    std::unique_ptr<mapped_file_writer> rx_file;
+    broadcast_ring_t rx_ring;
+    std::unique_ptr<chunk_pool> rx_pool;
+    std::unique_ptr<chunk_queue> rx_queue;
+    std::unique_ptr<chunk_writer> rx_chunker;
+    std::unique_ptr<shm_channel::shm_channel_server> shm;
+    std::vector<std::pair<broadcast_ring::subscriber_t, rx_handler_t>> subscribers;
+    std::unique_ptr<delim_set> delims;
+    std::unique_ptr<line_framer> framer;
+    std::vector<std::pair<std::shared_ptr<line_reader>, line_handler_t>> line_subscribers;
+    std::unique_ptr<channel_mux> _mux;
+    std::unique_ptr<lz_stream> lz;
+    std::unique_ptr<reliable_link> link;
+    std::unique_ptr<transform_stage> transform;
+    std::unique_ptr<modbus_poller> poller;
+    std::unique_ptr<modbus_server> _modbus;
+    std::vector<uint8_t> wr_chunk;  //!< кусок wr_queue, отданный ступени сжатия
+    std::vector<job_t> jobs;
+    std::atomic<bool> started{false};
+    std::atomic<bool> is_exit{false};
+};
+
+using uart_port_t = std::shared_ptr<uart_port>;
+
+//-----------------------------------------------------------------------------
+
+//! Создает порты по списку параметров; все отображаются через один Mapper.
+//! Устройство захватывает только open(), но файлы, пулы и сегменты shm порт
+//! создает уже в конструкторе, поэтому список должен содержать только используемые порты.
+std::vector<uart_port_t> make_ports(mapper_t mapper, const std::vector<uart_port_params>& params);
+
+//! Параллельно открывает порты списка
+void open_ports(const std::vector<uart_port_t>& ports);
+
+//-----------------------------------------------------------------------------
+
+#endif // UART_PORT_H
@@ -0,0 +1,162 @@
+
+#include "uart_profile.h"
+
+#ifdef PL_UART_PROFILE
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+//-----------------------------------------------------------------------------
+
+namespace uart_profile
+{
+
+//-----------------------------------------------------------------------------
+
+static const char* section_names[PROF_SECTIONS] = { "rx_drain", "tx_fill", "consumer" };
+
+//-----------------------------------------------------------------------------
+
+#ifdef PL_UART_PROFILE
+
+//! Открытие счетчика для текущего потока на любом CPU
+static int open_counter(uint32_t type, uint64_t config, bool with_kernel, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = with_kernel ? 0 : 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+//-----------------------------------------------------------------------------
+
+perf_group::perf_group()
+{
+    struct counter_desc {
+        uint32_t type;
+        uint64_t config;
+        bool with_kernel;   // переключения контекста происходят в ядре
+    };
+    static const counter_desc descs[PROF_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, false },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, false },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, false },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, true },
+    };
+
+    // лидером группы становится первый открывшийся счетчик
+    for (unsigned i = 0; i < PROF_COUNTERS; i++) {
+        fds[i] = open_counter(descs[i].type, descs[i].config, descs[i].with_kernel, leader);
+        if (fds[i] < 0)
+            continue;
+        if (leader < 0)
+            leader = fds[i];
+        index[i] = opened++;
+        mask |= 1u << i;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+perf_group::~perf_group()
+{
+    for (unsigned i = 0; i < PROF_COUNTERS; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+perf_group& perf_group::this_thread()
+{
+    thread_local perf_group group;
+    return group;
+}
+
+//-----------------------------------------------------------------------------
+
+void perf_group::read(uint64_t values[PROF_COUNTERS])
+{
+    // формат PERF_FORMAT_GROUP: число счетчиков, затем значения в порядке открытия
+    uint64_t data[1 + PROF_COUNTERS];
+    if (leader < 0 || ::read(leader, data, sizeof(data)) < ssize_t(sizeof(uint64_t) * (1 + opened))) {
+        memset(values, 0, sizeof(uint64_t) * PROF_COUNTERS);
+        return;
+    }
+
+    for (unsigned i = 0; i < PROF_COUNTERS; i++)
+        values[i] = (mask & (1u << i)) ? data[1 + index[i]] : 0;
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+
+void print_profile(FILE* out, const char* name, const port_profile& profile)
+{
+    if (!profile_enabled) {
+        fprintf(out, "profile [%s]: compiled out (build with -DPL_UART_PROFILE)\n", name);
+        return;
+    }
+
+    fprintf(out, "profile [%s]:\n", name);
+    fprintf(out, "  %-10s %12s %10s %12s %12s %6s %12s %10s\n",
+            "section", "calls", "ns/call", "cycles/call", "instr/call", "IPC", "misses/call", "ctx sw");
+
+    for (unsigned s = 0; s < PROF_SECTIONS; s++) {
+
+        const section_totals& t = profile.sections[s];
+        const uint64_t calls = t.calls.load(std::memory_order_relaxed);
+        if (!calls)
+            continue;
+
+        const unsigned available = t.available.load(std::memory_order_relaxed);
+        auto per_call = [&](profile_counter c, char* buf, size_t size) {
+            if (available & (1u << c))
+                snprintf(buf, size, "%.1f", double(t.counters[c].load(std::memory_order_relaxed)) / calls);
+            else
+                snprintf(buf, size, "-");
+            return buf;
+        };
+
+        char cycles[32], instr[32], misses[32], ipc[32], ctx[32];
+        const uint64_t n_cycles = t.counters[PROF_CYCLES].load(std::memory_order_relaxed);
+        const uint64_t n_instr = t.counters[PROF_INSTRUCTIONS].load(std::memory_order_relaxed);
+        if ((available & (1u << PROF_CYCLES)) && (available & (1u << PROF_INSTRUCTIONS)) && n_cycles)
+            snprintf(ipc, sizeof(ipc), "%.2f", double(n_instr) / n_cycles);
+        else
+            snprintf(ipc, sizeof(ipc), "-");
+        if (available & (1u << PROF_CONTEXT_SWITCHES))
+            snprintf(ctx, sizeof(ctx), "%lu", (unsigned long)t.counters[PROF_CONTEXT_SWITCHES].load(std::memory_order_relaxed));
+        else
+            snprintf(ctx, sizeof(ctx), "-");
+
+        fprintf(out, "  %-10s %12lu %10.1f %12s %12s %6s %12s %10s\n",
+                section_names[s], (unsigned long)calls, double(t.time_ns.load(std::memory_order_relaxed)) / calls,
+                per_call(PROF_CYCLES, cycles, sizeof(cycles)), per_call(PROF_INSTRUCTIONS, instr, sizeof(instr)), ipc,
+                per_call(PROF_CACHE_MISSES, misses, sizeof(misses)), ctx);
+    }
+
+    auto print_mmio = [&](const char* reg, const mmio_totals& t) {
+        const uint64_t calls = t.calls.load(std::memory_order_relaxed);
+        if (calls)
+            fprintf(out, "  mmio %-12s %12lu reads, %.1f ns/read\n", reg, (unsigned long)calls,
+                    double(t.time_ns.load(std::memory_order_relaxed)) / calls);
+    };
+    print_mmio("status_reg", profile.status_reg);
+    print_mmio("rx_fifo_reg", profile.rx_fifo_reg);
+}
+
+//-----------------------------------------------------------------------------
+
+};
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,173 @@
+#ifndef UART_PROFILE_H
+#define UART_PROFILE_H
+
+#include "time_ipc.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+
+//-----------------------------------------------------------------------------
+//! Профилирование циклов обмена аппаратными счетчиками perf_event_open.
+//! Включается сборкой с -DPL_UART_PROFILE. Без него точки замера - пустые
+//! объекты, которые компилятор удаляет целиком; суммы остаются нулевыми.
+//! Счетчики открываются группой для каждого потока при первом замере; если
+//! ядро их не дает (perf_event_paranoid, виртуальная машина), замеряется
+//! только время.
+//-----------------------------------------------------------------------------
+
+namespace uart_profile
+{
+#ifdef PL_UART_PROFILE
+    constexpr bool profile_enabled = true;
+#else
+    constexpr bool profile_enabled = false;
+#endif
+
+    //! Замеряемые участки циклов обмена
+    enum profile_section
+    {
+        PROF_RX_DRAIN,      //!< вычитывание FIFO приемника
+        PROF_TX_FILL,       //!< заполнение FIFO передатчика
+        PROF_CONSUMER,      //!< обработка принятых данных подписчиками порта
+        PROF_SECTIONS,
+    };
+
+    //! Счетчики группы perf_event_open
+    enum profile_counter
+    {
+        PROF_CYCLES,
+        PROF_INSTRUCTIONS,
+        PROF_CACHE_MISSES,
+        PROF_CONTEXT_SWITCHES,
+        PROF_COUNTERS,
+    };
+
+    //! Суммы по участку; пополняются потоками обмена, читаются из любого потока
+    struct section_totals
+    {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> time_ns{0};
+        std::atomic<uint64_t> counters[PROF_COUNTERS]{};
+        std::atomic<unsigned> available{0};     //!< маска счетчиков, открытых хотя бы одним потоком
+    };
+
+    //! Суммы по обращениям к регистру устройства
+    struct mmio_totals
+    {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> time_ns{0};
+    };
+
+    //! Профиль порта
+    struct port_profile
+    {
+        section_totals sections[PROF_SECTIONS];
+        mmio_totals status_reg;     //!< чтение регистра состояния
+        mmio_totals rx_fifo_reg;    //!< чтение FIFO приемника
+    };
+
+    //! Печать профиля порта в виде таблицы по участкам
+    void print_profile(FILE *out, const char *name, const port_profile &profile);
+
+    //-----------------------------------------------------------------------------
+
+#ifdef PL_UART_PROFILE
+
+    //! Группа счетчиков вызывающего потока
+    class perf_group
+    {
+    public:
+        //! Группа текущего потока; открывается при первом обращении и закрывается с потоком
+        static perf_group &this_thread();
+
+        ~perf_group();
+
+        //! Текущие значения; для недоступных счетчиков - 0
+        void read(uint64_t values[PROF_COUNTERS]);
+
+        unsigned available() const { return mask; }
+
+    private:
+        perf_group();
+
+        int fds[PROF_COUNTERS];
+        int leader{-1};
+        unsigned index[PROF_COUNTERS];  //!< позиция счетчика в результате чтения группы
+        unsigned opened{0};
+        unsigned mask{0};
+    };
+
+    //! Замер участка кода: время и приращения счетчиков потока
+    class section_scope
+    {
+    public:
+        explicit section_scope(section_totals &totals) : totals(totals), group(perf_group::this_thread())
+        {
+            group.read(begin);
+            started = ipc_get_time();
+        }
+
+        ~section_scope()
+        {
+            const ipc_time_t finished = ipc_get_time();
+            uint64_t end[PROF_COUNTERS];
+            group.read(end);
+
+            totals.calls.fetch_add(1, std::memory_order_relaxed);
+            totals.time_ns.fetch_add(std::chrono::nanoseconds(finished - started).count(), std::memory_order_relaxed);
+            for (unsigned i = 0; i < PROF_COUNTERS; i++)
+                totals.counters[i].fetch_add(end[i] - begin[i], std::memory_order_relaxed);
+            totals.available.fetch_or(group.available(), std::memory_order_relaxed);
+        }
+
+        section_scope(const section_scope &) = delete;
+        section_scope &operator=(const section_scope &) = delete;
+
+    private:
+        section_totals &totals;
+        perf_group &group;
+        uint64_t begin[PROF_COUNTERS];
+        ipc_time_t started;
+    };
+
+    //! Замер обращения к регистру: только время, счетчики слишком дороги для одного чтения
+    class mmio_scope
+    {
+    public:
+        explicit mmio_scope(mmio_totals &totals) : totals(totals), started(ipc_get_time()) {}
+
+        ~mmio_scope()
+        {
+            totals.calls.fetch_add(1, std::memory_order_relaxed);
+            totals.time_ns.fetch_add(std::chrono::nanoseconds(ipc_get_time() - started).count(), std::memory_order_relaxed);
+        }
+
+        mmio_scope(const mmio_scope &) = delete;
+        mmio_scope &operator=(const mmio_scope &) = delete;
+
+    private:
+        mmio_totals &totals;
+        ipc_time_t started;
+    };
+
+#else
+
+    class section_scope
+    {
+    public:
+        explicit section_scope(section_totals &) {}
+    };
+
+    class mmio_scope
+    {
+    public:
+        explicit mmio_scope(mmio_totals &) {}
+    };
+
+#endif
+};
+
+//-----------------------------------------------------------------------------
+
+#endif // UART_PROFILE_H
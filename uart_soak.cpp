@@ -0,0 +1,440 @@
+
+#include "config_parser.h"
+#include "sim_uartlite.h"
+#include "reliable_link.h"
+#include "chunk_pool.h"
+#include "byte_transform.h"
+#include "ulog.h"
+
+//-----------------------------------------------------------------------------
+
+#include <cstdint>
+#include <csignal>
+#include <algorithm>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Длительный прогон pl_uart на модели UART Lite с внесением сбоев.
+// Передатчик отправляет пронумерованные записи с меткой времени, модель
+// возвращает их в приемник (петля), приемник проверяет порядок, целостность
+// и задержку доставки. Без внесенных сбоев должна дойти каждая запись, со
+// сбоями потери ограничены числом испорченных моделью символов. Счетчики
+// ошибок драйвера должны совпасть с флагами, которые модель ему отдала.
+//
+// Прогон требует, чтобы хост давал потоку приема процессор чаще, чем
+// заполняется FIFO (16 символов: 174 мкс при 921600, 1.4 мс при 115200).
+// Простои всего процесса модель на линию не переносит; если же поток приема
+// опоздал на фоне работы других потоков и FIFO переполнился, прогон без
+// сбоев завершается с кодом 2: требование к хосту не выполнено, нужен
+// выделенный процессор или меньшая -baud. Код 1 - ошибка драйвера. С -reliable
+// записи идут через reliable_link, и любая потеря или искажение считаются ошибкой. С -chunks принятые данные
+// идут в приемник через пул блоков и отдельный поток потребителя. С -transform
+// поток преобразуется над надежной доставкой, как в uart_port; цепочка должна
+// быть обратима сама собой (xor, reverse): приемник применяет ее шаги в обратном
+// порядке. Ключ xor сбивается потерей байта, поэтому xor требует -reliable.
+//-----------------------------------------------------------------------------
+
+using namespace pl_uartlite;
+
+//-----------------------------------------------------------------------------
+
+static volatile int exit_flag = 0;
+void local_signal_handler(int /*signo*/)
+{
+    exit_flag = 1;
+}
+
+//-----------------------------------------------------------------------------
+
+//! Запись теста: сигнатура, номер, время отправки (мкс), CRC-16
+constexpr unsigned RECORD_SIZE = 12;
+constexpr uint8_t RECORD_MAGIC0 = 0xA5;
+constexpr uint8_t RECORD_MAGIC1 = 0x5A;
+
+//! Номер записи дальше ожидаемого на столько считается искаженным
+constexpr uint32_t RECORD_SEQ_WINDOW = 1 << 16;
+
+static uint16_t record_sum(const uint8_t* rec)
+{
+    uint16_t crc = 0xFFFF;
+    for (unsigned i = 0; i < RECORD_SIZE - 2; i++) {
+        crc ^= uint16_t(rec[i]) << 8;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x1021) : uint16_t(crc << 1);
+    }
+    return crc;
+}
+
+static uint32_t now_us(ipc_time_t start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(ipc_get_time() - start).count();
+}
+
+//-----------------------------------------------------------------------------
+
+//! Генератор записей: непрерывно или пачками flood байт с паузами idle
+struct soak_source
+{
+    ipc_time_t start;
+    size_t flood{0};
+    std::chrono::milliseconds idle{0};
+
+    uint32_t seq{0};
+    uint8_t buf[RECORD_SIZE];
+    size_t offset{RECORD_SIZE};
+    size_t burst_left{0};
+    ipc_time_t resume;
+    std::atomic<bool> stopped{false};   //!< прекратить отправку на границе записи
+
+    size_t read(const uint8_t*& data, size_t max)
+    {
+        if (offset == RECORD_SIZE && stopped.load(std::memory_order_relaxed))
+            return 0;
+
+        if (flood) {
+            if (!burst_left) {
+                if (ipc_get_time() < resume)
+                    return 0;
+                burst_left = flood;
+            }
+        }
+
+        if (offset == RECORD_SIZE) {
+            buf[0] = RECORD_MAGIC0;
+            buf[1] = RECORD_MAGIC1;
+            uint32_t t = now_us(start);
+            memcpy(buf + 2, &seq, 4);
+            memcpy(buf + 6, &t, 4);
+            uint16_t crc = record_sum(buf);
+            memcpy(buf + 10, &crc, 2);
+            ++seq;
+            offset = 0;
+        }
+
+        size_t n = std::min(max, RECORD_SIZE - offset);
+        if (flood) {
+            n = std::min(n, burst_left);
+            burst_left -= n;
+            if (!burst_left)
+                resume = ipc_get_time() + idle;
+        }
+        data = buf + offset;
+        offset += n;
+        return n;
+    }
+};
+
+//-----------------------------------------------------------------------------
+
+//! Приемник записей: поиск сигнатуры, проверка суммы, учет потерь и задержек
+struct soak_sink
+{
+    ipc_time_t start;
+    std::vector<uint8_t> pending;
+    uint32_t expected{0};
+    bool synced{false};
+
+    uint64_t received{0};
+    uint64_t lost{0};
+    uint64_t corrupt{0};
+    uint64_t reordered{0};
+    uint64_t skipped_bytes{0};
+    std::vector<uint32_t> latency_us;
+
+    void write(const uint8_t* data, size_t size)
+    {
+        pending.insert(pending.end(), data, data + size);
+
+        size_t pos = 0;
+        while (pending.size() - pos >= RECORD_SIZE) {
+
+            const uint8_t* rec = pending.data() + pos;
+            if (rec[0] != RECORD_MAGIC0 || rec[1] != RECORD_MAGIC1) {
+                ++pos;
+                ++skipped_bytes;
+                continue;
+            }
+            uint32_t seq, t;
+            uint16_t crc;
+            memcpy(&seq, rec + 2, 4);
+            memcpy(&t, rec + 6, 4);
+            memcpy(&crc, rec + 10, 2);
+
+            if (record_sum(rec) != crc || (synced && seq - expected > RECORD_SEQ_WINDOW && expected - seq > RECORD_SEQ_WINDOW)) {
+                ++corrupt;
+                ++pos;
+                ++skipped_bytes;
+                continue;
+            }
+
+            if (synced && int32_t(seq - expected) < 0) {
+                ++reordered;
+            } else {
+                if (synced)
+                    lost += seq - expected;
+                expected = seq + 1;
+                synced = true;
+            }
+
+            ++received;
+            latency_us.push_back(now_us(start) - t);
+            pos += RECORD_SIZE;
+        }
+        pending.erase(pending.begin(), pending.begin() + pos);
+    }
+};
+
+//-----------------------------------------------------------------------------
+
+static uint32_t percentile(std::vector<uint32_t>& v, double p)
+{
+    if (v.empty())
+        return 0;
+    size_t idx = std::min(v.size() - 1, size_t(p * (v.size() - 1)));
+    std::nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const unsigned duration = get_from_cmdline<unsigned>(argc, argv, "-d", 10);
+    const uint32_t baud_rate = get_from_cmdline<uint32_t>(argc, argv, "-baud", 115200);
+    const uint64_t seed = get_from_cmdline<uint64_t>(argc, argv, "-seed", 1);
+
+    sim_faults faults;
+    faults.overrun = get_from_cmdline<double>(argc, argv, "-overrun", 0);
+    faults.frame = get_from_cmdline<double>(argc, argv, "-frame", 0);
+    faults.parity = get_from_cmdline<double>(argc, argv, "-parity", 0);
+    faults.tx_stall = get_from_cmdline<double>(argc, argv, "-stall", 0);
+    faults.stall_time = std::chrono::milliseconds(get_from_cmdline<unsigned>(argc, argv, "-stall_ms", 100));
+    faults.glitch = get_from_cmdline<double>(argc, argv, "-glitch", 0);
+
+    const bool with_faults = faults.overrun > 0 || faults.frame > 0 || faults.parity > 0 || faults.tx_stall > 0 || faults.glitch > 0;
+
+    const bool reliable = is_option(argc, argv, "-reliable");
+    rl_params rl;
+    rl.window = get_from_cmdline<unsigned>(argc, argv, "-window", rl.window);
+    rl.payload = get_from_cmdline<size_t>(argc, argv, "-payload", rl.payload);
+    rl.baud_rate = baud_rate;
+
+    std::vector<transform_spec> tx_chain;
+    const std::string transforms = get_from_cmdline<std::string>(argc, argv, "-transform", "");
+    if (!transforms.empty() && !parse_transforms(transforms, tx_chain)) {
+        fprintf(stderr, "bad -transform '%s'\n", transforms.c_str());
+        return 1;
+    }
+    const std::vector<transform_spec> rx_chain(tx_chain.rbegin(), tx_chain.rend());
+    if (transform_keyed(tx_chain) && !reliable) {
+        fprintf(stderr, "-transform xor needs -reliable\n");
+        return 1;
+    }
+
+    const unsigned chunks = get_from_cmdline<unsigned>(argc, argv, "-chunks", 0);
+    const size_t chunk_size = get_from_cmdline<size_t>(argc, argv, "-chunk_size", 4096);
+
+    ulog::start(ulog::LOG_ERROR);
+    signal(SIGINT, local_signal_handler);
+
+    sim_uartlite model(baud_rate, UARTLITE_CHAR_BITS, UARTLITE_FIFO_DEPTH, seed);
+    model.set_faults(faults);
+    model.set_loopback(true);
+    // драйвер опрашивает FIFO каждые полпериода заполнения: дольше 5/8 без обращений
+    // процесс простаивал, и за простой линия продвигается на четверть FIFO
+    model.set_host_stall_limit(model.fifo_time() * 5 / 8, model.fifo_time() / 4);
+
+    std::deque<uint8_t> rd_queue;
+    std::mutex rd_lock;
+    std::deque<uint8_t> wr_queue;
+    std::mutex wr_lock;
+    sim_pl_uart uart(sim_bus(&model), rd_queue, rd_lock, wr_queue, wr_lock, baud_rate);
+
+    soak_source source;
+    source.start = ipc_get_time();
+    source.flood = get_from_cmdline<size_t>(argc, argv, "-flood", 0);
+    source.idle = std::chrono::milliseconds(get_from_cmdline<unsigned>(argc, argv, "-idle", 50));
+
+    soak_sink sink;
+    sink.start = source.start;
+
+    // с пулом блоков приемник работает в потоке потребителя, а поток приема только заполняет блоки
+    std::unique_ptr<chunk_pool> pool;
+    std::unique_ptr<chunk_queue> queue;
+    std::unique_ptr<chunk_writer> chunker;
+    rx_sink_t deliver = [&](const uint8_t* data, size_t size) { sink.write(data, size); };
+    if (chunks) {
+        pool = std::make_unique<chunk_pool>(chunk_size, chunks);
+        queue = std::make_unique<chunk_queue>(chunks);
+        chunker = std::make_unique<chunk_writer>(*pool, *queue);
+        deliver = [&](const uint8_t* data, size_t size) { chunker->write(data, size); };
+    }
+
+    tx_source_t tx_source = [&](const uint8_t*& data, size_t max) { return source.read(data, max); };
+    rx_sink_t rx_sink = deliver;
+
+    // преобразования стоят над надежной доставкой, как в uart_port
+    transform_stage transform(rx_chain, tx_chain);
+    if (!tx_chain.empty()) {
+        transform.set_source(tx_source);
+        transform.set_sink(rx_sink);
+        tx_source = [&](const uint8_t*& data, size_t max) { return transform.read_tx(data, max); };
+        rx_sink = [&](const uint8_t* data, size_t size) { transform.write_rx(data, size); };
+    }
+
+    reliable_link link(rl);
+    if (reliable) {
+        link.set_source(tx_source);
+        link.set_sink(rx_sink);
+        tx_source = [&](const uint8_t*& data, size_t max) { return link.read_tx(data, max); };
+        rx_sink = [&](const uint8_t* data, size_t size) { link.write_rx(data, size); };
+    }
+    uart.set_tx_source(tx_source);
+    uart.set_rx_sink(rx_sink);
+
+    fprintf(stderr, "soak: %u s at %u baud, overrun %g frame %g parity %g stall %g glitch %g\n",
+            duration, baud_rate, faults.overrun, faults.frame, faults.parity, faults.tx_stall, faults.glitch);
+    if (!tx_chain.empty())
+        fprintf(stderr, "transform: %s, %s kernels\n", transforms.c_str(), transform_isa_name(transform.isa()));
+    if (reliable)
+        fprintf(stderr, "reliable: window %u, payload %lu\n", rl.window, (unsigned long)rl.payload);
+
+    auto job_write = make_job<std::thread>([&] { uart.write_thread(); });
+    auto job_read = make_job<std::thread>([&] { uart.read_thread(); });
+    job_t job_consumer;
+    if (chunks) {
+        job_consumer = make_job<std::thread>([&] {
+            chunk_ref chunk;
+            while (!queue->is_closed() || queue->size()) {
+                if (!queue->pop(chunk, std::chrono::milliseconds(100)))
+                    continue;
+                sink.write(chunk.data(), chunk.size());
+                chunk.reset();
+            }
+        });
+    }
+
+    const ipc_time_t stop_time = source.start + std::chrono::seconds(duration);
+    while (!exit_flag && ipc_get_time() < stop_time)
+        ipc_delay(100);
+
+    // даем принять отправленное; надежному каналу - дождаться подтверждений
+    source.stopped = true;
+    if (reliable) {
+        const auto from = ipc_get_time();
+        while (link.in_flight() && ipc_get_time() - from < std::chrono::seconds(5))
+            ipc_delay(10);
+    }
+    const unsigned unacked = reliable ? link.in_flight() : 0;
+    ipc_delay(200);
+    uart.stop();
+    job_write->join();
+    job_read->join();
+    if (chunks) {
+        // потребитель дочитывает очередь и завершается на закрытой пустой очереди
+        queue->close();
+        job_consumer->join();
+    }
+
+    const sim_counters sim = model.counters();
+    const uart_stats& st = uart.get_stats();
+
+    // задержки выше 99.9 перцентиля и более чем вчетверо выше медианы считаются выбросами
+    std::vector<uint32_t> lat = sink.latency_us;
+    const uint32_t p50 = percentile(lat, 0.5);
+    const uint32_t p99 = percentile(lat, 0.99);
+    const uint32_t p999 = percentile(lat, 0.999);
+    const uint32_t lat_max = lat.empty() ? 0 : *std::max_element(lat.begin(), lat.end());
+    const uint32_t outlier_limit = std::max(p999, p50 * 4);
+    const size_t outliers = std::count_if(lat.begin(), lat.end(), [&](uint32_t v) { return v > outlier_limit; });
+
+    fprintf(stderr, "records: sent %u received %lu lost %lu corrupt %lu reordered %lu (skipped %lu bytes)\n",
+            source.seq, (unsigned long)sink.received, (unsigned long)sink.lost, (unsigned long)sink.corrupt,
+            (unsigned long)sink.reordered, (unsigned long)sink.skipped_bytes);
+    fprintf(stderr, "model: rx dropped %lu corrupted %lu reset lost %lu empty reads %lu, tx stalls %lu reset lost %lu dropped %lu, glitches %lu\n",
+            (unsigned long)sim.rx_dropped, (unsigned long)sim.rx_corrupted, (unsigned long)sim.rx_reset_lost, (unsigned long)sim.rx_empty_reads,
+            (unsigned long)sim.tx_stalls, (unsigned long)sim.tx_reset_lost, (unsigned long)sim.tx_dropped, (unsigned long)sim.glitches);
+    fprintf(stderr, "model flags: overrun %lu frame %lu parity %lu, host stalls %lu (%.1f ms line paused)\n",
+            (unsigned long)sim.overrun_flags, (unsigned long)sim.frame_flags, (unsigned long)sim.parity_flags,
+            (unsigned long)sim.host_stalls, sim.host_stall_us / 1000.0);
+    fprintf(stderr, "driver: rx %lu tx %lu bytes, overrun %lu frame %lu parity %lu, rx resets %lu tx resets %lu\n",
+            (unsigned long)st.rx_bytes, (unsigned long)st.tx_bytes, (unsigned long)st.overrun_errors, (unsigned long)st.frame_errors,
+            (unsigned long)st.parity_errors, (unsigned long)st.rx_resets, (unsigned long)st.tx_resets);
+    fprintf(stderr, "host: %lu RX polls later than FIFO fill time, %lu overruns found by them\n",
+            (unsigned long)st.rx_late_polls, (unsigned long)st.rx_late_overruns);
+    fprintf(stderr, "recovery: %lu events, avg %.1f us, max %.1f us\n", (unsigned long)st.recoveries,
+            st.recoveries ? st.recovery_total_ns / 1000.0 / st.recoveries : 0.0, st.recovery_max_ns / 1000.0);
+    fprintf(stderr, "latency: p50 %u us p99 %u us p99.9 %u us max %u us, outliers (> %u us): %lu\n",
+            p50, p99, p999, lat_max, outlier_limit, (unsigned long)outliers);
+    if (reliable) {
+        const rl_stats& rs = link.get_stats();
+        fprintf(stderr, "reliable: frames %lu, retransmits %lu (fast %lu), acks %lu, crc errors %lu, duplicates %lu, srtt %lu us, goodput %.0f B/s\n",
+                (unsigned long)rs.tx_frames, (unsigned long)(rs.retransmits + rs.fast_retransmits), (unsigned long)rs.fast_retransmits,
+                (unsigned long)rs.acks_sent, (unsigned long)rs.crc_errors, (unsigned long)rs.rx_duplicates, (unsigned long)rs.srtt_us,
+                double(rs.delivered_bytes) / duration);
+    }
+    if (chunks) {
+        const chunk_pool_stats& ps = pool->get_stats();
+        fprintf(stderr, "chunks: %u x %lu bytes, taken %lu, peak %lu in use, exhausted %lu, dropped %lu bytes\n",
+                chunks, (unsigned long)chunk_size, (unsigned long)ps.acquired, (unsigned long)ps.peak_in_use,
+                (unsigned long)ps.exhausted, (unsigned long)chunker->dropped());
+    }
+    if (uart_profile::profile_enabled)
+        uart_profile::print_profile(stderr, "soak", uart.get_profile());
+
+    ulog::stop();
+
+    // без внесенных сбоев доставляется каждая отправленная запись; со сбоями каждый
+    // потерянный, искаженный или лишний символ губит не больше одной записи
+    const uint64_t missing = source.seq - std::min<uint64_t>(sink.received, source.seq);
+    const uint64_t damaged = sim.rx_dropped + sim.rx_corrupted + sim.rx_reset_lost + sim.rx_empty_reads +
+                             sim.tx_dropped + sim.tx_reset_lost;
+    if (!sink.received) {
+        fprintf(stderr, "FAILED: nothing received\n");
+        return 1;
+    }
+
+    // каждое прочитанное драйвером значение состояния с флагом ошибки должно быть учтено
+    if (st.overrun_errors != sim.overrun_flags || st.frame_errors != sim.frame_flags || st.parity_errors != sim.parity_flags) {
+        fprintf(stderr, "FAILED: driver counted overrun %lu frame %lu parity %lu, model reported %lu %lu %lu\n",
+                (unsigned long)st.overrun_errors, (unsigned long)st.frame_errors, (unsigned long)st.parity_errors,
+                (unsigned long)sim.overrun_flags, (unsigned long)sim.frame_flags, (unsigned long)sim.parity_flags);
+        return 1;
+    }
+
+    // без сбоев переполнение допустимо только после опроса, опоздавшего по вине хоста
+    if (!with_faults && st.rx_resets > st.rx_late_overruns) {
+        fprintf(stderr, "FAILED: %lu RX overruns while the FIFO was polled in time\n",
+                (unsigned long)(st.rx_resets - st.rx_late_overruns));
+        return 1;
+    }
+    const bool host_late = !with_faults && st.rx_resets;
+    if (!with_faults && !host_late && (missing || sink.lost || sink.corrupt || sink.reordered || sink.skipped_bytes)) {
+        fprintf(stderr, "FAILED: %lu of %u records lost without injected faults\n", (unsigned long)missing, source.seq);
+        return 1;
+    }
+    if (missing > damaged) {
+        fprintf(stderr, "FAILED: %lu records lost, more than %lu damaged characters\n", (unsigned long)missing,
+                (unsigned long)damaged);
+        return 1;
+    }
+
+    // надежный канал не должен терять данные ни при каких сбоях и к концу слива
+    // должен получить подтверждения всех кадров
+    if (reliable && (sink.received != source.seq || sink.lost || sink.corrupt || sink.reordered || sink.skipped_bytes)) {
+        fprintf(stderr, "FAILED: data loss over reliable link\n");
+        return 1;
+    }
+    if (reliable && unacked) {
+        fprintf(stderr, "FAILED: %u frames still unacknowledged after drain\n", unacked);
+        return 1;
+    }
+
+    if (host_late) {
+        fprintf(stderr, "HOST TOO SLOW: %lu RX overruns after polls delayed past the FIFO fill time; "
+                "run on a dedicated CPU or lower -baud\n", (unsigned long)st.rx_resets);
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,363 @@
+
+#include "ulog.h"
+#include "time_ipc.h"
+
+#include <stdio.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+namespace ulog
+{
+    std::atomic<int> current_level{LOG_INFO};
+
+    //! Кольцо записей одного потока (один писатель - фоновый поток читатель)
+    struct log_ring
+    {
+        static constexpr size_t CAPACITY = 1024;
+        static constexpr size_t MASK = CAPACITY - 1;
+
+        log_record records[CAPACITY];
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+        std::atomic<bool> orphan{false};
+        uint32_t id{0};
+    };
+
+    //! Владелец кольца потока: при завершении потока кольцо дочитывается и удаляется
+    struct ring_holder
+    {
+        std::shared_ptr<log_ring> ring;
+
+        ~ring_holder()
+        {
+            if (ring)
+                ring->orphan = true;
+        }
+    };
+
+    static std::mutex rings_lock;
+    static std::vector<std::shared_ptr<log_ring>> rings;
+    static std::atomic<uint64_t> dropped_count{0};
+    static std::atomic<bool> is_running{false};
+    static std::thread writer;
+    static int out_fd = 2;
+    static const ipc_time_t start_time = ipc_get_time();
+
+    static thread_local ring_holder local_ring;
+
+    //-----------------------------------------------------------------------------
+
+    static log_ring *get_ring()
+    {
+        if (!local_ring.ring)
+        {
+            auto ring = std::make_shared<log_ring>();
+            std::lock_guard<std::mutex> lock(rings_lock);
+            ring->id = rings.size();
+            rings.push_back(ring);
+            local_ring.ring = ring;
+        }
+        return local_ring.ring.get();
+    }
+
+    //-----------------------------------------------------------------------------
+
+    log_record *reserve()
+    {
+        log_ring *ring = get_ring();
+
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= log_ring::CAPACITY)
+        {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        log_record *rec = &ring->records[head & log_ring::MASK];
+        rec->time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(ipc_get_time() - start_time).count();
+        rec->thread = ring->id;
+        return rec;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    void commit(log_record *)
+    {
+        log_ring *ring = local_ring.ring.get();
+        ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    void write_data(const log_format *format, const uint8_t *data, size_t size)
+    {
+        while (size)
+        {
+            log_record *rec = reserve();
+            if (!rec)
+                return;
+
+            size_t n = std::min(size, LOG_MAX_DATA);
+            rec->format = format;
+            rec->size = n;
+            memcpy(rec->args, data, n);
+            commit(rec);
+
+            data += n;
+            size -= n;
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+
+    void set_level(log_level level)
+    {
+        current_level = level;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    bool parse_level(const char *name, log_level &level)
+    {
+        static const char *names[] = {"debug", "info", "warn", "error", "none"};
+        for (int i = LOG_DEBUG; i <= LOG_NONE; i++)
+        {
+            if (!strcmp(name, names[i]))
+            {
+                level = log_level(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    uint64_t dropped()
+    {
+        return dropped_count.load(std::memory_order_relaxed);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    static void format_record(std::string &out, const log_record &rec)
+    {
+        const char *p = rec.format->fmt;
+
+        // сырые данные выводятся как есть
+        if (!p)
+        {
+            out.append(reinterpret_cast<const char *>(rec.args), rec.size);
+            return;
+        }
+
+        char tmp[256];
+        snprintf(tmp, sizeof(tmp), "[%llu.%06llu] ", (unsigned long long)(rec.time_ns / 1000000000ull), (unsigned long long)(rec.time_ns / 1000ull % 1000000ull));
+        out += tmp;
+
+        unsigned argi = 0;
+        while (*p)
+        {
+            if (*p != '%')
+            {
+                const char *next = strchr(p, '%');
+                size_t len = next ? size_t(next - p) : strlen(p);
+                out.append(p, len);
+                p += len;
+                continue;
+            }
+
+            if (p[1] == '%')
+            {
+                out += '%';
+                p += 2;
+                continue;
+            }
+
+            // спецификация без модификатора длины: тип определяется по символу преобразования
+            const char *start = p++;
+            std::string spec("%");
+            while (*p && strchr("-+ #0", *p))
+                spec += *p++;
+            while (*p && (isdigit((unsigned char)*p) || *p == '.'))
+                spec += *p++;
+            while (*p && strchr("hlLqjzt", *p))
+                p++;
+
+            const char conv = *p ? *p++ : 0;
+            const uint64_t a = (argi < rec.size) ? rec.args[argi++] : 0;
+
+            switch (conv)
+            {
+            case 'd':
+            case 'i':
+                spec += "ll";
+                spec += conv;
+                snprintf(tmp, sizeof(tmp), spec.c_str(), (long long)a);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                spec += "ll";
+                spec += conv;
+                snprintf(tmp, sizeof(tmp), spec.c_str(), (unsigned long long)a);
+                break;
+            case 'c':
+                spec += conv;
+                snprintf(tmp, sizeof(tmp), spec.c_str(), (int)a);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            {
+                double d;
+                memcpy(&d, &a, sizeof(d));
+                spec += conv;
+                snprintf(tmp, sizeof(tmp), spec.c_str(), d);
+                break;
+            }
+            case 's':
+                spec += conv;
+                snprintf(tmp, sizeof(tmp), spec.c_str(), a ? reinterpret_cast<const char *>(a) : "(null)");
+                break;
+            case 'p':
+                spec += conv;
+                snprintf(tmp, sizeof(tmp), spec.c_str(), reinterpret_cast<void *>(a));
+                break;
+            default:
+                snprintf(tmp, sizeof(tmp), "%.*s", int(p - start), start);
+                break;
+            }
+            out += tmp;
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+
+    static void flush(std::string &out)
+    {
+        const char *data = out.data();
+        size_t size = out.size();
+        while (size)
+        {
+            ssize_t res = ::write(out_fd, data, size);
+            if (res <= 0)
+                break;
+            data += res;
+            size -= res;
+        }
+        out.clear();
+    }
+
+    //-----------------------------------------------------------------------------
+
+    //! Вычитывает все кольца; возвращает число обработанных записей
+    static size_t drain(std::string &out)
+    {
+        std::vector<std::shared_ptr<log_ring>> active;
+        {
+            std::lock_guard<std::mutex> lock(rings_lock);
+            active = rings;
+        }
+
+        size_t count = 0;
+        for (auto &ring : active)
+        {
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            const uint64_t head = ring->head.load(std::memory_order_acquire);
+
+            for (; tail != head; ++tail, ++count)
+            {
+                format_record(out, ring->records[tail & log_ring::MASK]);
+                if (out.size() >= 64 * 1024)
+                    flush(out);
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            // кольцо завершившегося потока удаляется после вычитывания
+            if (ring->orphan && tail == ring->head.load(std::memory_order_acquire))
+            {
+                std::lock_guard<std::mutex> lock(rings_lock);
+                for (auto it = rings.begin(); it != rings.end(); ++it)
+                {
+                    if (*it == ring)
+                    {
+                        rings.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+        return count;
+    }
+
+    //-----------------------------------------------------------------------------
+
+    static void writer_thread()
+    {
+        std::string out;
+        out.reserve(64 * 1024);
+        uint64_t reported = 0;
+
+        while (true)
+        {
+            const bool running = is_running.load();
+            const size_t count = drain(out);
+
+            const uint64_t lost = dropped();
+            if (lost != reported)
+            {
+                char tmp[64];
+                snprintf(tmp, sizeof(tmp), "\nulog: %llu records dropped\n", (unsigned long long)(lost - reported));
+                out += tmp;
+                reported = lost;
+            }
+
+            flush(out);
+
+            if (!running)
+                break;
+            if (!count)
+                ipc_delay(10);
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+
+    void start(log_level level, int fd)
+    {
+        set_level(level);
+        if (is_running.exchange(true))
+            return;
+        out_fd = fd;
+        writer = std::thread(writer_thread);
+    }
+
+    //-----------------------------------------------------------------------------
+
+    void stop()
+    {
+        if (!is_running.exchange(false))
+            return;
+        if (writer.joinable())
+            writer.join();
+    }
+};
+
+//-----------------------------------------------------------------------------
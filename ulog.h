@@ -0,0 +1,152 @@
+
+#ifndef ULOG_H
+#define ULOG_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <type_traits>
+
+//-----------------------------------------------------------------------------
+//! Асинхронный двоичный журнал.
+//! Рабочие потоки записывают в собственное кольцо без блокировок только
+//! указатель на описание формата и аргументы; форматирование и вывод выполняет
+//! фоновый поток. При заполнении кольца запись отбрасывается и учитывается
+//! в счетчике потерь, рабочий поток никогда не ждет вывода.
+//-----------------------------------------------------------------------------
+
+namespace ulog
+{
+    enum log_level
+    {
+        LOG_DEBUG,
+        LOG_INFO,
+        LOG_WARN,
+        LOG_ERROR,
+        LOG_NONE,
+    };
+
+    //! Описание места записи в журнал; создается статически в макросе ULOG,
+    //! его адрес служит идентификатором формата
+    struct log_format
+    {
+        log_level level;
+        const char *fmt;    //!< формат printf, nullptr - запись с сырыми данными
+        const char *file;
+        int line;
+    };
+
+    //! Максимальное число аргументов одной записи
+    constexpr unsigned LOG_MAX_ARGS = 6;
+
+    //! Запись кольца: формат, время и аргументы в виде 64-битных слов.
+    //! Аргументы %s должны указывать на строки со статическим временем жизни.
+    struct log_record
+    {
+        const log_format *format;
+        uint64_t time_ns;
+        uint32_t size;      //!< число аргументов или байт сырых данных
+        uint32_t thread;
+        uint64_t args[LOG_MAX_ARGS];
+    };
+
+    constexpr size_t LOG_MAX_DATA = sizeof(log_record::args);
+
+    extern std::atomic<int> current_level;
+
+    inline log_level get_level()
+    {
+        return log_level(current_level.load(std::memory_order_relaxed));
+    }
+
+    void set_level(log_level level);
+    bool parse_level(const char *name, log_level &level);
+
+    //! Запускает фоновый поток вывода в дескриптор fd
+    void start(log_level level, int fd = 2);
+    //! Выводит накопленные записи и останавливает фоновый поток
+    void stop();
+    //! Число отброшенных записей
+    uint64_t dropped();
+
+    //! Резервирует запись в кольце текущего потока (nullptr - кольцо заполнено)
+    log_record *reserve();
+    void commit(log_record *rec);
+
+    template <typename T>
+    inline uint64_t to_arg(T v)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            double d = v;
+            uint64_t u;
+            memcpy(&u, &d, sizeof(u));
+            return u;
+        }
+        else if constexpr (std::is_pointer_v<T>)
+        {
+            return reinterpret_cast<uintptr_t>(v);
+        }
+        else if constexpr (std::is_enum_v<T>)
+        {
+            return static_cast<uint64_t>(v);
+        }
+        else
+        {
+            static_assert(std::is_integral_v<T>, "unsupported log argument type");
+            return static_cast<uint64_t>(static_cast<std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>>(v));
+        }
+    }
+
+    template <typename... args_type>
+    inline void write(const log_format *format, args_type... args)
+    {
+        static_assert(sizeof...(args) <= LOG_MAX_ARGS, "too many log arguments");
+
+        log_record *rec = reserve();
+        if (!rec)
+            return;
+
+        rec->format = format;
+        rec->size = sizeof...(args);
+        unsigned i = 0;
+        ((rec->args[i++] = to_arg(args)), ...);
+        (void)i;
+        commit(rec);
+    }
+
+    //! Записывает сырые данные, при необходимости несколькими записями
+    void write_data(const log_format *format, const uint8_t *data, size_t size);
+};
+
+//-----------------------------------------------------------------------------
+
+#define ULOG(level, fmt, ...)                                                          \
+    do                                                                                 \
+    {                                                                                  \
+        if ((level) >= ulog::get_level())                                              \
+        {                                                                              \
+            static const ulog::log_format _ulog_format{(level), fmt, __FILE__, __LINE__}; \
+            ulog::write(&_ulog_format, ##__VA_ARGS__);                                 \
+        }                                                                              \
+    } while (0)
+
+#define ULOG_DATA(level, data, size)                                                   \
+    do                                                                                 \
+    {                                                                                  \
+        if ((level) >= ulog::get_level())                                              \
+        {                                                                              \
+            static const ulog::log_format _ulog_format{(level), nullptr, __FILE__, __LINE__}; \
+            ulog::write_data(&_ulog_format, (data), (size));                           \
+        }                                                                              \
+    } while (0)
+
+#define ULOG_DEBUG(fmt, ...) ULOG(ulog::LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define ULOG_INFO(fmt, ...) ULOG(ulog::LOG_INFO, fmt, ##__VA_ARGS__)
+#define ULOG_WARN(fmt, ...) ULOG(ulog::LOG_WARN, fmt, ##__VA_ARGS__)
+#define ULOG_ERROR(fmt, ...) ULOG(ulog::LOG_ERROR, fmt, ##__VA_ARGS__)
+
+//-----------------------------------------------------------------------------
+
+#endif // ULOG_H